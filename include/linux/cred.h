@@ -20,6 +20,7 @@
 #include <linux/uidgid.h>
 #include <linux/sched.h>
 #include <linux/sched/user.h>
+#include <linux/provenance_blob.h>
 
 struct cred;
 struct inode;
@@ -154,6 +155,9 @@ struct cred {
 	struct user_namespace *user_ns; /* user_ns the caps and keyrings are relative to. */
 	struct group_info *group_info;	/* supplementary groups for euid/fsgid */
 	struct rcu_head	rcu;		/* RCU deletion hook */
+#if defined(CONFIG_SECURITY) && defined(CONFIG_SECURITY_PROVENANCE)
+	struct provenance_blob provenance_blob;	/* provenance points here */
+#endif
 } __randomize_layout;
 
 extern void __put_cred(struct cred *);
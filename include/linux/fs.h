@@ -40,6 +40,7 @@
 
 #include <asm/byteorder.h>
 #include <uapi/linux/fs.h>
+#include <linux/provenance_blob.h>
 
 struct backing_dev_info;
 struct bdi_writeback;
@@ -706,6 +707,9 @@ struct inode {
 #endif
 
 	void			*i_private; /* fs or device private pointer */
+#if defined(CONFIG_SECURITY) && defined(CONFIG_SECURITY_PROVENANCE)
+	struct provenance_blob	i_provenance_blob; /* i_provenance points here */
+#endif
 } __randomize_layout;
 
 static inline unsigned int i_blocksize(const struct inode *node)
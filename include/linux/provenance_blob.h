@@ -0,0 +1,33 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _LINUX_PROVENANCE_BLOB_H
+#define _LINUX_PROVENANCE_BLOB_H
+
+#include <linux/types.h>
+#include <linux/spinlock_types.h>
+
+/*
+ * Storage for the provenance of an inode, cred or task, embedded in the object itself
+ * so that it is allocated, freed and cached with it.
+ * Opaque here to keep fs.h, cred.h and sched.h free of the provenance headers:
+ * its layout is "struct provenance" (security/provenance/include/provenance.h),
+ * which checks at build time that both agree.
+ */
+#define PROVENANCE_BLOB_WORDS   37      // union prov_elt, process or inode fields and query module state, in 64-bit words.
+
+struct provenance_blob {
+	uint64_t data[PROVENANCE_BLOB_WORDS];
+	spinlock_t lock;
+};
+
+#endif /* _LINUX_PROVENANCE_BLOB_H */
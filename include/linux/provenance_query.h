@@ -20,11 +20,22 @@
 
  #define QUERY_HOOK_INIT(HEAD, HOOK)    .HEAD = &HOOK
 
+/*
+ * Bytes of state the provenance core keeps with every node for query modules.
+ * A module asks for its share with "state_size" and gets a pointer to it, for each node, in flow, alloc and free
+ * (NULL for nodes without state, e.g. disclosed nodes).
+ * The state is allocated and zeroed with the node, and is accessed under the same locks as the node.
+ * Old versions of a node share the state of the node.
+ */
+ #define PROV_QUERY_STATE_SIZE          32
+
 struct provenance_query_hooks {
 	struct list_head list;
-	int (*flow)(prov_entry_t *, prov_entry_t *, prov_entry_t *);
-	int (*alloc)(prov_entry_t *);
-	int (*free)(prov_entry_t *);
+	int (*flow)(prov_entry_t *from, void *from_state, prov_entry_t *edge, prov_entry_t *to, void *to_state);
+	int (*alloc)(prov_entry_t *node, void *state);
+	int (*free)(prov_entry_t *node, void *state);
+	size_t state_size;              // Bytes of per-node state needed by the module (0 if none).
+	size_t state_offset;            // Set on registration: offset of the state of the module in the state of a node.
 };
 
 extern struct list_head provenance_query_hooks;
@@ -29,6 +29,7 @@
 #include <linux/mm_types_task.h>
 #include <linux/task_io_accounting.h>
 #include <linux/rseq.h>
+#include <linux/provenance_blob.h>
 
 /* task_struct member predeclarations (sorted alphabetically): */
 struct audit_context;
@@ -1202,6 +1203,7 @@ struct task_struct {
 #ifdef CONFIG_SECURITY_PROVENANCE
   /* Used by CamFlow module */
 	void 				*provenance;
+	struct provenance_blob		provenance_blob;
 #endif
 #endif
 
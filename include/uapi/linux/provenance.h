@@ -141,6 +141,8 @@ static inline bool prov_bloom_empty(const uint8_t bloom[PROV_N_BYTES])
 #define PROV_SECCTX                             "/sys/kernel/security/provenance/secctx"
 #define PROV_SECCTX_FILTER                      "/sys/kernel/security/provenance/secctx_filter"
 #define PROV_NS_FILTER                          "/sys/kernel/security/provenance/ns"
+#define PROV_SB_FILTER                          "/sys/kernel/security/provenance/sb_filter"
+#define PROV_XATTR_FILTER                       "/sys/kernel/security/provenance/xattr_filter"
 #define PROV_LOG_FILE                           "/sys/kernel/security/provenance/log"
 #define PROV_LOGP_FILE                          "/sys/kernel/security/provenance/logp"
 #define PROV_POLICY_HASH_FILE                   "/sys/kernel/security/provenance/policy_hash"
@@ -150,8 +152,20 @@ static inline bool prov_bloom_empty(const uint8_t bloom[PROV_N_BYTES])
 #define PROV_VERSION                            "/sys/kernel/security/provenance/version"
 #define PROV_COMMIT                             "/sys/kernel/security/provenance/commit"
 #define PROV_CHANNEL                            "/sys/kernel/security/provenance/channel"
+#define PROV_COMPACT_CHANNEL                    "/sys/kernel/security/provenance/compact_channel"
+#define PROV_LZ4_CHANNEL                        "/sys/kernel/security/provenance/lz4_channel"
+#define PROV_SIZED_CHANNEL                      "/sys/kernel/security/provenance/sized_channel"
+#define PROV_CHANNEL_FILTER                     "/sys/kernel/security/provenance/channel_filter"
+#define PROV_CPU_NODE_FILE                      "/sys/kernel/security/provenance/cpu_node"
 #define PROV_DUPLICATE_FILE                     "/sys/kernel/security/provenance/duplicate"
 #define PROV_EPOCH_FILE                         "/sys/kernel/security/provenance/epoch"
+#define PROV_SAMPLING_FILE                      "/sys/kernel/security/provenance/sampling"
+#define PROV_RATE_FILE                          "/sys/kernel/security/provenance/rate"
+#define PROV_SKIP_LOOKUP_FILE                   "/sys/kernel/security/provenance/skip_lookup"
+#define PROV_REDUCE_FILE                        "/sys/kernel/security/provenance/reduce"
+#define PROV_LAZY_THREAD_FILE                   "/sys/kernel/security/provenance/lazy_thread"
+#define PROV_USAGE_INTERVAL_FILE                "/sys/kernel/security/provenance/usage_interval"
+#define PROV_PATTERN_FILE                       "/sys/kernel/security/provenance/pattern"
 
 #define PROV_RELAY_NAME                         "/sys/kernel/debug/provenance"
 #define PROV_LONG_RELAY_NAME                    "/sys/kernel/debug/long_provenance"
@@ -170,6 +184,7 @@ static inline bool prov_bloom_empty(const uint8_t bloom[PROV_N_BYTES])
 #define node_gid(node)                          ((node)->node_info.gid)
 #define node_previous_id(node)                  ((node)->node_info.previous_id)
 #define node_previous_type(node)                ((node)->node_info.previous_type)
+#define node_previous_version(node)             ((node)->node_info.previous_version)
 #define node_kernel_version(node)               ((node)->node_info.k_version)
 
 
@@ -256,10 +271,16 @@ union prov_identifier {
 #define clear_saved(node)                       prov_clear_flag(node, SAVED_BIT)
 #define provenance_is_saved(node)               prov_check_flag(node, SAVED_BIT)
 
+#define HASHED_BIT              8       // xattr node: value holds the xxh64 of the value then its full size (PROV_XATTR_HASHED_SIZE), as does size
+#define set_hashed(node)                        prov_set_flag(node, HASHED_BIT)
+#define clear_hashed(node)                      prov_clear_flag(node, HASHED_BIT)
+#define provenance_is_hashed(node)              prov_check_flag(node, HASHED_BIT)
 
 
-#define basic_elements          union prov_identifier identifier; uint32_t epoch; uint32_t nepoch; uint32_t internal_flag; uint64_t jiffies; uint8_t taint[PROV_N_BYTES];
-#define shared_node_elements    uint64_t previous_id; uint64_t previous_type; uint32_t k_version; uint32_t secid; uint32_t uid; uint32_t gid; void *var_ptr
+
+/* record_size occupies what was padding before jiffies, the layout is unchanged */
+#define basic_elements          union prov_identifier identifier; uint32_t epoch; uint32_t nepoch; uint32_t internal_flag; uint32_t record_size; uint64_t jiffies; uint8_t taint[PROV_N_BYTES];
+#define shared_node_elements    uint64_t previous_id; uint64_t previous_type; uint32_t previous_version; uint32_t k_version; uint32_t secid; uint32_t uid; uint32_t gid; void *var_ptr
 
 struct msg_struct {
 	basic_elements;
@@ -275,6 +296,7 @@ struct relation_struct {
 	uint8_t set;
 	int64_t offset;
 	uint64_t flags;
+	uint32_t weight;
 };
 
 struct node_struct {
@@ -292,6 +314,29 @@ struct proc_prov_struct {
 	uint32_t pidns;
 	uint32_t netns;
 	uint32_t cgroupns;
+	/*
+	 * Resource usage. With usage_interval set, the values of the last resource_usage
+	 * sample of the thread group; otherwise the counters of the calling thread at
+	 * the last hook before the version was recorded.
+	 */
+	/* usec */
+	uint64_t utime;
+	uint64_t stime;
+	/* KB */
+	uint64_t vm;
+	uint64_t rss;
+	uint64_t hw_vm;
+	uint64_t hw_rss;
+	uint64_t rbytes;
+	uint64_t wbytes;
+	uint64_t cancel_wbytes;
+};
+
+/* periodic resource usage sample of a process, identified as its ENT_PROC node */
+struct usage_struct {
+	basic_elements;
+	shared_node_elements;
+	uint32_t tgid;
 	/* usec */
 	uint64_t utime;
 	uint64_t stime;
@@ -347,6 +392,7 @@ struct sb_struct {
 	basic_elements;
 	shared_node_elements;
 	uint8_t uuid[16];
+	uint8_t capture;                // PROV_SET_IGNORE or PROV_SET_OPAQUE, from the superblock filters
 };
 
 struct pck_struct {
@@ -367,6 +413,7 @@ union prov_elt {
 	struct sb_struct sb_info;
 	struct pck_struct pck_info;
 	struct iattr_prov_struct iattr_info;
+	struct usage_struct usage_info;
 };
 
 struct str_struct {
@@ -417,6 +464,7 @@ struct disc_node_struct {
 
 #define PROV_XATTR_NAME_SIZE            256
 #define PROV_XATTR_VALUE_SIZE           (PATH_MAX - PROV_XATTR_NAME_SIZE)
+#define PROV_XATTR_HASHED_SIZE          (2 * sizeof(uint64_t))  // value of a hashed node: xxh64 of the value, then its full size
 struct xattr_prov_struct {
 	basic_elements;
 	shared_node_elements;
@@ -447,6 +495,7 @@ union long_prov_elt {
 	struct sb_struct sb_info;
 	struct pck_struct pck_info;
 	struct iattr_prov_struct iattr_info;
+	struct usage_struct usage_info;
 	struct str_struct str_info;
 	struct file_name_struct file_name_info;
 	struct arg_struct arg_info;
@@ -471,6 +520,8 @@ struct prov_filter {
 #define PROV_SET_TAINT          0x08
 #define PROV_SET_DELETE         0x10
 #define PROV_SET_RECORD         0x20
+#define PROV_SET_IGNORE         0x40
+#define PROV_SET_HASH           0x80
 
 struct prov_process_config {
 	union prov_elt prov;
@@ -506,6 +557,32 @@ struct groupinfo {
 	uint64_t taint;
 };
 
+struct prov_sampling {
+	uint64_t type;
+	uint32_t rate;
+};
+
+struct prov_rate {
+	uint32_t rate;
+	uint32_t burst;
+};
+
+/* cpu_node holds one uint32_t NUMA node per CPU id, PROV_NO_NODE for impossible CPUs */
+#define PROV_NO_NODE                    0xFFFFFFFF
+
+#define PROV_CHANNEL_NODE_FILTER        0
+#define PROV_CHANNEL_DERIVED_FILTER     1
+#define PROV_CHANNEL_GENERATED_FILTER   2
+#define PROV_CHANNEL_USED_FILTER        3
+#define PROV_CHANNEL_INFORMED_FILTER    4
+#define PROV_CHANNEL_NB_FILTER          5
+
+struct prov_channel_filter {
+	char channel[NAME_MAX + 1];     // name the channel was created with
+	uint8_t kind;                   // PROV_CHANNEL_*_FILTER
+	struct prov_filter filter;
+};
+
 #define IGNORE_NS    0
 
 struct nsinfo {
@@ -519,4 +596,58 @@ struct nsinfo {
 	uint64_t taint;
 };
 
+#define PROV_FSTYPE_LEN    32
+
+/* Capture mode of the superblocks of a file system type or, fstype left empty, of one superblock (i.e., mount) by UUID. */
+struct sbinfo {
+	char fstype[PROV_FSTYPE_LEN];
+	uint8_t uuid[16];
+	uint8_t op;                     // PROV_SET_IGNORE, PROV_SET_OPAQUE, or PROV_SET_DELETE
+};
+
+/*
+ * How the value of an xattr is recorded: hashed (PROV_SET_HASH) or copied (0).
+ * name is an xattr name, a prefix ending with '.' (e.g., "security."), or empty to match any xattr.
+ */
+struct xattrinfo {
+	char name[PROV_XATTR_NAME_SIZE];
+	uint8_t op;                     // PROV_SET_HASH, 0, or PROV_SET_DELETE
+};
+
+#define PROV_PATTERN_MAX_STEPS  8
+#define PROV_PATTERN_STATES     64      // Partial match states shared by all the patterns loaded.
+
+#define PROV_MATCH_UID          0x01
+#define PROV_MATCH_GID          0x02
+#define PROV_MATCH_TAINT        0x04
+#define PROV_MATCH_TRACKED      0x08
+
+/* A node of a path pattern, and the relation leading to it (ignored for the first node). */
+struct prov_pattern_step {
+	uint64_t relation;              // relation type or category (e.g., RL_USED), 0 for any
+	uint64_t node;                  // node type or category (e.g., DM_ENTITY), 0 for any
+	uint64_t taint;                 // taint the node carries, if PROV_MATCH_TAINT
+	uint32_t uid;                   // uid of the node, if PROV_MATCH_UID
+	uint32_t gid;                   // gid of the node, if PROV_MATCH_GID
+	uint8_t match;                  // PROV_MATCH_* predicates on the node
+};
+
+#define PROV_PATTERN_WARN       0x01
+#define PROV_PATTERN_PREVENT    0x02
+
+/*
+ * A path of flows between nodes (e.g., a process reads a tainted file, then writes to a socket), matched as flows happen.
+ * A node keeps the partial matches it ends, a pattern of n steps uses n - 2 of the PROV_PATTERN_STATES states.
+ * Loading or deleting a pattern restarts matching from scratch.
+ * See tools/pattern.c for the text syntax.
+ */
+struct prov_pattern {
+	uint32_t id;                    // chosen by the user, identifies the pattern to replace or delete
+	uint8_t op;                     // 0 or PROV_SET_DELETE
+	uint8_t action;                 // PROV_PATTERN_WARN and/or PROV_PATTERN_PREVENT when the path is complete
+	uint8_t length;                 // number of steps, 2 to PROV_PATTERN_MAX_STEPS
+	uint64_t matches;               // number of complete matches, on read
+	struct prov_pattern_step steps[PROV_PATTERN_MAX_STEPS];
+};
+
 #endif
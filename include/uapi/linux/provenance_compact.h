@@ -0,0 +1,572 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Compact relay wire format (version 2).
+ *
+ * Every sub-buffer of a compact channel starts with a struct prov_compact_header
+ * carrying the boot and machine IDs of the emitting kernel. Records follow, each
+ * starting with a tag byte: the two low bits give the kind of record, the six
+ * high bits flag which optional fields are present.
+ * Identifiers are encoded as zigzag varint deltas against the previous record of
+ * the same sub-buffer, boot and machine IDs are elided when they match the header,
+ * and the type-specific tail of nodes is run-length encoded on zero bytes.
+ * Kernel-only fields (nepoch, k_version and var_ptr) and structure padding are
+ * not transmitted; they decode as zero. The flags of relations are transmitted,
+ * when non-zero, like the other optional fields of relations.
+ * record_size is not transmitted either, it is derived from the type on decoding.
+ * The encoder state is reset at every sub-buffer boundary, so a consumer can start
+ * decoding from any sub-buffer.
+ */
+#ifndef _UAPI_LINUX_PROVENANCE_COMPACT_H
+#define _UAPI_LINUX_PROVENANCE_COMPACT_H
+
+#ifdef __KERNEL__
+#include <linux/stddef.h>
+#include <linux/string.h>
+#else
+#include <stddef.h>
+#include <string.h>
+#endif
+#include <linux/provenance.h>
+#include <linux/provenance_types.h>
+
+#define PROV_FORMAT_RAW                 0
+#define PROV_FORMAT_COMPACT             1
+#define PROV_FORMAT_LZ4                 2       // see include/uapi/linux/provenance_lz4.h
+#define PROV_FORMAT_SIZED               3       // raw records cut to record_size, see prov_record_size
+
+#define PROV_COMPACT_VERSION            2
+#define PROV_COMPACT_MAGIC              0x766f7270      // "prov"
+
+/* record kinds (two low bits of the tag) */
+#define PROV_COMPACT_HEADER             0
+#define PROV_COMPACT_RELATION           1
+#define PROV_COMPACT_NODE               2
+#define PROV_COMPACT_LONG_NODE          3
+#define PROV_COMPACT_KIND_MASK          0x03
+
+/* relation presence flags */
+#define PROV_COMPACT_R_OFFSET           (1 << 2)
+#define PROV_COMPACT_R_ALLOWED          (1 << 3)
+#define PROV_COMPACT_R_FLAGS            (1 << 4)
+#define PROV_COMPACT_R_WEIGHT           (1 << 5)
+#define PROV_COMPACT_R_SET              (1 << 6)
+#define PROV_COMPACT_R_TAINT            (1 << 7)
+
+/* node presence flags */
+#define PROV_COMPACT_N_TAINT            (1 << 2)
+#define PROV_COMPACT_N_PREVIOUS         (1 << 3)
+#define PROV_COMPACT_N_CRED             (1 << 4)
+#define PROV_COMPACT_N_FLAG             (1 << 5)
+
+/* worst case size of an encoded record */
+#define PROV_COMPACT_MAX_SIZE           (sizeof(union long_prov_elt) + 256)
+
+struct prov_compact_header {
+	uint8_t tag;            // PROV_COMPACT_HEADER
+	uint8_t version;        // PROV_COMPACT_VERSION
+	uint16_t size;          // Size of this header, records start right after it.
+	uint32_t magic;         // PROV_COMPACT_MAGIC, lets consumers resynchronise.
+	uint32_t sequence;      // Sub-buffer sequence number on this CPU.
+	uint32_t boot_id;
+	uint32_t machine_id;
+};
+
+struct prov_compact_state {
+	uint64_t last_relation_id;
+	uint64_t last_node_id;
+	uint64_t last_jiffies;
+	uint32_t boot_id;
+	uint32_t machine_id;
+};
+
+/*!
+ * @brief Size of the structure that records a type, as set in record_size.
+ *
+ * Sized channels (PROV_FORMAT_SIZED) emit regular records cut to this size,
+ * consumers walk them with the record_size of each record.
+ * Long records have the size of union long_prov_elt, see prov_long_record_size.
+ */
+static inline uint32_t prov_record_size(uint64_t type)
+{
+	if (prov_type_is_relation(type))
+		return sizeof(struct relation_struct);
+	switch (type) {
+	case ACT_TASK:
+		return sizeof(struct task_prov_struct);
+	case ENT_PROC:
+		return sizeof(struct proc_prov_struct);
+	case ENT_USAGE:
+		return sizeof(struct usage_struct);
+	case ENT_INODE_UNKNOWN:
+	case ENT_INODE_LINK:
+	case ENT_INODE_FILE:
+	case ENT_INODE_DIRECTORY:
+	case ENT_INODE_CHAR:
+	case ENT_INODE_BLOCK:
+	case ENT_INODE_PIPE:
+	case ENT_INODE_SOCKET:
+		return sizeof(struct inode_prov_struct);
+	case ENT_IATTR:
+		return sizeof(struct iattr_prov_struct);
+	case ENT_MSG:
+		return sizeof(struct msg_msg_struct);
+	case ENT_SHM:
+		return sizeof(struct shm_struct);
+	case ENT_SBLCK:
+		return sizeof(struct sb_struct);
+	case ENT_PACKET:
+		return sizeof(struct pck_struct);
+	default:
+		return sizeof(union prov_elt);
+	}
+}
+
+/*!
+ * @brief Size of a long record, as set in record_size.
+ *
+ * Hashed xattr nodes stop after the hash and the size of the value (see PROV_XATTR_HASHED_SIZE);
+ * sized channels emit them at that size. Every other long record has the size of union long_prov_elt.
+ */
+static inline uint32_t prov_long_record_size(const union long_prov_elt *elt)
+{
+	if (prov_type(elt) == ENT_XATTR && provenance_is_hashed(elt))
+		return offsetof(struct xattr_prov_struct, value) + PROV_XATTR_HASHED_SIZE;
+	return sizeof(union long_prov_elt);
+}
+
+static inline void prov_compact_reset(struct prov_compact_state *s, uint32_t boot_id, uint32_t machine_id)
+{
+	memset(s, 0, sizeof(struct prov_compact_state));
+	s->boot_id = boot_id;
+	s->machine_id = machine_id;
+}
+
+static inline void prov_compact_write_header(void *out, const struct prov_compact_state *s, uint32_t sequence)
+{
+	struct prov_compact_header *hdr = out;
+
+	hdr->tag = PROV_COMPACT_HEADER;
+	hdr->version = PROV_COMPACT_VERSION;
+	hdr->size = sizeof(struct prov_compact_header);
+	hdr->magic = PROV_COMPACT_MAGIC;
+	hdr->sequence = sequence;
+	hdr->boot_id = s->boot_id;
+	hdr->machine_id = s->machine_id;
+}
+
+static inline uint8_t *__compact_put(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline bool __compact_get(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	unsigned int shift = 0;
+	uint8_t b;
+
+	*v = 0;
+	do {
+		if (*p >= end || shift > 63)
+			return false;
+		b = *(*p)++;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return true;
+}
+
+static inline uint64_t __compact_zigzag(uint64_t delta)
+{
+	return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t __compact_unzigzag(uint64_t v)
+{
+	return (v >> 1) ^ (uint64_t)-(int64_t)(v & 1);
+}
+
+/* Types have the W3C type and family in the top 16 bits and a one-hot subtype. */
+static inline uint8_t *__compact_put_type(uint8_t *p, uint64_t type)
+{
+	uint64_t subtype = type & 0x0000FFFFFFFFFFFFULL;
+
+	p = __compact_put(p, type >> 48);
+	if (subtype && !(subtype & (subtype - 1)))
+		return __compact_put(p, __builtin_ctzll(subtype) + 1);
+	p = __compact_put(p, 0);
+	return __compact_put(p, subtype);
+}
+
+static inline bool __compact_get_type(const uint8_t **p, const uint8_t *end, uint64_t *type)
+{
+	uint64_t high, bit, subtype;
+
+	if (!__compact_get(p, end, &high) || !__compact_get(p, end, &bit))
+		return false;
+	if (bit > 48)
+		return false;
+	if (bit)
+		subtype = 1ULL << (bit - 1);
+	else if (!__compact_get(p, end, &subtype))
+		return false;
+	*type = (high << 48) | subtype;
+	return true;
+}
+
+/* Node and relation identifiers; the low bit of the id delta flags foreign boot/machine IDs. */
+static inline uint8_t *__compact_put_id(uint8_t *p, const union prov_identifier *id, uint64_t *last, bool relation, const struct prov_compact_state *s)
+{
+	bool foreign = id->node_id.boot_id != s->boot_id || id->node_id.machine_id != s->machine_id;
+
+	p = __compact_put_type(p, id->node_id.type);
+	if (id->node_id.type == ENT_PACKET) {
+		memcpy(p, id->buffer + sizeof(uint64_t), PROV_IDENTIFIER_BUFFER_LENGTH - sizeof(uint64_t));
+		return p + PROV_IDENTIFIER_BUFFER_LENGTH - sizeof(uint64_t);
+	}
+	p = __compact_put(p, (__compact_zigzag(id->node_id.id - *last) << 1) | foreign);
+	*last = id->node_id.id;
+	if (!relation)
+		p = __compact_put(p, id->node_id.version);
+	if (foreign) {
+		p = __compact_put(p, id->node_id.boot_id);
+		p = __compact_put(p, id->node_id.machine_id);
+	}
+	return p;
+}
+
+static inline bool __compact_get_id(const uint8_t **p, const uint8_t *end, union prov_identifier *id, uint64_t *last, bool relation, const struct prov_compact_state *s)
+{
+	uint64_t v, boot_id, machine_id;
+
+	if (!__compact_get_type(p, end, &id->node_id.type))
+		return false;
+	if (id->node_id.type == ENT_PACKET) {
+		if (end - *p < (long)(PROV_IDENTIFIER_BUFFER_LENGTH - sizeof(uint64_t)))
+			return false;
+		memcpy(id->buffer + sizeof(uint64_t), *p, PROV_IDENTIFIER_BUFFER_LENGTH - sizeof(uint64_t));
+		*p += PROV_IDENTIFIER_BUFFER_LENGTH - sizeof(uint64_t);
+		return true;
+	}
+	if (!__compact_get(p, end, &v))
+		return false;
+	id->node_id.id = *last + __compact_unzigzag(v >> 1);
+	*last = id->node_id.id;
+	if (!relation) {
+		if (!__compact_get(p, end, &boot_id))
+			return false;
+		id->node_id.version = boot_id;
+	}
+	boot_id = s->boot_id;
+	machine_id = s->machine_id;
+	if ((v & 1) && (!__compact_get(p, end, &boot_id) || !__compact_get(p, end, &machine_id)))
+		return false;
+	id->node_id.boot_id = boot_id;
+	id->node_id.machine_id = machine_id;
+	return true;
+}
+
+static inline uint8_t *__compact_put_basic(uint8_t *p, const union long_prov_elt *elt, struct prov_compact_state *s)
+{
+	p = __compact_put(p, elt->msg_info.epoch);
+	p = __compact_put(p, __compact_zigzag(elt->msg_info.jiffies - s->last_jiffies));
+	s->last_jiffies = elt->msg_info.jiffies;
+	return p;
+}
+
+static inline bool __compact_get_basic(const uint8_t **p, const uint8_t *end, union long_prov_elt *elt, struct prov_compact_state *s)
+{
+	uint64_t v;
+
+	if (!__compact_get(p, end, &v))
+		return false;
+	elt->msg_info.epoch = v;
+	if (!__compact_get(p, end, &v))
+		return false;
+	elt->msg_info.jiffies = s->last_jiffies + __compact_unzigzag(v);
+	s->last_jiffies = elt->msg_info.jiffies;
+	return true;
+}
+
+#define PROV_COMPACT_MIN_ZERO_RUN       8
+
+/* End of the run of zero bytes starting at pos, scanning a word at a time. */
+static inline size_t __compact_skip_zeros(const uint8_t *data, size_t pos, size_t end)
+{
+	uint64_t word;
+
+	for (; pos + sizeof(uint64_t) <= end; pos += sizeof(uint64_t)) {
+		memcpy(&word, data + pos, sizeof(uint64_t));
+		if (word)
+			break;
+	}
+	for (; pos < end && !data[pos]; pos++)
+		;
+	return pos;
+}
+
+/* Tail of a node: repeated [zero run][literal length][literal], ended by [0][0]. */
+static inline uint8_t *__compact_put_tail(uint8_t *p, const uint8_t *data, size_t start, size_t end)
+{
+	size_t i = start, j, lit, zeros;
+
+	while (i < end) {
+		lit = __compact_skip_zeros(data, i, end);
+		if (lit == end)
+			break;
+		j = lit;
+		while (j < end) {
+			if (data[j]) {
+				j++;
+				continue;
+			}
+			zeros = __compact_skip_zeros(data, j, end);
+			if (zeros - j >= PROV_COMPACT_MIN_ZERO_RUN || zeros == end)
+				break;
+			j = zeros;
+		}
+		p = __compact_put(p, lit - i);
+		p = __compact_put(p, j - lit);
+		memcpy(p, data + lit, j - lit);
+		p += j - lit;
+		i = j;
+	}
+	*p++ = 0;
+	*p++ = 0;
+	return p;
+}
+
+static inline bool __compact_get_tail(const uint8_t **p, const uint8_t *end, uint8_t *data, size_t start, size_t size)
+{
+	size_t pos = start;
+	uint64_t zeros, lit;
+
+	for (;;) {
+		if (!__compact_get(p, end, &zeros) || !__compact_get(p, end, &lit))
+			return false;
+		if (!zeros && !lit)
+			return true;
+		if (zeros > size - pos || lit > size - pos - zeros || lit > (uint64_t)(end - *p))
+			return false;
+		pos += zeros;
+		memcpy(data + pos, *p, lit);
+		*p += lit;
+		pos += lit;
+	}
+}
+
+/*!
+ * @brief Encode a record in the compact wire format.
+ * @param s Encoder state of the current sub-buffer, updated.
+ * @param record The record (a union prov_elt if is_long is false).
+ * @param is_long Whether the record is a union long_prov_elt.
+ * @param out Output buffer of at least PROV_COMPACT_MAX_SIZE bytes.
+ * @return The number of bytes written to out.
+ */
+static inline size_t prov_compact_encode(struct prov_compact_state *s, const void *record, bool is_long, uint8_t *out)
+{
+	const union long_prov_elt *elt = record;
+	const struct relation_struct *r = &elt->relation_info;
+	const struct node_struct *n = &elt->node_info;
+	uint8_t *p = out + 1;
+	uint8_t tag;
+
+	if (prov_is_relation(elt)) {
+		tag = PROV_COMPACT_RELATION;
+		if (r->offset)
+			tag |= PROV_COMPACT_R_OFFSET;
+		if (r->allowed)
+			tag |= PROV_COMPACT_R_ALLOWED;
+		if (r->flags)
+			tag |= PROV_COMPACT_R_FLAGS;
+		if (r->weight != 1)
+			tag |= PROV_COMPACT_R_WEIGHT;
+		if (r->set)
+			tag |= PROV_COMPACT_R_SET;
+		if (!prov_bloom_empty(r->taint))
+			tag |= PROV_COMPACT_R_TAINT;
+		p = __compact_put_id(p, &r->identifier, &s->last_relation_id, true, s);
+		p = __compact_put_basic(p, elt, s);
+		p = __compact_put_id(p, &r->snd, &s->last_node_id, false, s);
+		p = __compact_put_id(p, &r->rcv, &s->last_node_id, false, s);
+		if (tag & PROV_COMPACT_R_OFFSET)
+			p = __compact_put(p, __compact_zigzag(r->offset));
+		if (tag & PROV_COMPACT_R_ALLOWED)
+			p = __compact_put(p, r->allowed);
+		if (tag & PROV_COMPACT_R_FLAGS)
+			p = __compact_put(p, r->flags);
+		if (tag & PROV_COMPACT_R_WEIGHT)
+			p = __compact_put(p, r->weight);
+		if (tag & PROV_COMPACT_R_SET)
+			p = __compact_put(p, r->set);
+		if (tag & PROV_COMPACT_R_TAINT) {
+			memcpy(p, r->taint, PROV_N_BYTES);
+			p += PROV_N_BYTES;
+		}
+		out[0] = tag;
+		return p - out;
+	}
+
+	tag = is_long ? PROV_COMPACT_LONG_NODE : PROV_COMPACT_NODE;
+	if (!prov_bloom_empty(n->taint))
+		tag |= PROV_COMPACT_N_TAINT;
+	if (n->previous_id || n->previous_type || n->previous_version)
+		tag |= PROV_COMPACT_N_PREVIOUS;
+	if (n->secid || n->uid || n->gid)
+		tag |= PROV_COMPACT_N_CRED;
+	if (n->internal_flag)
+		tag |= PROV_COMPACT_N_FLAG;
+	p = __compact_put_id(p, &n->identifier, &s->last_node_id, false, s);
+	p = __compact_put_basic(p, elt, s);
+	if (tag & PROV_COMPACT_N_TAINT) {
+		memcpy(p, n->taint, PROV_N_BYTES);
+		p += PROV_N_BYTES;
+	}
+	if (tag & PROV_COMPACT_N_PREVIOUS) {
+		p = __compact_put(p, __compact_zigzag(n->previous_id - n->identifier.node_id.id));
+		p = __compact_put_type(p, n->previous_type);
+		p = __compact_put(p, n->previous_version);
+	}
+	if (tag & PROV_COMPACT_N_CRED) {
+		p = __compact_put(p, n->secid);
+		p = __compact_put(p, n->uid);
+		p = __compact_put(p, n->gid);
+	}
+	if (tag & PROV_COMPACT_N_FLAG)
+		p = __compact_put(p, n->internal_flag);
+	p = __compact_put_tail(p, record, sizeof(struct node_struct),
+			       is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt));
+	out[0] = tag;
+	return p - out;
+}
+
+/*!
+ * @brief Decode one compact record or sub-buffer header.
+ * @param s Decoder state, reset by headers and updated by records.
+ * @param in Input bytes.
+ * @param len Number of input bytes available.
+ * @param out Receives the record, zeroed first; must hold a union long_prov_elt.
+ * @param kind Receives the kind of what was decoded (PROV_COMPACT_HEADER, PROV_COMPACT_RELATION...).
+ * @return The number of bytes consumed; -1 if the input is truncated or corrupt.
+ */
+static inline long prov_compact_decode(struct prov_compact_state *s, const uint8_t *in, size_t len, union long_prov_elt *out, int *kind)
+{
+	const uint8_t *p = in + 1, *end = in + len;
+	struct relation_struct *r = &out->relation_info;
+	struct node_struct *n = &out->node_info;
+	struct prov_compact_header hdr;
+	uint64_t v;
+	uint8_t tag;
+
+	if (!len)
+		return -1;
+	tag = in[0];
+	*kind = tag & PROV_COMPACT_KIND_MASK;
+	if (*kind == PROV_COMPACT_HEADER) {
+		if (len < sizeof(struct prov_compact_header))
+			return -1;
+		memcpy(&hdr, in, sizeof(struct prov_compact_header));
+		if (hdr.tag || hdr.version != PROV_COMPACT_VERSION || hdr.magic != PROV_COMPACT_MAGIC
+		    || hdr.size < sizeof(struct prov_compact_header) || hdr.size > len)
+			return -1;
+		prov_compact_reset(s, hdr.boot_id, hdr.machine_id);
+		return hdr.size;
+	}
+
+	memset(out, 0, *kind == PROV_COMPACT_LONG_NODE ? sizeof(union long_prov_elt) : sizeof(union prov_elt));
+	if (*kind == PROV_COMPACT_RELATION) {
+		if (!__compact_get_id(&p, end, &r->identifier, &s->last_relation_id, true, s)
+		    || !__compact_get_basic(&p, end, out, s)
+		    || !__compact_get_id(&p, end, &r->snd, &s->last_node_id, false, s)
+		    || !__compact_get_id(&p, end, &r->rcv, &s->last_node_id, false, s))
+			return -1;
+		r->weight = 1;
+		if (tag & PROV_COMPACT_R_OFFSET) {
+			if (!__compact_get(&p, end, &v))
+				return -1;
+			r->offset = __compact_unzigzag(v);
+		}
+		if (tag & PROV_COMPACT_R_ALLOWED) {
+			if (!__compact_get(&p, end, &v))
+				return -1;
+			r->allowed = v;
+		}
+		if (tag & PROV_COMPACT_R_FLAGS) {
+			if (!__compact_get(&p, end, &v))
+				return -1;
+			r->flags = v;
+		}
+		if (tag & PROV_COMPACT_R_WEIGHT) {
+			if (!__compact_get(&p, end, &v))
+				return -1;
+			r->weight = v;
+		}
+		if (tag & PROV_COMPACT_R_SET) {
+			if (!__compact_get(&p, end, &v))
+				return -1;
+			r->set = v;
+		}
+		if (tag & PROV_COMPACT_R_TAINT) {
+			if (end - p < PROV_N_BYTES)
+				return -1;
+			memcpy(r->taint, p, PROV_N_BYTES);
+			p += PROV_N_BYTES;
+		}
+		r->record_size = prov_record_size(r->identifier.relation_id.type);
+		return p - in;
+	}
+
+	if (!__compact_get_id(&p, end, &n->identifier, &s->last_node_id, false, s)
+	    || !__compact_get_basic(&p, end, out, s))
+		return -1;
+	if (tag & PROV_COMPACT_N_TAINT) {
+		if (end - p < PROV_N_BYTES)
+			return -1;
+		memcpy(n->taint, p, PROV_N_BYTES);
+		p += PROV_N_BYTES;
+	}
+	if (tag & PROV_COMPACT_N_PREVIOUS) {
+		if (!__compact_get(&p, end, &v))
+			return -1;
+		n->previous_id = n->identifier.node_id.id + __compact_unzigzag(v);
+		if (!__compact_get_type(&p, end, &n->previous_type) || !__compact_get(&p, end, &v))
+			return -1;
+		n->previous_version = v;
+	}
+	if (tag & PROV_COMPACT_N_CRED) {
+		if (!__compact_get(&p, end, &v))
+			return -1;
+		n->secid = v;
+		if (!__compact_get(&p, end, &v))
+			return -1;
+		n->uid = v;
+		if (!__compact_get(&p, end, &v))
+			return -1;
+		n->gid = v;
+	}
+	if (tag & PROV_COMPACT_N_FLAG) {
+		if (!__compact_get(&p, end, &v))
+			return -1;
+		n->internal_flag = v;
+	}
+	if (!__compact_get_tail(&p, end, (uint8_t *)out, sizeof(struct node_struct),
+				*kind == PROV_COMPACT_LONG_NODE ? sizeof(union long_prov_elt) : sizeof(union prov_elt)))
+		return -1;
+	n->record_size = *kind == PROV_COMPACT_LONG_NODE ? prov_long_record_size((union long_prov_elt *)out) : prov_record_size(n->identifier.node_id.type);
+	return p - in;
+}
+
+#endif /* _UAPI_LINUX_PROVENANCE_COMPACT_H */
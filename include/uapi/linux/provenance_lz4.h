@@ -0,0 +1,41 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * LZ4 framed relay channels.
+ *
+ * Records are staged per CPU in blocks of PROV_LZ4_BLOCK_SIZE bytes. Once a block
+ * is full (or on flush) it is compressed with LZ4 (block format) and written to the
+ * relay channel as one frame: a struct prov_lz4_frame followed by csize bytes of
+ * payload. A frame never spans two sub-buffers. Decompressed, the payload is a
+ * sequence of raw records (union prov_elt or union long_prov_elt, depending on
+ * the channel).
+ */
+#ifndef _UAPI_LINUX_PROVENANCE_LZ4_H
+#define _UAPI_LINUX_PROVENANCE_LZ4_H
+
+#define PROV_LZ4_MAGIC                  0x347a6c70      // "plz4"
+#define PROV_LZ4_VERSION                1
+#define PROV_LZ4_BLOCK_SIZE             (1 << 16)
+
+/* frame flags */
+#define PROV_LZ4_STORED                 0x0001          // payload did not compress, stored as is
+
+struct prov_lz4_frame {
+	uint32_t magic;         // PROV_LZ4_MAGIC
+	uint16_t version;       // PROV_LZ4_VERSION
+	uint16_t flags;
+	uint32_t size;          // Bytes of records once decompressed.
+	uint32_t csize;         // Bytes of payload following this header.
+	uint32_t sequence;      // Block number on this CPU.
+	uint32_t lost;          // Records dropped on this CPU since the previous frame.
+};
+
+#endif /* _UAPI_LINUX_PROVENANCE_LZ4_H */
@@ -129,6 +129,8 @@
 #define RL_MMAP_EXEC_PRIVATE                    (RL_USED        | (0x0000000000000001ULL << 28))
 #define RL_MMAP_WRITE_PRIVATE                   (RL_USED        | (0x0000000000000001ULL << 29))
 #define RL_LOAD_FILE                            (RL_USED        | (0x0000000000000001ULL << 30))
+#define RL_AGGREGATE                            (RL_USED        | (0x0000000000000001ULL << 31))
+#define RL_AGGREGATE_THREADS                    (RL_USED        | (0x0000000000000001ULL << 32))
 /* no more than 51!!!! */
 
 /* INFORMED SUBTYPES */
@@ -181,6 +183,7 @@
 #define ENT_ARG                                 (DM_ENTITY    | (0x0000000000000001ULL << 25))
 #define ENT_ENV                                 (DM_ENTITY    | (0x0000000000000001ULL << 26))
 #define ENT_PROC                                (DM_ENTITY    | (0x0000000000000001ULL << 27))
+#define ENT_USAGE                               (DM_ENTITY    | (0x0000000000000001ULL << 28))
 
 #define prov_type(prov)                 ((prov)->node_info.identifier.node_id.type)
 #define node_type(node)                 prov_type(node)
@@ -7,82 +7,203 @@
 # published by the Free Software Foundation; either version 2 of the License,
 # or (at your option) any later version.
 
+from __future__ import print_function
 import sqlite3
 import sys
-import logging
-from collections import deque
 import re
+import hashlib
+import pickle
+from collections import deque
+
+CACHE_VERSION = 1
 
-def getCallee(cursor, caller, callmap):
+def loadGraph(cursor):
 	'''
-	This function gets all the functions called by the caller, and record the level of the functions
+	This function loads the whole callgraph in memory, in two queries.
+
+	@param cursor The cursor that traverses through the SQLite database
+	@return (names, keys, callees): function ID -> name, function ID -> (name, file), caller ID -> list of callee IDs
 	'''
-	cursor.execute('SELECT c.Caller, c.Callee, f.File FROM functions AS f INNER JOIN calls AS c ON f.Id = c.Caller WHERE Caller = ?', (caller,))
-	calleelist = []
-	for callee in cursor.fetchall():	# all the functions called by the caller
-		calleelist.append(callee[1])	# callee[1] is the function ID of the callee function
-	if caller not in callmap:
-		callmap[caller] = calleelist
-	return calleelist
-
-def check_callmap(cursor, callmap, to_print):
-	"""
-	If to_print, we print the callmap
-	"""
-	pattern = re.compile("security_")	# All LSM hooks must start with "security_"
-	hooks = []
-	for caller in callmap:
-		callername = cursor.execute('SELECT f.Name FROM functions AS f WHERE Id = ?', (str(caller),)).fetchone()[0]	# ID should be unique
-		if pattern.match(callername) is not None:
-			hooks.append(callername)
-		for callee in callmap[caller]:
-			calleename = cursor.execute('SELECT f.Name FROM functions AS f WHERE Id = ?', (str(callee),)).fetchone()[0]
-			if pattern.match(calleename) is not None:
-				hooks.append(calleename)
-			if to_print:
-				callees += str(calleename) + ', '
-		if to_print:
-			print(callername + ": " + callees)
-	return hooks
+	names = {}
+	keys = {}
+	for fid, name, path in cursor.execute('SELECT Id, Name, File FROM functions'):
+		names[fid] = name
+		keys[fid] = (name, path)
+	callees = {}
+	for caller, callee in cursor.execute('SELECT Caller, Callee FROM calls'):
+		if caller in names and callee in names:	# The plugin may record calls to functions it never saw defined
+			callees.setdefault(caller, []).append(callee)
+	return names, keys, callees
+
+def fingerprints(keys, callees):
+	'''
+	This function fingerprints every function by its callees.
+	IDs are not stable across builds of the database, so functions are keyed by (name, file).
+	A function whose fingerprint changed may now reach different LSM hooks, and so may its callers.
+	'''
+	children = {}
+	for fid, key in keys.items():
+		children.setdefault(key, set()).update(keys[callee] for callee in callees.get(fid, ()))
+	prints = {}
+	for key, calls in children.items():
+		h = hashlib.md5()
+		for name, path in sorted(calls, key=lambda k: (k[0] or u'', k[1] or u'')):
+			h.update((u'%s\0%s\n' % (name, path)).encode('utf-8'))
+		prints[key] = h.hexdigest()
+	return prints
+
+def affectedFunctions(keys, callees, changed):
+	'''
+	This function finds every function that can reach a changed function.
+	A path from a syscall to a function changed since the last run starts with unchanged functions,
+	whose calls are the same in both graphs, so reverse reachability in the new graph is enough.
+	'''
+	callers = {}
+	for caller in callees:
+		for callee in callees[caller]:
+			callers.setdefault(callee, []).append(caller)
+	seen = set(fid for fid in keys if keys[fid] in changed)
+	queue = deque(seen)
+	while len(queue) > 0:
+		fid = queue.popleft()
+		for caller in callers.get(fid, ()):
+			if caller not in seen:
+				seen.add(caller)
+				queue.append(caller)
+	return seen
+
+def reachableHooks(roots, callees, hookbit, memo):
+	'''
+	This function computes, for every function reachable from the roots, the LSM hooks it may call, as a bit mask.
+	Recursive calls form cycles, so strongly connected components are found (iterative Tarjan) and share one mask.
+	Masks are memoized across roots: the subgraphs shared by syscalls (VFS, memory management...) are walked once.
+	'''
+	index = {}
+	low = {}
+	stack = []
+	onstack = set()
+	counter = 0
+	for root in roots:
+		if root in memo:
+			continue
+		index[root] = low[root] = counter
+		counter += 1
+		stack.append(root)
+		onstack.add(root)
+		work = [(root, iter(callees.get(root, ())))]
+		while len(work) > 0:
+			caller, it = work[-1]
+			descended = False
+			for callee in it:
+				if callee in memo:	# Already in a completed component
+					continue
+				if callee not in index:
+					index[callee] = low[callee] = counter
+					counter += 1
+					stack.append(callee)
+					onstack.add(callee)
+					work.append((callee, iter(callees.get(callee, ()))))
+					descended = True
+					break
+				if callee in onstack:
+					low[caller] = min(low[caller], index[callee])
+			if descended:
+				continue
+			work.pop()
+			if len(work) > 0:
+				parent = work[-1][0]
+				low[parent] = min(low[parent], low[caller])
+			if low[caller] != index[caller]:
+				continue
+			component = []
+			while True:
+				fid = stack.pop()
+				onstack.discard(fid)
+				component.append(fid)
+				if fid == caller:
+					break
+			members = set(component)
+			mask = 0
+			for fid in component:
+				mask |= hookbit.get(fid, 0)
+				for callee in callees.get(fid, ()):
+					if callee not in members:
+						mask |= memo[callee]
+			for fid in component:
+				memo[fid] = mask
+	return memo
+
+def loadCache(path):
+	try:
+		with open(path, 'rb') as f:
+			cache = pickle.load(f)
+		if cache.get('version') == CACHE_VERSION:
+			return cache
+	except Exception:
+		pass
+	return {'version': CACHE_VERSION, 'fingerprints': {}, 'syscalls': {}}
 
 if __name__ == "__main__":
-	if len(sys.argv) < 4:
+	args = [arg for arg in sys.argv[1:] if arg != '--full']
+	if len(args) < 3:
 		print(
 			"""
-			Usage: python analyze.py <database_file_path> <root_caller_ID_file_path> <output_file_path>
+			Usage: python analyze.py [--full] <database_file_path> <root_caller_ID_file_path> <output_file_path> [<cache_file_path>]
+			Only syscalls reaching a function changed since the last run are recomputed, unless --full is given.
+			The cache defaults to <output_file_path>.cache.
 			"""
 		)
 		exit(1)
+	cachepath = args[3] if len(args) > 3 else args[2] + '.cache'
 
-	logging.basicConfig(filename='error.log',level=logging.DEBUG)
+	# Load the database once; every query below runs in memory.
+	conn = sqlite3.connect(args[0])
+	names, keys, callees = loadGraph(conn.cursor())
+	conn.close()	# Done. Close the database
 
-	# Connect to the database and get a cursor.
-	conn = sqlite3.connect(sys.argv[1])
-	c = conn.cursor()
-	output = open(sys.argv[3], "w+")
+	pattern = re.compile("security_")	# All LSM hooks must start with "security_"
+	hooknames = sorted(set(name for name in names.values() if pattern.match(name) is not None))
+	hookindex = dict((name, i) for i, name in enumerate(hooknames))
+	hookbit = dict((fid, 1 << hookindex[name]) for fid, name in names.items() if name in hookindex)
 
-	with open(sys.argv[2]) as f:
+	syscalls = []
+	with open(args[1]) as f:
 		for line in f:	# Each line should contain a system call name and the entry point ID.
 			fields = line.split()
-			syscallname = fields[0]
-			callerID = fields[1]
-			caller2callee = {}	# Maps a caller function (ID) to its callee functions (IDs).
-
-			queue = deque([callerID])	# starting from the root caller
-
-			while len(queue) > 0:
-				caller = queue.popleft()
-				callees = getCallee(c, caller, caller2callee)
-				for callee in callees:
-					if callee not in caller2callee and callee not in queue:	# We have not checked this function as a caller yet nor will check later
-						queue.append(callee)
-
-			security_hooks = check_callmap(c, caller2callee, False)	# LSM hooks called by the system call
-			security_hooks = set(security_hooks)
-			security_hooks = list(security_hooks)
-			print syscallname
-			output.write(syscallname + "\t" + str(security_hooks) + "\n")
-
-	f.close()
+			if len(fields) >= 2:
+				syscalls.append((fields[0], int(fields[1])))
+
+	prints = fingerprints(keys, callees)
+	cache = loadCache(cachepath)
+	if '--full' in sys.argv:
+		cache['syscalls'] = {}
+	old = cache['fingerprints']
+	changed = set(key for key in prints if old.get(key) != prints[key])
+	affected = affectedFunctions(keys, callees, changed) if len(cache['syscalls']) > 0 else None
+
+	todo = []
+	for syscallname, callerID in syscalls:
+		previous = cache['syscalls'].get(syscallname)
+		if callerID not in names:
+			print("Unknown entry point: " + syscallname)
+			continue
+		if affected is None or previous is None or previous[0] != keys[callerID] or callerID in affected:
+			todo.append((syscallname, callerID))
+	print("%d functions changed, %d of %d syscalls to analyze" % (len(changed), len(todo), len(syscalls)))
+
+	memo = reachableHooks([callerID for _, callerID in todo], callees, hookbit, {})
+	for syscallname, callerID in todo:
+		mask = memo[callerID]
+		hooks = [hooknames[i] for i in range(len(hooknames)) if mask >> i & 1]	# LSM hooks called by the system call
+		cache['syscalls'][syscallname] = (keys[callerID], hooks)
+		print(syscallname)
+
+	output = open(args[2], "w+")
+	for syscallname, callerID in syscalls:
+		if syscallname in cache['syscalls']:
+			output.write(syscallname + "\t" + str(cache['syscalls'][syscallname][1]) + "\n")
 	output.close()
-	conn.close()	# Done. Close the database
+
+	cache['fingerprints'] = prints
+	with open(cachepath, 'wb') as f:
+		pickle.dump(cache, f, 2)
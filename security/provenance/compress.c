@@ -0,0 +1,246 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <uapi/linux/provenance_lz4.h>
+
+#include "provenance.h"
+#include "provenance_relay.h"
+#include "provenance_compress.h"
+
+#define PROV_LZ4_NB_BLOCK       4
+#define PROV_LZ4_ACCELERATION   1
+
+static struct workqueue_struct *prov_lz4_wq;
+
+/*!
+ * @brief Per-CPU staging and compression state of an LZ4 relay channel.
+ *
+ * Blocks form a ring: blocks head to tail - 1 are sealed and wait for compression,
+ * block tail is being filled by the write path.
+ * The lock protects the ring against the worker and flush, it is only contended by them.
+ */
+struct prov_lz4_buf {
+	spinlock_t lock;
+	struct rchan *chan;
+	struct work_struct work;
+	int cpu;
+	unsigned int head;                              // Next sealed block to compress.
+	unsigned int tail;                              // Block being filled.
+	size_t len;                                     // Bytes in the block being filled.
+	uint32_t sequence;                              // Frames emitted on this CPU.
+	uint32_t lost;                                  // Records dropped since the last frame.
+	uint32_t sizes[PROV_LZ4_NB_BLOCK];              // Bytes in each sealed block.
+	uint8_t *blocks[PROV_LZ4_NB_BLOCK];
+	uint8_t *frame;                                 // Frame header and compressed payload.
+	void *wrkmem;                                   // LZ4 compression state.
+};
+
+#define PROV_LZ4_FRAME_SIZE     (sizeof(struct prov_lz4_frame) + LZ4_COMPRESSBOUND(PROV_LZ4_BLOCK_SIZE))
+
+/*!
+ * @brief Compress and emit every sealed block of a CPU, in order.
+ *
+ * Runs in the provenance LZ4 workqueue, bound to the CPU of the buffer when online.
+ * A work item never runs concurrently with itself, so frame and wrkmem need no lock.
+ */
+static void prov_lz4_work(struct work_struct *work)
+{
+	struct prov_lz4_buf *b = container_of(work, struct prov_lz4_buf, work);
+	struct prov_lz4_frame *frame = (struct prov_lz4_frame *)b->frame;
+	uint8_t *payload = b->frame + sizeof(struct prov_lz4_frame);
+	unsigned long flags;
+	unsigned int index;
+	int csize;
+
+	for (;;) {
+		spin_lock_irqsave(&b->lock, flags);
+		if (b->head == b->tail) {
+			spin_unlock_irqrestore(&b->lock, flags);
+			return;
+		}
+		index = b->head % PROV_LZ4_NB_BLOCK;
+		frame->lost = b->lost;
+		b->lost = 0;
+		spin_unlock_irqrestore(&b->lock, flags);
+
+		frame->magic = PROV_LZ4_MAGIC;
+		frame->version = PROV_LZ4_VERSION;
+		frame->size = b->sizes[index];
+		frame->sequence = b->sequence++;
+		csize = LZ4_compress_fast((const char *)b->blocks[index], (char *)payload, b->sizes[index],
+					  LZ4_COMPRESSBOUND(PROV_LZ4_BLOCK_SIZE),
+					  PROV_LZ4_ACCELERATION, b->wrkmem);
+		if (csize > 0 && csize < b->sizes[index]) {
+			frame->flags = 0;
+			frame->csize = csize;
+		} else {
+			frame->flags = PROV_LZ4_STORED;
+			frame->csize = b->sizes[index];
+			memcpy(payload, b->blocks[index], b->sizes[index]);
+		}
+		relay_write(b->chan, frame, sizeof(struct prov_lz4_frame) + frame->csize);
+
+		spin_lock_irqsave(&b->lock, flags);
+		b->head++;
+		spin_unlock_irqrestore(&b->lock, flags);
+	}
+}
+
+/*!
+ * @brief Hand the block being filled over to the worker.
+ *
+ * Called with the lock held.
+ * @return false if every other block is still waiting for compression.
+ */
+static bool __seal_block(struct prov_lz4_buf *b)
+{
+	if (b->tail + 1 - b->head >= PROV_LZ4_NB_BLOCK)
+		return false;
+	b->sizes[b->tail % PROV_LZ4_NB_BLOCK] = b->len;
+	b->tail++;
+	b->len = 0;
+	queue_work_on(b->cpu, prov_lz4_wq, &b->work);
+	return true;
+}
+
+/*!
+ * @brief Stage a record in the current block of this CPU, sealing the block when full.
+ *
+ * The record is dropped (and counted in the next frame) if compression lags behind.
+ * @param chan The LZ4 relay channel.
+ * @param msg The record.
+ * @param size The size of the record.
+ *
+ */
+void prov_lz4_write(struct rchan *chan, const void *msg, size_t size)
+{
+	struct prov_lz4_buf __percpu *lz4 = chan->private_data;
+	struct prov_lz4_buf *b;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	b = this_cpu_ptr(lz4);
+	spin_lock(&b->lock);
+	if (unlikely(b->len + size > PROV_LZ4_BLOCK_SIZE) && !__seal_block(b)) {
+		b->lost++;
+		goto out;
+	}
+	memcpy(b->blocks[b->tail % PROV_LZ4_NB_BLOCK] + b->len, msg, size);
+	b->len += size;
+out:
+	spin_unlock(&b->lock);
+	local_irq_restore(flags);
+}
+
+/*!
+ * @brief Seal the partially filled blocks of every CPU and wait for their frames to be written.
+ * @param chan The LZ4 relay channel.
+ *
+ */
+void prov_lz4_flush(struct rchan *chan)
+{
+	struct prov_lz4_buf __percpu *lz4 = chan->private_data;
+	struct prov_lz4_buf *b;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		b = per_cpu_ptr(lz4, cpu);
+		spin_lock_irqsave(&b->lock, flags);
+		if (b->len)
+			__seal_block(b);
+		spin_unlock_irqrestore(&b->lock, flags);
+	}
+	flush_workqueue(prov_lz4_wq);
+}
+
+void prov_lz4_free(struct prov_lz4_buf __percpu *lz4)
+{
+	struct prov_lz4_buf *b;
+	int cpu, i;
+
+	if (!lz4)
+		return;
+	for_each_possible_cpu(cpu) {
+		b = per_cpu_ptr(lz4, cpu);
+		for (i = 0; i < PROV_LZ4_NB_BLOCK; i++)
+			kvfree(b->blocks[i]);
+		kvfree(b->frame);
+		kvfree(b->wrkmem);
+	}
+	free_percpu(lz4);
+}
+
+/*!
+ * @brief Allocate the staging state of an LZ4 channel, node-local to each CPU.
+ * @return The per-CPU state, to be passed as relay channel private data; NULL on failure.
+ *
+ */
+struct prov_lz4_buf __percpu *prov_lz4_alloc(void)
+{
+	struct prov_lz4_buf __percpu *lz4;
+	struct prov_lz4_buf *b;
+	int cpu, i, node;
+
+	if (!prov_lz4_wq)
+		return NULL;
+	lz4 = alloc_percpu(struct prov_lz4_buf);
+	if (!lz4)
+		return NULL;
+	for_each_possible_cpu(cpu) {
+		b = per_cpu_ptr(lz4, cpu);
+		node = cpu_to_node(cpu);
+		spin_lock_init(&b->lock);
+		INIT_WORK(&b->work, prov_lz4_work);
+		b->cpu = cpu;
+		for (i = 0; i < PROV_LZ4_NB_BLOCK; i++) {
+			b->blocks[i] = kvmalloc_node(PROV_LZ4_BLOCK_SIZE, GFP_KERNEL, node);
+			if (!b->blocks[i])
+				goto free;
+		}
+		b->frame = kvmalloc_node(PROV_LZ4_FRAME_SIZE, GFP_KERNEL, node);
+		b->wrkmem = kvmalloc_node(LZ4_MEM_COMPRESS, GFP_KERNEL, node);
+		if (!b->frame || !b->wrkmem)
+			goto free;
+	}
+	return lz4;
+free:
+	prov_lz4_free(lz4);
+	return NULL;
+}
+
+/*!
+ * @brief Bind the staging state to its relay channel, before any record is written.
+ */
+void prov_lz4_attach(struct prov_lz4_buf __percpu *lz4, struct rchan *chan)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(lz4, cpu)->chan = chan;
+}
+
+static int __init prov_lz4_init(void)
+{
+	prov_lz4_wq = alloc_workqueue("provenance_lz4", 0, 0);
+	if (!prov_lz4_wq)
+		pr_err("Provenance: could not allocate LZ4 workqueue.");
+	else
+		pr_info("Provenance: LZ4 channels ready.\n");
+	return 0;
+}
+core_initcall(prov_lz4_init);
@@ -26,6 +26,8 @@
 #include "provenance_net.h"
 #include "provenance_task.h"
 #include "provenance_machine.h"
+#include "provenance_usage.h"
+#include "provenance_pattern.h"
 
 #define TMPBUFLEN    12
 
@@ -125,6 +127,18 @@ declare_write_flag_fcn(prov_write_duplicate, prov_policy.should_duplicate);
 declare_read_flag_fcn(prov_read_duplicate, prov_policy.should_duplicate);
 declare_file_operations(prov_duplicate_ops, prov_write_duplicate, prov_read_duplicate);
 
+declare_write_flag_fcn(prov_write_skip_lookup, prov_policy.should_skip_lookup);
+declare_read_flag_fcn(prov_read_skip_lookup, prov_policy.should_skip_lookup);
+declare_file_operations(prov_skip_lookup_ops, prov_write_skip_lookup, prov_read_skip_lookup);
+
+declare_write_flag_fcn(prov_write_lazy_thread, prov_policy.should_lazy_thread);
+declare_read_flag_fcn(prov_read_lazy_thread, prov_policy.should_lazy_thread);
+declare_file_operations(prov_lazy_thread_ops, prov_write_lazy_thread, prov_read_lazy_thread);
+
+declare_write_flag_fcn(prov_write_reduce, prov_policy.should_reduce);
+declare_read_flag_fcn(prov_read_reduce, prov_policy.should_reduce);
+declare_file_operations(prov_reduce_ops, prov_write_reduce, prov_read_reduce);
+
 static ssize_t prov_write_machine_id(struct file *file, const char __user *buf,
 				     size_t count, loff_t *ppos)
 {
@@ -313,14 +327,17 @@ static ssize_t prov_read_self(struct file *filp, char __user *buf,
 			      size_t count, loff_t *ppos)
 {
 	struct provenance *cprov = current_provenance();
+	union prov_elt self;
 
 	if (count < sizeof(struct task_prov_struct))
 		return -ENOMEM;
 
 	spin_lock(prov_lock(cprov));
-	if (copy_to_user(buf, prov_elt(cprov), sizeof(union prov_elt)))
-		count = -EAGAIN;
+	memcpy(&self, prov_elt(cprov), sizeof(union prov_elt));
 	spin_unlock(prov_lock(cprov));
+	self.node_info.var_ptr = NULL;  // Kernel address.
+	if (copy_to_user(buf, &self, sizeof(union prov_elt)))
+		count = -EAGAIN;
 	return count; // write only
 }
 declare_file_operations(prov_self_ops, prov_write_self, prov_read_self);
@@ -481,6 +498,7 @@ static ssize_t prov_read_process(struct file *filp, char __user *buf,
 	spin_lock(prov_lock(prov));
 	memcpy(&msg->prov, prov_elt(prov), sizeof(union prov_elt));
 	spin_unlock(prov_lock(prov));
+	msg->prov.node_info.var_ptr = NULL;     // Kernel address.
 
 	if (copy_to_user(buf, msg, sizeof(struct prov_process_config)))
 		rtn = -ENOMEM;
@@ -718,6 +736,172 @@ static ssize_t prov_read_ns_filter(struct file *filp, char __user *buf,
 }
 declare_file_operations(prov_ns_filter_ops, prov_write_ns_filter, prov_read_ns_filter);
 
+/*!
+ * @brief Add, update or delete a superblock filter, setting the capture mode of a file system type or of one mount.
+ *
+ * The capture mode of every mounted superblock is then recomputed,
+ * so that the change applies to existing mounts and not only to new ones.
+ */
+static ssize_t prov_write_sb_filter(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct sb_filters *s;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(struct sbinfo))
+		return -ENOMEM;
+
+	s = kzalloc(sizeof(struct sb_filters), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	if (copy_from_user(&s->filter, buf, sizeof(struct sbinfo))) {
+		kfree(s);
+		return -EAGAIN;
+	}
+	s->filter.fstype[PROV_FSTYPE_LEN - 1] = '\0';
+
+	if ((s->filter.op & PROV_SET_DELETE) != PROV_SET_DELETE)
+		prov_sb_add_or_update(s);
+	else
+		prov_sb_delete(s);
+	iterate_supers(prov_sb_apply, NULL);
+	return sizeof(struct sbinfo);
+}
+
+static ssize_t prov_read_sb_filter(struct file *filp, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct list_head *listentry, *listtmp;
+	struct sb_filters *tmp;
+	size_t pos = 0;
+
+	if (count < sizeof(struct sbinfo))
+		return -ENOMEM;
+
+	list_for_each_safe(listentry, listtmp, &sb_filters) {
+		tmp = list_entry(listentry, struct sb_filters, list);
+		if (count < pos + sizeof(struct sbinfo))
+			return -ENOMEM;
+		if (copy_to_user(buf + pos, &(tmp->filter), sizeof(struct sbinfo)))
+			return -EAGAIN;
+		pos += sizeof(struct sbinfo);
+	}
+	return pos;
+}
+declare_file_operations(prov_sb_filter_ops, prov_write_sb_filter, prov_read_sb_filter);
+
+static ssize_t prov_write_xattr_filter(struct file *file, const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct xattr_filters *s;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(struct xattrinfo))
+		return -ENOMEM;
+
+	s = kzalloc(sizeof(struct xattr_filters), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	if (copy_from_user(&s->filter, buf, sizeof(struct xattrinfo))) {
+		kfree(s);
+		return -EAGAIN;
+	}
+	s->filter.name[PROV_XATTR_NAME_SIZE - 1] = '\0';
+
+	if ((s->filter.op & PROV_SET_DELETE) != PROV_SET_DELETE)
+		prov_xattr_add_or_update(s);
+	else
+		prov_xattr_delete(s);
+	return sizeof(struct xattrinfo);
+}
+
+static ssize_t prov_read_xattr_filter(struct file *filp, char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	struct list_head *listentry, *listtmp;
+	struct xattr_filters *tmp;
+	size_t pos = 0;
+
+	if (count < sizeof(struct xattrinfo))
+		return -ENOMEM;
+
+	list_for_each_safe(listentry, listtmp, &xattr_filters) {
+		tmp = list_entry(listentry, struct xattr_filters, list);
+		if (count < pos + sizeof(struct xattrinfo))
+			return -ENOMEM;
+		if (copy_to_user(buf + pos, &(tmp->filter), sizeof(struct xattrinfo)))
+			return -EAGAIN;
+		pos += sizeof(struct xattrinfo);
+	}
+	return pos;
+}
+declare_file_operations(prov_xattr_filter_ops, prov_write_xattr_filter, prov_read_xattr_filter);
+
+static ssize_t prov_write_pattern(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct pattern_filters *s;
+	int rc;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(struct prov_pattern))
+		return -ENOMEM;
+
+	s = kzalloc(sizeof(struct pattern_filters), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	if (copy_from_user(&s->filter, buf, sizeof(struct prov_pattern))) {
+		kfree(s);
+		return -EAGAIN;
+	}
+
+	if ((s->filter.op & PROV_SET_DELETE) != PROV_SET_DELETE) {
+		rc = prov_pattern_add_or_update(s);
+		if (rc)
+			return rc;
+	} else
+		prov_pattern_delete(s);
+	return sizeof(struct prov_pattern);
+}
+
+static ssize_t prov_read_pattern(struct file *filp, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct pattern_filters *tmp;
+	struct prov_pattern pattern;
+	ssize_t pos = 0;
+
+	if (count < sizeof(struct prov_pattern))
+		return -ENOMEM;
+
+	mutex_lock(&pattern_lock);
+	list_for_each_entry(tmp, &pattern_filters, list) {
+		if (count < pos + sizeof(struct prov_pattern)) {
+			pos = -ENOMEM;
+			break;
+		}
+		memcpy(&pattern, &tmp->filter, sizeof(struct prov_pattern));
+		pattern.matches = atomic64_read(&tmp->matches);
+		if (copy_to_user(buf + pos, &pattern, sizeof(struct prov_pattern))) {
+			pos = -EAGAIN;
+			break;
+		}
+		pos += sizeof(struct prov_pattern);
+	}
+	mutex_unlock(&pattern_lock);
+	return pos;
+}
+declare_file_operations(prov_pattern_ops, prov_write_pattern, prov_read_pattern);
+
 /*!
  * @brief This function records a relation between a provenance node and a user supplied data, which is a transient node.
  *
@@ -725,6 +909,7 @@ declare_file_operations(prov_ns_filter_ops, prov_write_ns_filter, prov_read_ns_f
  * The relation between the two nodes is RL_LOG and the node of the user-supplied log is of type ENT_STR.
  * ENT_STR node is transient and should not have further use.
  * Therefore, once we have recorded the node, we will free the memory allocated for it.
+ * A thread node not created yet is created first, under the lock of the process (see "materialize_task_provenance").
  * @param cprov Provenance node to be annotated by the user.
  * @param buf Userspace buffer where user annotation locates.
  * @param count Number of bytes copied from the user buffer.
@@ -733,9 +918,17 @@ declare_file_operations(prov_ns_filter_ops, prov_write_ns_filter, prov_read_ns_f
  */
 static inline int record_log(union prov_elt *tprov, const char __user *buf, size_t count)
 {
+	struct provenance *cprov = current_provenance();
 	union long_prov_elt *str;
+	unsigned long irqflags;
 	int rc = 0;
 
+	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
+	rc = materialize_task_provenance((prov_entry_t *)tprov);
+	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
+	if (rc < 0)
+		return rc;
+
 	str = alloc_long_provenance(ENT_STR);
 	if (!str)
 		return -ENOMEM;
@@ -802,6 +995,9 @@ static ssize_t prov_read_policy_hash(struct file *filp, char __user *buf,
 	struct list_head *listentry, *listtmp;
 	struct ipv4_filters *ipv4_tmp;
 	struct ns_filters *ns_tmp;
+	struct sb_filters *sb_tmp;
+	struct xattr_filters *xattr_tmp;
+	struct pattern_filters *pattern_tmp;
 	struct secctx_filters *secctx_tmp;
 	struct user_filters *user_tmp;
 	struct group_filters *group_tmp;
@@ -854,6 +1050,12 @@ static ssize_t prov_read_policy_hash(struct file *filp, char __user *buf,
 	hash_filters(egress_ipv4filters, ipv4_filters, ipv4_tmp, prov_ipv4_filter);
 	/* namespace policy */
 	hash_filters(ns_filters, ns_filters, ns_tmp, ns_filters);
+	/* superblock policy */
+	hash_filters(sb_filters, sb_filters, sb_tmp, sbinfo);
+	/* xattr policy */
+	hash_filters(xattr_filters, xattr_filters, xattr_tmp, xattrinfo);
+	/* patterns */
+	hash_filters(pattern_filters, pattern_filters, pattern_tmp, prov_pattern);
 	/* secctx policy */
 	hash_filters(secctx_filters, secctx_filters, secctx_tmp, secinfo);
 	/* userid policy */
@@ -938,8 +1140,30 @@ static ssize_t prov_read_commit(struct file *filp, char __user *buf,
 }
 declare_file_operations(prov_commit, no_write, prov_read_commit);
 
-static ssize_t prov_write_channel(struct file *file, const char __user *buf,
+static ssize_t prov_read_cpu_node(struct file *filp, char __user *buf,
 				  size_t count, loff_t *ppos)
+{
+	size_t len = nr_cpu_ids * sizeof(uint32_t);
+	ssize_t rc = len;
+	uint32_t *map;
+	int cpu;
+
+	if (count < len)
+		return -ENOMEM;
+	map = kmalloc(len, GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	memset(map, 0xFF, len);
+	for_each_possible_cpu(cpu)
+		map[cpu] = cpu_to_node(cpu);
+	if (copy_to_user(buf, map, len))
+		rc = -EAGAIN;
+	kfree(map);
+	return rc;
+}
+declare_file_operations(prov_cpu_node_ops, no_write, prov_read_cpu_node);
+
+static ssize_t __write_channel(const char __user *buf, size_t count, int format)
 {
 	char *buffer;
 	int rtn = 0;
@@ -958,13 +1182,80 @@ static ssize_t prov_write_channel(struct file *file, const char __user *buf,
 		rtn = -ENOMEM;
 		goto out;
 	}
-	rtn = prov_create_channel(buffer, strlen(buffer));
+	rtn = prov_create_channel(buffer, strlen(buffer), format);
 out:
 	kfree(buffer);
 	return rtn;
 }
+
+static ssize_t prov_write_channel(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	return __write_channel(buf, count, PROV_FORMAT_RAW);
+}
 declare_file_operations(prov_channel_ops, prov_write_channel, no_read);
 
+static ssize_t prov_write_compact_channel(struct file *file, const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	return __write_channel(buf, count, PROV_FORMAT_COMPACT);
+}
+declare_file_operations(prov_compact_channel_ops, prov_write_compact_channel, no_read);
+
+static ssize_t prov_write_lz4_channel(struct file *file, const char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	return __write_channel(buf, count, PROV_FORMAT_LZ4);
+}
+declare_file_operations(prov_lz4_channel_ops, prov_write_lz4_channel, no_read);
+
+static ssize_t prov_write_sized_channel(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	return __write_channel(buf, count, PROV_FORMAT_SIZED);
+}
+declare_file_operations(prov_sized_channel_ops, prov_write_sized_channel, no_read);
+
+static ssize_t prov_write_channel_filter(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct prov_channel_filter setting;
+	struct relay_list *tmp;
+	uint64_t *filter;
+
+	if (!capable(CAP_AUDIT_CONTROL)) {
+		pr_err("Provenance: failing setting filter, !CAP_AUDIT_CONTROL.");
+		return -EPERM;
+	}
+
+	if (count < sizeof(struct prov_channel_filter)) {
+		pr_err("Provenance: failing setting filter, wrong length.");
+		return -ENOMEM;
+	}
+
+	if (copy_from_user(&setting, buf, sizeof(struct prov_channel_filter))) {
+		pr_err("Provenance: failed copying from user.");
+		return -ENOMEM;
+	}
+
+	if (setting.kind >= PROV_CHANNEL_NB_FILTER)
+		return -EINVAL;
+	setting.channel[NAME_MAX] = '\0';
+
+	list_for_each_entry(tmp, &relay_list, list) {
+		if (strcmp(tmp->name, setting.channel) == 0) {
+			filter = &tmp->filters[setting.kind];
+			if (setting.filter.add != 0)
+				(*filter) |= setting.filter.filter & setting.filter.mask;
+			else
+				(*filter) &= ~(setting.filter.filter & setting.filter.mask);
+			return count;
+		}
+	}
+	return -ENOENT;
+}
+declare_file_operations(prov_channel_filter_ops, prov_write_channel_filter, no_read);
+
 static ssize_t prov_write_epoch(struct file *file, const char __user *buf,
 				size_t count, loff_t *ppos)
 {
@@ -974,6 +1265,127 @@ static ssize_t prov_write_epoch(struct file *file, const char __user *buf,
 }
 declare_file_operations(prov_epoch_ops, prov_write_epoch, no_read);
 
+static ssize_t prov_write_sampling(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct prov_sampling setting;
+	int index;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(struct prov_sampling))
+		return -ENOMEM;
+
+	if (copy_from_user(&setting, buf, sizeof(struct prov_sampling)))
+		return -EAGAIN;
+
+	if (!prov_type_is_relation(setting.type))
+		return -EINVAL;
+
+	index = relation_sampling_index(setting.type);
+	if (index < 0)
+		return -EINVAL;
+
+	WRITE_ONCE(prov_policy.prov_sampling[index], setting.rate);
+	return sizeof(struct prov_sampling);
+}
+
+static ssize_t prov_read_sampling(struct file *filp, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct prov_sampling setting;
+	int index;
+
+	if (count < sizeof(struct prov_sampling))
+		return -ENOMEM;
+
+	if (copy_from_user(&setting, buf, sizeof(struct prov_sampling)))
+		return -EAGAIN;
+
+	if (!prov_type_is_relation(setting.type))
+		return -EINVAL;
+
+	index = relation_sampling_index(setting.type);
+	if (index < 0)
+		return -EINVAL;
+
+	setting.rate = READ_ONCE(prov_policy.prov_sampling[index]);
+	if (copy_to_user(buf, &setting, sizeof(struct prov_sampling)))
+		return -EAGAIN;
+	return sizeof(struct prov_sampling);
+}
+declare_file_operations(prov_sampling_ops, prov_write_sampling, prov_read_sampling);
+
+static ssize_t prov_write_rate(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct prov_rate setting;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(struct prov_rate))
+		return -ENOMEM;
+
+	if (copy_from_user(&setting, buf, sizeof(struct prov_rate)))
+		return -EAGAIN;
+
+	WRITE_ONCE(prov_policy.prov_burst, setting.burst);
+	WRITE_ONCE(prov_policy.prov_rate, setting.rate);
+	return sizeof(struct prov_rate);
+}
+
+static ssize_t prov_read_rate(struct file *filp, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct prov_rate setting;
+
+	if (count < sizeof(struct prov_rate))
+		return -ENOMEM;
+
+	setting.rate = READ_ONCE(prov_policy.prov_rate);
+	setting.burst = READ_ONCE(prov_policy.prov_burst);
+	if (copy_to_user(buf, &setting, sizeof(struct prov_rate)))
+		return -EAGAIN;
+	return sizeof(struct prov_rate);
+}
+declare_file_operations(prov_rate_ops, prov_write_rate, prov_read_rate);
+
+static ssize_t prov_write_usage_interval(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	uint32_t interval;
+
+	if (!capable(CAP_AUDIT_CONTROL))
+		return -EPERM;
+
+	if (count < sizeof(uint32_t))
+		return -ENOMEM;
+
+	if (copy_from_user(&interval, buf, sizeof(uint32_t)))
+		return -EAGAIN;
+
+	WRITE_ONCE(prov_policy.prov_usage_interval, interval);
+	prov_usage_start();
+	return sizeof(uint32_t);
+}
+
+static ssize_t prov_read_usage_interval(struct file *filp, char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	uint32_t interval;
+
+	if (count < sizeof(uint32_t))
+		return -ENOMEM;
+
+	interval = READ_ONCE(prov_policy.prov_usage_interval);
+	if (copy_to_user(buf, &interval, sizeof(uint32_t)))
+		return -EAGAIN;
+	return sizeof(uint32_t);
+}
+declare_file_operations(prov_usage_interval_ops, prov_write_usage_interval, prov_read_usage_interval);
+
 #define prov_create_file(name, perm, fun_ptr)				      \
 	dentry = securityfs_create_file(name, perm, prov_dir, NULL, fun_ptr); \
 	provenance_mark_as_opaque_dentry(dentry)
@@ -1012,6 +1424,9 @@ static int __init init_prov_fs(void)
 	prov_create_file("secctx", 0644, &prov_secctx_ops);
 	prov_create_file("secctx_filter", 0644, &prov_secctx_filter_ops);
 	prov_create_file("ns", 0644, &prov_ns_filter_ops);
+	prov_create_file("sb_filter", 0644, &prov_sb_filter_ops);
+	prov_create_file("xattr_filter", 0644, &prov_xattr_filter_ops);
+	prov_create_file("pattern", 0644, &prov_pattern_ops);
 	prov_create_file("log", 0666, &prov_log_ops);
 	prov_create_file("logp", 0666, &prov_logp_ops);
 	prov_create_file("policy_hash", 0444, &prov_policy_hash_ops);
@@ -1021,8 +1436,19 @@ static int __init init_prov_fs(void)
 	prov_create_file("version", 0444, &prov_version);
 	prov_create_file("commit", 0444, &prov_commit);
 	prov_create_file("channel", 0644, &prov_channel_ops);
+	prov_create_file("compact_channel", 0644, &prov_compact_channel_ops);
+	prov_create_file("lz4_channel", 0644, &prov_lz4_channel_ops);
+	prov_create_file("sized_channel", 0644, &prov_sized_channel_ops);
+	prov_create_file("channel_filter", 0644, &prov_channel_filter_ops);
+	prov_create_file("cpu_node", 0444, &prov_cpu_node_ops);
 	prov_create_file("duplicate", 0644, &prov_duplicate_ops);
 	prov_create_file("epoch", 0644, &prov_epoch_ops);
+	prov_create_file("sampling", 0644, &prov_sampling_ops);
+	prov_create_file("rate", 0644, &prov_rate_ops);
+	prov_create_file("skip_lookup", 0644, &prov_skip_lookup_ops);
+	prov_create_file("reduce", 0644, &prov_reduce_ops);
+	prov_create_file("lazy_thread", 0644, &prov_lazy_thread_ops);
+	prov_create_file("usage_interval", 0644, &prov_usage_interval_ops);
 	pr_info("Provenance: fs ready.\n");
 	return 0;
 }
@@ -27,6 +27,7 @@
 #include "provenance_inode.h"
 #include "provenance_task.h"
 #include "provenance_machine.h"
+#include "provenance_pattern.h"
 
 #ifdef CONFIG_SECURITY_PROVENANCE_PERSISTENCE
 // If provenance is set to be persistant (saved between reboots).
@@ -88,6 +89,8 @@ static inline void queue_save_provenance(struct provenance *provenance,
  * We create a ACT_TASK node for the newly allocated task.
  * Since @cred is shared by all threads, we use @cred to save process's provenance,
  * and @task to save provenance of each thread.
+ * If the user set "should_lazy_thread", nothing is recorded for a new thread (CLONE_THREAD):
+ * its node is only created, and its creation recorded, when a relation involving it is first recorded (see "materialize_task_provenance").
  * @param task Task being allocated.
  * @param clone_flags The flags indicating what should be shared.
  * @return 0 if no error occurred. Other error codes unknown.
@@ -96,12 +99,18 @@ static inline void queue_save_provenance(struct provenance *provenance,
 static int provenance_task_alloc(struct task_struct *task,
 				 unsigned long clone_flags)
 {
-	struct provenance *ntprov = alloc_provenance(ACT_TASK, GFP_KERNEL);
+	struct provenance *ntprov;
 	const struct cred *cred;
 	struct task_struct *t = current;
 	struct provenance *tprov;
 	struct provenance *cprov;
+	unsigned long irqflags;
 
+	if ((clone_flags & CLONE_THREAD) && prov_policy.should_lazy_thread) {
+		task->provenance = init_lazy_provenance(&task->provenance_blob, ACT_TASK);
+		return 0;
+	}
+	ntprov = init_provenance(&task->provenance_blob, ACT_TASK);
 	task->provenance = ntprov;
 	if (t != NULL) {
 		cred = t->real_cred;
@@ -109,8 +118,10 @@ static int provenance_task_alloc(struct task_struct *task,
 		if (cred != NULL) {
 			cprov = cred->provenance;
 			if (tprov != NULL &&  cprov != NULL) {
+				spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
 				uses_two(RL_PROC_READ, cprov, tprov, NULL, clone_flags);
 				informs(RL_CLONE, tprov, ntprov, NULL, clone_flags);
+				spin_unlock_irqrestore(prov_lock(cprov), irqflags);
 			}
 		}
 	}
@@ -121,7 +132,9 @@ static int provenance_task_alloc(struct task_struct *task,
  * @brief Record provenance when task_free hook is triggered.
  *
  * Record provenance relation RL_TERMINATE_TASK by calling function "record_terminate".
- * Free kernel memory allocated for provenance entry of the task in question.
+ * A thread whose node was never created (see "provenance_task_alloc") records nothing,
+ * it is counted in the thread summary of its process instead (see "record_thread_summary").
+ * Release the provenance entry of the task in question, embedded in its task_struct.
  * Set the provenance pointer in task_struct to NULL.
  * @param task The task in question (i.e., to be free).
  *
@@ -129,10 +142,21 @@ static int provenance_task_alloc(struct task_struct *task,
 static void provenance_task_free(struct task_struct *task)
 {
 	struct provenance *tprov = task->provenance;
+	struct provenance *cprov;
+	unsigned long irqflags;
 
-	if (tprov) {
+	if (tprov && provenance_is_lazy(tprov)) {
+		// A thread never involved in a flow: counted in a summary for its process.
+		cprov = task->real_cred ? task->real_cred->provenance : NULL;
+		if (cprov && (prov_policy.prov_all || provenance_is_tracked(prov_elt(cprov)))) {
+			spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
+			if (atomic_inc_return(&cprov->threads) >= PROV_THREADS_FLUSH)
+				record_thread_summary(cprov);
+			spin_unlock_irqrestore(prov_lock(cprov), irqflags);
+		}
+	} else if (tprov) {
 		record_terminate(RL_TERMINATE_TASK, tprov);
-		free_provenance(tprov);
+		fini_provenance(tprov);
 	}
 	task->provenance = NULL;
 }
@@ -148,10 +172,8 @@ static void provenance_task_free(struct task_struct *task)
 static void cred_init_provenance(void)
 {
 	struct cred *cred = (struct cred *)current->real_cred;
-	struct provenance *prov = alloc_provenance(ENT_PROC, GFP_KERNEL);
+	struct provenance *prov = init_provenance(&cred->provenance_blob, ENT_PROC);
 
-	if (!prov)
-		panic("Provenance:  Failed to initialize initial task.\n");
 	node_uid(prov_elt(prov)) = __kuid_val(cred->euid);
 	node_gid(prov_elt(prov)) = __kgid_val(cred->egid);
 	cred->provenance = prov;
@@ -162,19 +184,16 @@ static void cred_init_provenance(void)
  *
  * This hook is triggered when allocating sufficient memory and attaching to @cred such that cred_transfer() will not get ENOMEM.
  * Therefore, no information flow occurred.
- * We simply create a ENT_PROC provenance node and associate the provenance entry to the newly allocated @cred.
+ * We simply create a ENT_PROC provenance node, embedded in the newly allocated @cred, and associate it to @cred.
  * Set the proper UID and GID of the node based on the information from @cred.
  * @param cred Points to the new credentials.
  * @param gfp Indicates the atomicity of any memory allocations.
- * @return 0 if no error occurred; -ENOMEM if no memory can be allocated for the new provenance entry. Other error codes unknown.\
+ * @return 0 if no error occurred. Other error codes unknown.
  *
  */
 static int provenance_cred_alloc_blank(struct cred *cred, gfp_t gfp)
 {
-	struct provenance *prov = alloc_provenance(ENT_PROC, gfp);
-
-	if (!prov)
-		return -ENOMEM;
+	struct provenance *prov = init_provenance(&cred->provenance_blob, ENT_PROC);
 
 	node_uid(prov_elt(prov)) = __kuid_val(cred->euid);
 	node_gid(prov_elt(prov)) = __kgid_val(cred->egid);
@@ -186,8 +205,9 @@ static int provenance_cred_alloc_blank(struct cred *cred, gfp_t gfp)
  * @brief Record provenance when cred_free hook is triggered.
  *
  * This hook is triggered when deallocating and clearing the cred->security field in a set of credentials.
+ * Record the summaries of flows aggregated by rate limiting and of threads never involved in a flow that have not been recorded yet, if any.
  * Record provenance relation RL_TERMINATE_PROC by calling "record_terminate" function.
- * Free kernel memory allocated for provenance entry of the cred in question.
+ * Release the provenance entry of the cred in question, embedded in @cred.
  * Set the provenance pointer in @cred to NULL.
  * @param cred Points to the credentials to be freed.
  *
@@ -197,8 +217,10 @@ static void provenance_cred_free(struct cred *cred)
 	struct provenance *cprov = cred->provenance;
 
 	if (cprov) {
+		record_aggregate(cprov);
+		record_thread_summary(cprov);
 		record_terminate(RL_TERMINATE_PROC, cprov);
-		free_provenance(cprov);
+		fini_provenance(cprov);
 	}
 	cred->provenance = NULL;
 }
@@ -221,13 +243,11 @@ static int provenance_cred_prepare(struct cred *new,
 				   gfp_t gfp)
 {
 	struct provenance *old_prov = old->provenance;
-	struct provenance *nprov = alloc_provenance(ENT_PROC, gfp);
+	struct provenance *nprov = init_provenance(&new->provenance_blob, ENT_PROC);
 	struct provenance *tprov;
 	unsigned long irqflags;
 	int rc = 0;
 
-	if (!nprov)
-		return -ENOMEM;
 	node_uid(prov_elt(nprov)) = __kuid_val(new->euid);
 	node_gid(prov_elt(nprov)) = __kgid_val(new->egid);
 	spin_lock_irqsave_nested(prov_lock(old_prov), irqflags, PROVENANCE_LOCK_PROC);
@@ -259,6 +279,8 @@ static void provenance_cred_transfer(struct cred *new, const struct cred *old)
 	struct provenance *prov = new->provenance;
 
 	*prov =  *old_prov;
+	// The copy still points to the query state of the old cred.
+	prov_attach_query_state(prov);
 }
 
 /*!
@@ -360,24 +382,26 @@ static int provenance_task_kill(struct task_struct *p, struct kernel_siginfo *in
  * This hook is triggered when allocating and attaching a security structure to @inode->i_security.
  * The i_security field is initialized to NULL when the inode structure is allocated.
  * When i_security field is initialized, we also initialize i_provenance field of the inode.
- * Therefore, we create a new ENT_INODE_UNKNOWN provenance entry.
+ * Therefore, we create a new ENT_INODE_UNKNOWN provenance entry, embedded in @inode.
  * UUID information from @i_sb (superblock) is copied to the new inode's provenance entry.
+ * The inode is made opaque if its superblock is.
  * We then call function "refresh_inode_provenance" to obtain more information about the inode.
  * No information flow occurs.
  * @param inode The inode structure.
- * @return 0 if operation was successful; -ENOMEM if no memory can be allocated for the new inode provenance entry. Other error codes unknown.
+ * @return 0 if operation was successful. Other error codes unknown.
  *
  */
 static int provenance_inode_alloc_security(struct inode *inode)
 {
-	struct provenance *iprov = alloc_provenance(ENT_INODE_UNKNOWN, GFP_KERNEL);
+	struct provenance *iprov = init_provenance(&inode->i_provenance_blob, ENT_INODE_UNKNOWN);
 	struct provenance *sprov;
 
-	if (unlikely(!iprov))
-		return -ENOMEM;
 	sprov = inode->i_sb->s_provenance;
 	memcpy(prov_elt(iprov)->inode_info.sb_uuid, prov_elt(sprov)->sb_info.uuid, 16 * sizeof(uint8_t));
+	if (provenance_inode_sb_is_opaque(inode))
+		set_opaque(prov_elt(iprov));
 	inode->i_provenance = iprov;
+	invalidate_inode_provenance(iprov);
 	refresh_inode_provenance(inode, iprov);
 	return 0;
 }
@@ -387,7 +411,7 @@ static int provenance_inode_alloc_security(struct inode *inode)
  *
  * This hook is triggered when deallocating the inode security structure and set @inode->i_security to NULL.
  * Record provenance relation RL_FREED by calling "record_terminate" function.
- * Free kernel memory allocated for provenance entry of the inode in question.
+ * Release the provenance entry of the inode in question, embedded in @inode.
  * Set the provenance pointer in @inode to NULL.
  * @param inode The inode structure whose security is to be freed.
  *
@@ -398,7 +422,7 @@ static void provenance_inode_free_security(struct inode *inode)
 
 	if (iprov) {
 		record_terminate(RL_FREED, iprov);
-		free_provenance(iprov);
+		fini_provenance(iprov);
 	}
 	inode->i_provenance = NULL;
 }
@@ -453,6 +477,8 @@ static int provenance_inode_create(struct inode *dir,
  * Note that "uses" function also generates provenance relation RL_PROC_WRITE.
  * Information flows from @inode's provenance to the current process that attempts to access the inode, and eventually to the cred of the task.
  * Provenance relation is not recorded if the inode to be access is private or if the inode's provenance entry does not exist.
+ * If the user set "should_skip_lookup", search permission checks on the directories traversed during path lookup are not recorded.
+ * Each path component would otherwise produce its own relations, while the resolved path is already captured when the file is opened.
  * @param inode The inode structure to check.
  * @param mask The permission mask.
  * @return 0 if permission is granted; -ENOMEM if @inode's provenance does not exist. Other error codes unknown.
@@ -472,6 +498,10 @@ static int provenance_inode_permission(struct inode *inode, int mask)
 		return 0;
 	if (unlikely(IS_PRIVATE(inode)))
 		return 0;
+	if (prov_policy.should_skip_lookup && is_lookup_permission(inode, mask))
+		return 0;
+	if (provenance_inode_is_ignored(inode))
+		return 0;
 	cprov = get_cred_provenance();
 	tprov = get_task_provenance(true);
 	iprov = get_inode_provenance(inode, false);
@@ -544,6 +574,7 @@ static int provenance_inode_link(struct dentry *old_dentry,
 	rc = generates(RL_LINK, cprov, tprov, iprov, NULL, 0);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
+	prov_name_invalidate(new_dentry);
 	record_inode_name_from_dentry(new_dentry, iprov, true);
 	return rc;
 }
@@ -571,6 +602,7 @@ static int provenance_inode_unlink(struct inode *dir, struct dentry *dentry)
 	rc = generates(RL_UNLINK, cprov, tprov, iprov, NULL, 0);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
+	prov_name_invalidate(dentry);
 	return rc;
 }
 
@@ -676,6 +708,7 @@ static int provenance_inode_setattr(struct dentry *dentry, struct iattr *iattr)
 		goto out;
 	rc = derives(RL_SETATTR_INODE, iattrprov, iprov, NULL, 0);
 out:
+	invalidate_inode_provenance(iprov);     // The attributes are about to change.
 	queue_save_provenance(iprov, dentry);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
@@ -689,24 +722,37 @@ out:
  * This hook is triggered when checking permission before obtaining file attributes.
  * Record provenance relation RL_GETATTR by calling "uses" function.
  * Information flows from the inode of the file to the calling process, and eventually to the process's cred.
+ * If edges are compressed (or the graph reduced) and the same versions of the process and the inode are already connected by a RL_GETATTR relation,
+ * we return before taking any lock (see "getattr_cache_hit"), as repeated stat of an unchanged file carry no new information.
  * @param path The path structure for the file.
  * @return 0 if permission is granted; -ENOMEM if the provenance entry of the file is NULL. Other error codes unknown.
  *
  */
 static int provenance_inode_getattr(const struct path *path)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_dentry_provenance(path->dentry, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
+	struct inode *inode = d_backing_inode(path->dentry);
 	unsigned long irqflags;
 	int rc;
 
-	if (!iprov)
+	if (!inode)
 		return -ENOMEM;
+	if (provenance_inode_is_ignored(inode))
+		return 0;
+	if (getattr_cache_hit(current_provenance(), inode->i_provenance))
+		return 0;
+
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_inode_provenance(inode, true);
 
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
 	spin_lock_nested(prov_lock(iprov), PROVENANCE_LOCK_INODE);
 	rc = uses(RL_GETATTR, iprov, tprov, cprov, NULL, 0);
+	if (rc >= 0)
+		getattr_cache_add(cprov, iprov);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
 	return rc;
@@ -724,12 +770,17 @@ static int provenance_inode_getattr(const struct path *path)
  */
 static int provenance_inode_readlink(struct dentry *dentry)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_dentry_provenance(dentry, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc;
 
+	if (provenance_dentry_is_ignored(dentry))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_dentry_provenance(dentry, true);
 	if (!iprov)
 		return -ENOMEM;
 
@@ -748,9 +799,10 @@ static int provenance_inode_readlink(struct dentry *dentry)
  * @param dentry The dentry struct whose inode's provenance xattr is to be set.
  * @param name Must be XATTR_NAME_PROVENANCE to set the xattr.
  * @param value Setting of the provenance xattr.
- * @param size Must be the size of provenance entry.
+ * @param size At least the size of the basic elements of a provenance entry, the only ones read,
+ *             so that entries of an older layout of "union prov_elt" are accepted.
  * @param flags The operational flags.
- * @return 0 if no error occurred; -ENOMEM if size does not match. Other error codes unknown.
+ * @return 0 if no error occurred; -ENOMEM if the entry is too small. Other error codes unknown.
  *
  */
 static int provenance_inode_setxattr(struct dentry *dentry,
@@ -763,7 +815,7 @@ static int provenance_inode_setxattr(struct dentry *dentry,
 	union prov_elt *setting;
 
 	if (strcmp(name, XATTR_NAME_PROVENANCE) == 0) { // Provenance xattr
-		if (size != sizeof(union prov_elt))
+		if (size < sizeof(struct msg_struct))
 			return -ENOMEM;
 		prov = get_dentry_provenance(dentry, true);
 		setting = (union prov_elt *)value;
@@ -823,6 +875,7 @@ static void provenance_inode_post_setxattr(struct dentry *dentry,
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
 	spin_lock_nested(prov_lock(iprov), PROVENANCE_LOCK_INODE);
 	record_write_xattr(RL_SETXATTR, iprov, tprov, cprov, name, value, size, flags);
+	invalidate_inode_provenance(iprov);     // e.g., a new security label.
 	queue_save_provenance(iprov, dentry);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
@@ -843,15 +896,19 @@ static void provenance_inode_post_setxattr(struct dentry *dentry,
  */
 static int provenance_inode_getxattr(struct dentry *dentry, const char *name)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_dentry_provenance(dentry, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	int rc = 0;
 	unsigned long irqflags;
 
 	if (strcmp(name, XATTR_NAME_PROVENANCE) == 0)
 		return 0;
-
+	if (provenance_dentry_is_ignored(dentry))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_dentry_provenance(dentry, true);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -875,12 +932,17 @@ static int provenance_inode_getxattr(struct dentry *dentry, const char *name)
  */
 static int provenance_inode_listxattr(struct dentry *dentry)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_dentry_provenance(dentry, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_dentry_is_ignored(dentry))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_dentry_provenance(dentry, true);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -921,6 +983,7 @@ static int provenance_inode_removexattr(struct dentry *dentry, const char *name)
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
 	spin_lock_nested(prov_lock(iprov), PROVENANCE_LOCK_INODE);
 	rc = record_write_xattr(RL_RMVXATTR, iprov, tprov, cprov, name, NULL, 0, 0);
+	invalidate_inode_provenance(iprov);     // The attribute is about to be removed.
 	queue_save_provenance(iprov, dentry);
 	spin_unlock(prov_lock(iprov));
 	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
@@ -956,6 +1019,7 @@ static int provenance_inode_getsecurity(struct inode *inode,
 		goto out;
 	*buffer = kmalloc(sizeof(union prov_elt), GFP_KERNEL);
 	memcpy(*buffer, prov_elt(iprov), sizeof(union prov_elt));
+	((union prov_elt *)*buffer)->node_info.var_ptr = NULL;  // Kernel address.
 out:
 	return sizeof(union prov_elt);
 }
@@ -1002,6 +1066,7 @@ static int provenance_inode_listsecurity(struct inode *inode,
  * and the requested permission from @mask,
  * record various provenance relations, including:
  * RL_WRITE, RL_READ, RL_SEARCH, RL_SND, RL_RCV, RL_EXEC.
+ * RL_SEARCH is not recorded if the user set "should_skip_lookup".
  * @param file The file structure being accessed.
  * @param mask The requested permissions.
  * @return 0 if permission is granted; -ENOMEM if inode provenance is NULL. Other error codes unknown.
@@ -1009,14 +1074,19 @@ static int provenance_inode_listsecurity(struct inode *inode,
  */
 static int provenance_file_permission(struct file *file, int mask)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_file_provenance(file, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	struct inode *inode = file_inode(file);
 	uint32_t perms;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_file_is_ignored(file))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_file_provenance(file, true);
 	if (!iprov)
 		return -ENOMEM;
 	perms = file_mask_to_perms(inode->i_mode, mask);
@@ -1033,7 +1103,7 @@ static int provenance_file_permission(struct file *file, int mask)
 			if (rc < 0)
 				goto out;
 		}
-		if ((perms & (DIR__SEARCH)) != 0) {
+		if ((perms & (DIR__SEARCH)) != 0 && !prov_policy.should_skip_lookup) {
 			rc = uses(RL_SEARCH, iprov, tprov, cprov, file, mask);
 			if (rc < 0)
 				goto out;
@@ -1169,12 +1239,17 @@ static int provenance_kernel_read_file(struct file *file
  */
 static int provenance_file_open(struct file *file)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_file_provenance(file, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_file_is_ignored(file))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_file_provenance(file, true);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -1197,12 +1272,17 @@ static int provenance_file_open(struct file *file)
  */
 static int provenance_file_receive(struct file *file)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_file_provenance(file, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_file_is_ignored(file))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_file_provenance(file, true);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -1223,12 +1303,17 @@ static int provenance_file_receive(struct file *file)
  */
 static int provenance_file_lock(struct file *file, unsigned int cmd)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_file_provenance(file, false);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_file_is_ignored(file))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_file_provenance(file, false);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -1262,6 +1347,12 @@ static int provenance_file_send_sigiotask(struct task_struct *task,
 
 	if (!iprov)
 		return -ENOMEM;
+	// @task is not current, its node cannot be created here (see "materialize_task_provenance"); use its thread group leader.
+	if (tprov && provenance_is_lazy(tprov)) {
+		tprov = task->group_leader->provenance;
+		if (!tprov || provenance_is_lazy(tprov))
+			return 0;
+	}
 	if (!signum)
 		signum = SIGIO;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -1413,12 +1504,17 @@ static int provenance_file_ioctl(struct file *file,
 				 unsigned int cmd,
 				 unsigned long arg)
 {
-	struct provenance *cprov = get_cred_provenance();
-	struct provenance *tprov = get_task_provenance(true);
-	struct provenance *iprov = get_file_provenance(file, true);
+	struct provenance *cprov;
+	struct provenance *tprov;
+	struct provenance *iprov;
 	unsigned long irqflags;
 	int rc = 0;
 
+	if (provenance_file_is_ignored(file))
+		return 0;
+	cprov = get_cred_provenance();
+	tprov = get_task_provenance(true);
+	iprov = get_file_provenance(file, true);
 	if (!iprov)
 		return -ENOMEM;
 	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
@@ -2208,6 +2304,7 @@ static int provenance_socket_sock_rcv_skb(struct sock *sk, struct sk_buff *skb)
 		if (provenance_records_packet(prov_elt(iprov)))
 			record_packet_content(skb, &pckprov);
 
+		prov_attach_query_state(&pckprov);
 		spin_lock_irqsave(prov_lock(iprov), irqflags);
 		call_provenance_alloc((prov_entry_t *)&pckprov);
 		rc = derives(RL_RCV_PACKET, &pckprov, iprov, NULL, 0);
@@ -2425,6 +2522,7 @@ static void provenance_sb_free_security(struct super_block *sb)
  * This hook is triggered when mounting a kernel device, including pipe.
  * This function will update the Universal Unique ID of the provenance entry of the device @sb->s_provenance once it is mounted.
  * We obtain this information from @sb if it exists, or we give it a random value.
+ * The capture mode of the superblock (ignored, opaque or normal) is then set from the superblock filters.
  * @param sb The super block structure.
  * @param flags The operations flags.
  * @param data
@@ -2445,6 +2543,7 @@ static int provenance_sb_kern_mount(struct super_block *sb,
 	}
 	if (c == 0)     // If no uuid defined, generate a random one.
 		get_random_bytes(prov_elt(sbprov)->sb_info.uuid, 16 * sizeof(uint8_t));
+	prov_sb_apply(sb, NULL);        // Now that the UUID is known, set the capture mode.
 	return 0;
 }
 
@@ -2556,10 +2655,18 @@ LIST_HEAD(secctx_filters);
 LIST_HEAD(user_filters);
 LIST_HEAD(group_filters);
 LIST_HEAD(ns_filters);
+LIST_HEAD(sb_filters);
+LIST_HEAD(xattr_filters);
+LIST_HEAD(pattern_filters);
+DEFINE_MUTEX(pattern_lock);
 LIST_HEAD(provenance_query_hooks);
 LIST_HEAD(relay_list);
+struct prov_name_entry __rcu *prov_name_cache[1 << PROV_NAME_CACHE_BITS];
+DEFINE_SPINLOCK(prov_name_lock);
 
 struct capture_policy prov_policy;
+DEFINE_PER_CPU(uint32_t [PROV_SAMPLING_SIZE], prov_sampling_count);
+DEFINE_PER_CPU(struct getattr_cache_entry [PROV_GETATTR_CACHE_SIZE], getattr_cache);
 
 uint32_t prov_machine_id;
 uint32_t prov_boot_id;
@@ -2605,7 +2712,7 @@ void __init provenance_add_hooks(void)
 	if (unlikely(!provenance_cache))
 		panic("Provenance: could not allocate provenance_cache.");
 	long_provenance_cache = kmem_cache_create("long_provenance_struct",
-						  sizeof(union long_prov_elt),
+						  sizeof(union long_prov_elt) + PROV_QUERY_STATE_SIZE,   // Followed by the query module state.
 						  0, SLAB_PANIC, NULL);
 	if (unlikely(!long_provenance_cache))
 		panic("Provenance: could not allocate long_provenance_cache.");
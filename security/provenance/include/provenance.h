@@ -24,6 +24,7 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/xattr.h>
+#include <linux/provenance_blob.h>
 
 #include "provenance_policy.h"
 #include "provenance_filter.h"
@@ -48,8 +49,25 @@ enum {
 	PROVENANCE_LOCK_SOCK
 };
 
+/*
+ * Same layout as "struct provenance_blob" (include/linux/provenance_blob.h),
+ * the storage embedded in inodes, creds and tasks.
+ */
 struct provenance {
 	union prov_elt msg;
+	union {
+		struct {        // process
+			unsigned long budget_jiffies;   // Last time the flow budget of a process was refilled.
+			atomic_t budget;                // Number of flows a process can still record.
+			atomic_t aggregated;            // Number of flows aggregated since the last summary relation.
+			atomic_t threads;               // Number of threads never involved in a flow freed since the last thread summary.
+		};
+		struct {        // inode
+			uint64_t refresh_ctime;         // ctime (ns) of the inode when its attributes were last copied.
+			uint64_t refresh_version;       // i_version of the inode when its attributes were last copied.
+		};
+	};
+	uint8_t query_state[PROV_QUERY_STATE_SIZE];     // State of query modules, pointed to by "var_ptr".
 	spinlock_t lock;
 };
 
@@ -57,11 +75,29 @@ struct provenance {
 #define prov_lock(provenance)           (&(provenance->lock))
 #define prov_entry(provenance)          ((prov_entry_t *)prov_elt(provenance))
 
+/*
+ * Point a node to its query module state (see PROV_QUERY_STATE_SIZE).
+ * To be done again whenever the node is overwritten (e.g., loaded from its xattr).
+ * Long nodes keep "var_ptr" NULL, see "long_prov_query_state".
+ */
+#define prov_attach_query_state(provenance)     (prov_elt(provenance)->node_info.var_ptr = (provenance)->query_state)
+
 #define ASSIGN_NODE_ID    0
 
 extern struct kmem_cache *provenance_cache;
 extern struct kmem_cache *long_provenance_cache;
 
+static __always_inline void __init_provenance(struct provenance *prov, uint64_t ntype)
+{
+	spin_lock_init(prov_lock(prov));
+	prov_type(prov_elt(prov)) = ntype;
+	node_identifier(prov_elt(prov)).id = prov_next_node_id();
+	node_identifier(prov_elt(prov)).boot_id = prov_boot_id;
+	node_identifier(prov_elt(prov)).machine_id = prov_machine_id;
+	prov_attach_query_state(prov);
+	call_provenance_alloc(prov_entry(prov));
+}
+
 /*!
  * @brief Allocate memory for a new provenance node and populate "node_identifier" information.
  *
@@ -84,12 +120,7 @@ static __always_inline struct provenance *alloc_provenance(uint64_t ntype, gfp_t
 
 	if (!prov)
 		return NULL;
-	spin_lock_init(prov_lock(prov));
-	prov_type(prov_elt(prov)) = ntype;
-	node_identifier(prov_elt(prov)).id = prov_next_node_id();
-	node_identifier(prov_elt(prov)).boot_id = prov_boot_id;
-	node_identifier(prov_elt(prov)).machine_id = prov_machine_id;
-	call_provenance_alloc(prov_entry(prov));
+	__init_provenance(prov, ntype);
 	return prov;
 }
 
@@ -102,6 +133,61 @@ static inline void free_provenance(struct provenance *prov)
 	kmem_cache_free(provenance_cache, prov);
 }
 
+/*!
+ * @brief Initialize a provenance node in the storage embedded in its inode, cred or task.
+ *
+ * Same as "alloc_provenance" without the allocation, so it cannot fail.
+ * The blob is zeroed first: it may hold a copy of the parent's provenance (e.g., after dup_task_struct or prepare_creds).
+ * @param blob The storage embedded in the kernel object.
+ * @param ntype The type of the provenance node.
+ * @return The pointer to the provenance node, within @blob.
+ *
+ */
+static __always_inline struct provenance *init_provenance(struct provenance_blob *blob, uint64_t ntype)
+{
+	struct provenance *prov = (struct provenance *)blob;
+
+	BUILD_BUG_ON(!prov_type_is_node(ntype));
+	BUILD_BUG_ON(sizeof(struct provenance) != sizeof(struct provenance_blob));
+	BUILD_BUG_ON(offsetof(struct provenance, lock) != offsetof(struct provenance_blob, lock));
+
+	memset(prov, 0, sizeof(struct provenance));
+	__init_provenance(prov, ntype);
+	return prov;
+}
+
+/*!
+ * @brief Initialize a provenance node in embedded storage, without giving it an identifier yet.
+ *
+ * Used for threads, whose node is only created if a relation involving them is recorded (see "materialize_task_provenance").
+ * Until then, the node has identifier 0 and query modules are not told about it.
+ */
+static __always_inline struct provenance *init_lazy_provenance(struct provenance_blob *blob, uint64_t ntype)
+{
+	struct provenance *prov = (struct provenance *)blob;
+
+	BUILD_BUG_ON(!prov_type_is_node(ntype));
+
+	memset(prov, 0, sizeof(struct provenance));
+	spin_lock_init(prov_lock(prov));
+	prov_type(prov_elt(prov)) = ntype;
+	node_identifier(prov_elt(prov)).boot_id = prov_boot_id;
+	node_identifier(prov_elt(prov)).machine_id = prov_machine_id;
+	prov_attach_query_state(prov);
+	return prov;
+}
+
+#define provenance_is_lazy(prov)        (READ_ONCE(node_identifier(prov_elt(prov)).id) == 0)
+
+/*!
+ * @brief Release a provenance node initialized by "init_provenance"; its storage goes with its kernel object.
+ */
+static inline void fini_provenance(struct provenance *prov)
+{
+	if (!provenance_is_lazy(prov))
+		call_provenance_free(prov_entry(prov));
+}
+
 /*!
  * @brief Allocate memory for a new long provenance node and set the provenance "LONG" flag (in basic_elements).
  *
@@ -196,4 +282,6 @@ static inline bool __provenance_is_kernel_recorded(union long_prov_elt *node)
 		return false;
 	return true;
 }
+
+#include "provenance_sb.h"    // needs struct provenance
 #endif
@@ -0,0 +1,37 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _PROVENANCE_COMPRESS_H
+#define _PROVENANCE_COMPRESS_H
+
+#include <linux/relay.h>
+
+struct prov_lz4_buf;
+
+#ifdef CONFIG_SECURITY_PROVENANCE_LZ4
+struct prov_lz4_buf __percpu *prov_lz4_alloc(void);
+void prov_lz4_attach(struct prov_lz4_buf __percpu *lz4, struct rchan *chan);
+void prov_lz4_free(struct prov_lz4_buf __percpu *lz4);
+void prov_lz4_write(struct rchan *chan, const void *msg, size_t size);
+void prov_lz4_flush(struct rchan *chan);
+#else
+static inline struct prov_lz4_buf __percpu *prov_lz4_alloc(void)
+{
+	return NULL;
+}
+static inline void prov_lz4_attach(struct prov_lz4_buf __percpu *lz4, struct rchan *chan) {}
+static inline void prov_lz4_free(struct prov_lz4_buf __percpu *lz4) {}
+static inline void prov_lz4_write(struct rchan *chan, const void *msg, size_t size) {}
+static inline void prov_lz4_flush(struct rchan *chan) {}
+#endif
+
+#endif
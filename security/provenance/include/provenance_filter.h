@@ -13,10 +13,13 @@
 #ifndef _PROVENANCE_FILTER_H
 #define _PROVENANCE_FILTER_H
 
+#include <linux/percpu.h>
+#include <linux/bitops.h>
 #include <uapi/linux/provenance.h>
 
 #include "provenance_policy.h"
 #include "provenance_ns.h"
+#include "provenance_xattr.h"
 
 #define HIT_FILTER(filter, data)        ((filter & data) != 0)
 
@@ -95,6 +98,83 @@ static inline bool filter_relation(const uint64_t type)
 	return false;
 }
 
+/*!
+ * @brief Per-CPU counters used to pick which edges are kept when a relation type is sampled.
+ */
+DECLARE_PER_CPU(uint32_t [PROV_SAMPLING_SIZE], prov_sampling_count);
+
+/*!
+ * @brief This function returns the index of the sampling rate of a relation type in the capture policy.
+ *
+ * Sampling rates are organised by category, in the same way as the relation filters,
+ * and indexed by the subtype bit of the relation within its category.
+ * Relations that version or name a node, and relations that close a node, cannot be sampled,
+ * as dropping them would leave the graph inconsistent.
+ * User annotations (RL_LOG), summaries of rate limited flows (RL_AGGREGATE) and of threads never involved in a flow (RL_AGGREGATE_THREADS)
+ * are always recorded.
+ * @param type The type of the relation (i.e., edge).
+ * @return The index of the sampling rate or -1 if the relation cannot be sampled.
+ *
+ */
+static inline int relation_sampling_index(const uint64_t type)
+{
+	uint64_t subtype = SUBTYPE(type);
+	int category;
+
+	if (!subtype || filter_update_node(type) || prov_is_close(type)
+	    || type == RL_LOG || type == RL_AGGREGATE || type == RL_AGGREGATE_THREADS)
+		return -1;
+	if (prov_is_derived(type))
+		category = 0;
+	else if (prov_is_generated(type))
+		category = 1;
+	else if (prov_is_used(type))
+		category = 2;
+	else if (prov_is_informed(type))
+		category = 3;
+	else
+		return -1;
+	return category * PROV_SAMPLING_SUBTYPES + __ffs64(subtype);
+}
+
+/*!
+ * @brief This function returns the weight of a relation, i.e., the number of relations of this type it stands for.
+ * @param type The type of the relation (i.e., edge).
+ * @return The sampling rate of the relation type, 1 if the relation type is not sampled.
+ *
+ */
+static inline uint32_t relation_sampling_weight(const uint64_t type)
+{
+	int index = relation_sampling_index(type);
+	uint32_t rate;
+
+	if (index < 0)
+		return 1;
+	rate = READ_ONCE(prov_policy.prov_sampling[index]);
+	if (rate <= 1)
+		return 1;
+	return rate;
+}
+
+/*!
+ * @brief This function decides whether or not a relation (i.e., edge) should be dropped by sampling.
+ *
+ * If the user set a sampling rate N for the type of the relation, only one in N relations of that type is recorded.
+ * Recorded relations carry N as their weight so that consumers can estimate the volume of the flows.
+ * The decision is made before any node is versioned so that dropped relations cost as little as possible.
+ * @param type The type of the relation (i.e., edge).
+ * @return true if the relation should be dropped (i.e., not recorded) or false if otherwise.
+ *
+ */
+static inline bool filter_sampled_relation(const uint64_t type)
+{
+	uint32_t rate = relation_sampling_weight(type);
+
+	if (likely(rate == 1))
+		return false;
+	return (this_cpu_inc_return(prov_sampling_count[relation_sampling_index(type)]) % rate) != 0;
+}
+
 /*!
  * @brief This function decides whether or not tracking should propagate.
  *
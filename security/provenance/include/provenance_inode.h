@@ -15,17 +15,28 @@
 
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/iversion.h>
 #include <linux/namei.h>
+#include <linux/percpu.h>
 #include <linux/xattr.h>
+#include <linux/xxhash.h>
+#include <asm/unaligned.h>
 
 #include "provenance_record.h"
 #include "provenance_policy.h"
 #include "provenance_filter.h"
+#include "provenance_name.h"
 
 #define is_inode_dir(inode)             S_ISDIR(inode->i_mode)
 #define is_inode_socket(inode)          S_ISSOCK(inode->i_mode)
 #define is_inode_file(inode)            S_ISREG(inode->i_mode)
 
+/*!
+ * @brief A permission check on a directory that only asks for search permission is a path lookup (i.e., the directory is a non-final path component).
+ */
+#define is_lookup_permission(inode, mask)       (is_inode_dir(inode) && ((mask) & ~MAY_NOT_BLOCK) == MAY_EXEC)
+
 /*!
  * @brief Update the type of the provenance inode node based on the mode of the inode, and create a version relation between old and new provenance node.
  *
@@ -117,13 +128,14 @@ static inline void provenance_mark_as_opaque(const char *name)
  * @brief Record the name of a provenance node from directory entry.
  *
  * Unless specific criteria are met,
- * the name of the provenance node is looked up through "dentry_path_raw" and function "record_node_name" is called,
- * to associate the name of the provenance to the provenance node itself as a relation.
+ * the name of the provenance node, the path of @dentry from the root of its file system, is associated to the provenance node as a relation.
+ * The path node is taken from the path node cache (see "record_dentry_name") or resolved through "dentry_path_raw".
  * The criteria to be met are:
- * 1. The name of the provenance node has been recorded already, or
+ * 1. The name of the provenance node has been recorded already and @force is not set, or
  * 2. The provenance node itself has not been recorded.
  * @param dentry Pointer to dentry of the base directory.
  * @param prov The provenance node in question.
+ * @param force Record the name even if one has been recorded already (new link or rename).
  * @return 0 if no error occurred. -ENOMEM if no memory to store the name of the provenance node. PTR_ERR if path lookup failed.
  *
  */
@@ -131,23 +143,7 @@ static inline int record_inode_name_from_dentry(struct dentry *dentry,
 						struct provenance *prov,
 						bool force)
 {
-	char *buffer;
-	char *ptr;
-	int rc;
-
-	if (provenance_is_name_recorded(prov_elt(prov)) ||
-	    !provenance_is_recorded(prov_elt(prov)))
-		return 0;
-	// Should not sleep.
-	buffer = kcalloc(PATH_MAX, sizeof(char), GFP_ATOMIC);
-	if (!buffer)
-		return -ENOMEM;
-	ptr = dentry_path_raw(dentry, buffer, PATH_MAX);
-	if (IS_ERR(ptr))
-		return PTR_ERR(ptr);
-	rc = record_node_name(prov, ptr, force);
-	kfree(buffer);
-	return rc;
+	return record_dentry_name(prov, dentry, NULL, force);
 }
 
 /*!
@@ -177,6 +173,14 @@ static inline int record_inode_name(struct inode *inode, struct provenance *prov
 	return rc;
 }
 
+/*!
+ * @brief Force the next "refresh_inode_provenance" to copy the inode attributes, whatever its ctime and i_version.
+ */
+static __always_inline void invalidate_inode_provenance(struct provenance *prov)
+{
+	WRITE_ONCE(prov->refresh_ctime, U64_MAX);
+}
+
 /*!
  * @brief Update provenance information of an inode node.
  *
@@ -187,15 +191,34 @@ static inline int record_inode_name(struct inode *inode, struct provenance *prov
  * 3. Update uid and gid information of the inode node.
  * 4. Update secid information of the inode node.
  * 5. Update the type of the inode node itself.
+ * Steps 2 to 5 are skipped unless the inode changed since they last ran:
+ * chown, chmod and setxattr all update ctime (and i_version, where the file system keeps it),
+ * and a change of type shows in the mode.
+ * ctime only has jiffy granularity and i_version is 0 without SB_I_VERSION,
+ * so the owner is compared as well, and the setattr and xattr hooks force the next refresh.
+ * The snapshot is taken before the attributes are read, so a concurrent change is picked up by the next refresh.
  * @param inode The inode in question whose provenance entry to be updated.
  *
  */
 static __always_inline void refresh_inode_provenance(struct inode *inode,
 						     struct provenance *prov)
 {
+	uint64_t ctime;
+	uint64_t version;
+
 	if (provenance_is_opaque(prov_elt(prov)))
 		return;
 	record_inode_name(inode, prov);
+	ctime = timespec64_to_ns(&inode->i_ctime);
+	version = inode_peek_iversion_raw(inode);
+	if (ctime == READ_ONCE(prov->refresh_ctime)
+	    && version == READ_ONCE(prov->refresh_version)
+	    && inode->i_mode == prov_elt(prov)->inode_info.mode
+	    && __kuid_val(inode->i_uid) == node_uid(prov_elt(prov))
+	    && __kgid_val(inode->i_gid) == node_gid(prov_elt(prov)))
+		return;
+	WRITE_ONCE(prov->refresh_ctime, ctime);
+	WRITE_ONCE(prov->refresh_version, version);
 	prov_elt(prov)->inode_info.ino = inode->i_ino;
 	node_uid(prov_elt(prov)) = __kuid_val(inode->i_uid);
 	node_gid(prov_elt(prov)) = __kgid_val(inode->i_gid);
@@ -209,6 +232,9 @@ static __always_inline void refresh_inode_provenance(struct inode *inode,
  * We do not initialize the inode if it has already been initialized, or failure occurred.
  * Provenance extended attributes are copied to the inode provenance in this function,
  * unless the inode does not support xattr.
+ * The size of the xattr tells its layout: an xattr saved by a kernel with another layout of "union prov_elt"
+ * (e.g., before "previous_version" was added) only has its basic elements (identifier, flags and taint) copied,
+ * as only those are at the same place; the other attributes are refreshed from the inode.
  * inode struct contains @inode->i_provenance to store provenance.
  * @param inode The inode structure in which we initialize provenance.
  * @param opt_dentry The directory entry pointer.
@@ -249,8 +275,10 @@ static inline int inode_init_provenance(struct inode *inode,
 	}
 	rc = __vfs_getxattr(dentry, inode, XATTR_NAME_PROVENANCE, buf, sizeof(union prov_elt));
 	dput(dentry);
+	if (rc >= 0 && rc < sizeof(struct msg_struct))
+		rc = -ENODATA;
 	if (rc < 0) {
-		if (rc != -ENODATA && rc != -EOPNOTSUPP) {
+		if (rc != -ENODATA && rc != -EOPNOTSUPP && rc != -ERANGE) {
 			clear_initialized(prov_elt(prov));
 			goto free_buf;
 		} else {
@@ -258,7 +286,14 @@ static inline int inode_init_provenance(struct inode *inode,
 			goto free_buf;
 		}
 	}
-	memcpy(prov_elt(prov), buf, sizeof(union prov_elt));
+	if (rc == sizeof(union prov_elt))
+		memcpy(prov_elt(prov), buf, sizeof(union prov_elt));
+	else    // Saved with another layout.
+		memcpy(prov_elt(prov), buf, sizeof(struct msg_struct));
+	prov_attach_query_state(prov);
+	if (provenance_inode_sb_is_opaque(inode))      // The flags were overwritten by those stored in the xattr.
+		set_opaque(prov_elt(prov));
+	invalidate_inode_provenance(prov);     // The attributes stored in the xattr may be stale.
 	rc = 0;
 free_buf:
 	kfree(buf);
@@ -270,12 +305,14 @@ free_buf:
  *
  * This function either initialize the provenance of the inode (if not initialized) and/or refreshes the provenance of the inode if needed.
  * If the function can sleep, provenance information of the inode should be refreshed.
+ * An inode of an opaque superblock is made opaque when it is allocated or when the superblock becomes opaque (see "prov_sb_apply"),
+ * and stays so until evicted, even once the superblock is no longer opaque.
+ * Nothing is written here: callers may hold the lock of another inode (e.g., "current_update_shst").
  * @param inode The inode in question.
  * @param may_sleep Bool value signifies whether this function can sleep.
  * @return provenance struct pointer.
  *
  * @todo Error checking in this function should be included since "inode_init_provenance" can fail (i.e., non-zero return value).
- * @todo We may not want to update (call refresh_inode_provenance) all the time.
  */
 static __always_inline struct provenance *get_inode_provenance(struct inode *inode, bool may_sleep)
 {
@@ -349,6 +386,7 @@ static inline void save_provenance(struct dentry *dentry)
 	spin_unlock(prov_lock(prov));
 	clear_recorded(&buf);
 	clear_name_recorded(&buf);
+	buf.node_info.var_ptr = NULL;   // Kernel address, attached again when loaded.
 	if (!dentry)
 		return;
 	__vfs_setxattr_noperm(dentry, XATTR_NAME_PROVENANCE, &buf, sizeof(union prov_elt), 0);
@@ -368,6 +406,7 @@ static inline void save_provenance(struct dentry *dentry)
  * 2. If the relation @type should not be recorded, or
  * 3. Failure occurred.
  * xattr name and value pair is recorded in the long provenance entry.
+ * If the xattr filters set PROV_SET_HASH for @name, the xxh64 of the whole value is recorded instead of a copy (see HASHED_BIT).
  * @param type The type of relation to be recorded.
  * @param iprov The inode provenance entry.
  * @param tprov The task provenance entry.
@@ -398,12 +437,19 @@ static __always_inline int record_write_xattr(uint64_t type,
 		return 0;
 	if (!should_record_relation(type, prov_entry(cprov), prov_entry(iprov)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 	xattr = alloc_long_provenance(ENT_XATTR);
 	if (!xattr)
 		return -ENOMEM;
 	memcpy(xattr->xattr_info.name, name, PROV_XATTR_NAME_SIZE - 1);
 	xattr->xattr_info.name[PROV_XATTR_NAME_SIZE - 1] = '\0';
-	if (value) {
+	if (value && (prov_xattr_whichOP(name) & PROV_SET_HASH)) {
+		put_unaligned(xxh64(value, size, 0), (uint64_t *)xattr->xattr_info.value);
+		put_unaligned((uint64_t)size, (uint64_t *)xattr->xattr_info.value + 1);        // Kept within record_size.
+		xattr->xattr_info.size = size;
+		set_hashed(xattr);
+	} else if (value) {
 		if (size < PROV_XATTR_VALUE_SIZE) {
 			xattr->xattr_info.size = size;
 			memcpy(xattr->xattr_info.value, value, size);
@@ -460,6 +506,8 @@ static __always_inline int record_read_xattr(struct provenance *cprov,
 		return 0;
 	if (!should_record_relation(RL_GETXATTR, prov_entry(iprov), prov_entry(cprov)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 	xattr = alloc_long_provenance(ENT_XATTR);
 	if (!xattr) {
 		rc = -ENOMEM;
@@ -480,6 +528,76 @@ out:
 	return rc;
 }
 
+#define PROV_GETATTR_CACHE_BITS         6
+#define PROV_GETATTR_CACHE_SIZE         (1 << PROV_GETATTR_CACHE_BITS)
+
+/*!
+ * @brief A getattr relation recorded between a version of an inode and a version of a process.
+ */
+struct getattr_cache_entry {
+	uint64_t proc_id;
+	uint64_t inode_id;
+	uint32_t proc_version;
+	uint32_t inode_version;
+};
+
+DECLARE_PER_CPU(struct getattr_cache_entry [PROV_GETATTR_CACHE_SIZE], getattr_cache);
+
+/*!
+ * @brief This function checks whether a getattr relation between the current versions of a process and an inode has already been recorded.
+ *
+ * Each CPU keeps a small direct-mapped cache of getattr relations, indexed by the identifiers of the process and the inode.
+ * An entry matches only if both nodes are still at the version they had when the relation was recorded,
+ * in which case recording the relation again would not add any information.
+ * This function is called before any lock is taken, the nodes are therefore read without locking.
+ * A torn read can only cause a cache miss or skip a relation that is about to become redundant.
+ * @param cprov The provenance node of the process.
+ * @param iprov The provenance node of the inode.
+ * @return true if the getattr relation has already been recorded or false if otherwise.
+ *
+ */
+static inline bool getattr_cache_hit(struct provenance *cprov, struct provenance *iprov)
+{
+	struct getattr_cache_entry *entry;
+	uint64_t proc_id = node_identifier(prov_elt(cprov)).id;
+	uint64_t inode_id = node_identifier(prov_elt(iprov)).id;
+	bool hit;
+
+	if (!prov_policy.should_compress_edge && !prov_policy.should_reduce)
+		return false;
+	if (!provenance_is_recorded(prov_elt(cprov)) || !provenance_is_recorded(prov_elt(iprov)))
+		return false;
+	entry = get_cpu_ptr(&getattr_cache[hash_64(proc_id ^ inode_id, PROV_GETATTR_CACHE_BITS)]);
+	hit = entry->proc_id == proc_id
+	      && entry->inode_id == inode_id
+	      && entry->proc_version == node_identifier(prov_elt(cprov)).version
+	      && entry->inode_version == node_identifier(prov_elt(iprov)).version;
+	put_cpu_ptr(entry);
+	return hit;
+}
+
+/*!
+ * @brief This function remembers that a getattr relation between the current versions of a process and an inode has been recorded.
+ * @param cprov The provenance node of the process.
+ * @param iprov The provenance node of the inode.
+ *
+ */
+static inline void getattr_cache_add(struct provenance *cprov, struct provenance *iprov)
+{
+	struct getattr_cache_entry *entry;
+	uint64_t proc_id = node_identifier(prov_elt(cprov)).id;
+	uint64_t inode_id = node_identifier(prov_elt(iprov)).id;
+
+	if (!prov_policy.should_compress_edge && !prov_policy.should_reduce)
+		return;
+	entry = get_cpu_ptr(&getattr_cache[hash_64(proc_id ^ inode_id, PROV_GETATTR_CACHE_BITS)]);
+	entry->proc_id = proc_id;
+	entry->inode_id = inode_id;
+	entry->proc_version = node_identifier(prov_elt(cprov)).version;
+	entry->inode_version = node_identifier(prov_elt(iprov)).version;
+	put_cpu_ptr(entry);
+}
+
 #define FILE__EXECUTE           0x00000001UL
 #define FILE__READ              0x00000002UL
 #define FILE__APPEND            0x00000004UL
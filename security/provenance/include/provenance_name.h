@@ -0,0 +1,216 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _PROVENANCE_NAME_H
+#define _PROVENANCE_NAME_H
+
+#include <linux/dcache.h>
+#include <linux/fs_struct.h>
+#include <linux/hash.h>
+#include <linux/mount.h>
+#include <linux/path.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "provenance.h"
+#include "provenance_record.h"
+
+/*
+ * Cache of the path nodes (ENT_PATH) emitted for dentries.
+ * A hit names a node without resolving the path again, and the path node,
+ * already recorded in this epoch, is referenced by identifier only.
+ * The cache is direct-mapped on the dentry: bounded, a slot is replaced on collision.
+ * Lookups run under RCU; insertions and invalidations take prov_name_lock.
+ * An entry is only valid while no dentry has been moved since it was resolved ("rename_lock" sequence),
+ * as moving a directory changes the path of every dentry below it.
+ */
+#define PROV_NAME_CACHE_BITS    8
+
+struct prov_name_entry {
+	struct rcu_head rcu;
+	spinlock_t lock;                        // Serialises recording the name node.
+	const struct dentry *dentry;            // Key: the dentry,
+	const struct dentry *parent;            // its parent when the path was resolved,
+	u64 hash_len;                           // the hash and length of its name,
+	const struct vfsmount *mnt;             // the mount (NULL for a path from the file system root),
+	struct path root;                       // the root of the caller if the mount is set ("d_path"),
+	unsigned int rename_seq;                // and the "rename_lock" sequence when the path was resolved.
+	union long_prov_elt *name;
+};
+
+extern struct prov_name_entry __rcu *prov_name_cache[1 << PROV_NAME_CACHE_BITS];
+extern spinlock_t prov_name_lock;
+
+#define prov_name_slot(dentry)  (&prov_name_cache[hash_ptr((dentry), PROV_NAME_CACHE_BITS)])
+
+static inline void __free_name_entry(struct rcu_head *head)
+{
+	struct prov_name_entry *e = container_of(head, struct prov_name_entry, rcu);
+
+	free_long_provenance(e->name);
+	kfree(e);
+}
+
+/*!
+ * @brief Read the root of the current process, against which "d_path" resolves paths.
+ */
+static __always_inline void __prov_name_root(struct path *root)
+{
+	struct fs_struct *fs = current->fs;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&fs->seq);
+		*root = fs->root;
+	} while (read_seqcount_retry(&fs->seq, seq));
+}
+
+/*!
+ * @brief Whether the cached path of @e is still the path of @dentry on @mnt, seen from @root.
+ *
+ * Any dentry moved since @e was resolved invalidates it (see "rename_lock").
+ * The parent and name are checked as well, in case @dentry was freed and its memory reused.
+ */
+static __always_inline bool __name_entry_match(const struct prov_name_entry *e,
+					       const struct dentry *dentry,
+					       const struct vfsmount *mnt,
+					       const struct path *root)
+{
+	return e->dentry == dentry
+	       && e->mnt == mnt
+	       && (!mnt || path_equal(&e->root, root))
+	       && e->parent == READ_ONCE(dentry->d_parent)
+	       && e->hash_len == READ_ONCE(dentry->d_name.hash_len)
+	       && !read_seqretry(&rename_lock, e->rename_seq);
+}
+
+/*!
+ * @brief Replace the content of the slot of @dentry with @e (NULL to empty it), if @dentry is NULL or owns the slot.
+ */
+static inline void __prov_name_replace(struct prov_name_entry __rcu **slot,
+				       const struct dentry *dentry,
+				       struct prov_name_entry *e)
+{
+	struct prov_name_entry *old;
+
+	spin_lock(&prov_name_lock);
+	old = rcu_dereference_protected(*slot, lockdep_is_held(&prov_name_lock));
+	if (dentry && (!old || old->dentry != dentry)) {
+		spin_unlock(&prov_name_lock);
+		return;
+	}
+	rcu_assign_pointer(*slot, e);
+	spin_unlock(&prov_name_lock);
+	if (old)
+		call_rcu(&old->rcu, __free_name_entry);
+}
+
+/*!
+ * @brief Drop the cached path of @dentry (rename, link, unlink).
+ */
+static inline void prov_name_invalidate(const struct dentry *dentry)
+{
+	__prov_name_replace(prov_name_slot(dentry), dentry, NULL);
+}
+
+/*!
+ * @brief Record the name of @node, the path of @dentry, using the path node cache.
+ *
+ * The path is relative to the root of the file system ("dentry_path_raw") if @mnt is NULL,
+ * and absolute in the caller's namespace ("d_path") otherwise.
+ * Unless @force is set, nothing is done if the name of @node has already been recorded.
+ * @param node The provenance node to name.
+ * @param dentry The dentry of the node.
+ * @param mnt The mount of the dentry, or NULL.
+ * @param force Record the name even if one has already been recorded (e.g., new link).
+ * @return 0 if no error occurred. -ENOMEM if no memory to store the name. PTR_ERR if path lookup failed.
+ *
+ */
+static inline int record_dentry_name(struct provenance *node,
+				     struct dentry *dentry,
+				     struct vfsmount *mnt,
+				     bool force)
+{
+	struct prov_name_entry __rcu **slot = prov_name_slot(dentry);
+	struct prov_name_entry *e;
+	union long_prov_elt *fname_prov;
+	struct path path = { .mnt = mnt, .dentry = dentry };
+	struct path root = { };
+	char *buffer;
+	char *ptr;
+	int rc;
+
+	if (provenance_is_opaque(prov_elt(node)))
+		return 0;
+	if ((provenance_is_name_recorded(prov_elt(node)) && !force)
+	    || !provenance_is_recorded(prov_elt(node)))
+		return 0;
+
+	if (mnt)
+		__prov_name_root(&root);
+	rcu_read_lock();
+	e = rcu_dereference(*slot);
+	if (e && __name_entry_match(e, dentry, mnt, &root)) {
+		spin_lock(&e->lock);
+		rc = __record_node_name(node, e->name);
+		spin_unlock(&e->lock);
+		rcu_read_unlock();
+		return rc;
+	}
+	rcu_read_unlock();
+
+	// Should not sleep.
+	buffer = kcalloc(PATH_MAX, sizeof(char), GFP_ATOMIC);
+	if (!buffer)
+		return -ENOMEM;
+	e = kzalloc(sizeof(struct prov_name_entry), GFP_ATOMIC);
+	if (!e) {
+		rc = -ENOMEM;
+		goto free_buffer;
+	}
+	e->dentry = dentry;
+	e->mnt = mnt;
+	e->root = root;
+	// Read the key before the path: a concurrent rename changes it, and the entry never matches.
+	e->rename_seq = read_seqbegin(&rename_lock);
+	e->parent = READ_ONCE(dentry->d_parent);
+	e->hash_len = READ_ONCE(dentry->d_name.hash_len);
+	if (mnt)
+		ptr = d_path(&path, buffer, PATH_MAX);
+	else
+		ptr = dentry_path_raw(dentry, buffer, PATH_MAX);
+	if (IS_ERR(ptr)) {
+		rc = PTR_ERR(ptr);
+		goto free_entry;
+	}
+	fname_prov = alloc_long_provenance(ENT_PATH);
+	if (!fname_prov) {
+		rc = -ENOMEM;
+		goto free_entry;
+	}
+	strlcpy(fname_prov->file_name_info.name, ptr, PATH_MAX);
+	fname_prov->file_name_info.length = strnlen(fname_prov->file_name_info.name, PATH_MAX);
+	e->name = fname_prov;
+	spin_lock_init(&e->lock);
+	rc = __record_node_name(node, fname_prov);
+	__prov_name_replace(slot, NULL, e);
+	kfree(buffer);
+	return rc;
+
+free_entry:
+	kfree(e);
+free_buffer:
+	kfree(buffer);
+	return rc;
+}
+#endif
@@ -0,0 +1,35 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _PROVENANCE_PATTERN_H
+#define _PROVENANCE_PATTERN_H
+
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <uapi/linux/provenance.h>
+
+struct pattern_filters {
+	struct list_head list;
+	struct rcu_head rcu;
+	struct prov_pattern filter;
+	unsigned int base;              // First of the partial match states of the pattern.
+	atomic64_t matches;
+};
+
+/* Read by the matcher under RCU; updated, and read from securityfs, under pattern_lock. */
+extern struct list_head pattern_filters;
+extern struct mutex pattern_lock;
+
+int prov_pattern_add_or_update(struct pattern_filters *f);
+void prov_pattern_delete(struct pattern_filters *f);
+#endif
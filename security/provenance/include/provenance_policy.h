@@ -13,6 +13,9 @@
 #ifndef _PROVENANCE_POLICY_H
 #define _PROVENANCE_POLICY_H
 
+#define PROV_SAMPLING_SUBTYPES          48                              // Number of subtype bits in a relation type.
+#define PROV_SAMPLING_SIZE              (4 * PROV_SAMPLING_SUBTYPES)    // One slot per "derived", "generated", "used" and "informed" subtype.
+
 /*!
  * @brief provenance capture policy defined by the user.
  *
@@ -24,6 +27,9 @@ struct capture_policy {
 	bool should_compress_node;                      // Whether nodes should be compressed into one if possible.
 	bool should_compress_edge;                      // Whether edges should be compressed into one if possible. (e.g., multiple same edge between two nodes.)
 	bool should_duplicate;                          // For SPADE: every time a relation is recorded the two end nodes will be recorded again if set to true.
+	bool should_skip_lookup;                        // Whether search permission checks on directories during path lookup should not be recorded.
+	bool should_lazy_thread;                        // Whether thread nodes should only be created when a thread is first involved in a flow.
+	bool should_reduce;                             // Whether edges (and the version updates they cause) that do not change dependencies between nodes should be dropped.
 	uint64_t prov_node_filter;                      // Node to be filtered out (i.e., not recorded).
 	uint64_t prov_propagate_node_filter;            // Node to be filtered out if it is part of propagate.
 	uint64_t prov_derived_filter;                   // Edge of category "derived" to be filtered out.
@@ -34,6 +40,10 @@ struct capture_policy {
 	uint64_t prov_propagate_generated_filter;       // Edge of category "generated" to be filtered out if it is part of propagate.
 	uint64_t prov_propagate_used_filter;            // Edge of category "used" to be filtered out if it is part of propagate.
 	uint64_t prov_propagate_informed_filter;        // Edge of category "informed" to be filtered out if it is part of propagate.
+	uint32_t prov_sampling[PROV_SAMPLING_SIZE];     // Edge of a given type is recorded 1 in N times (0 or 1 means every edge is recorded).
+	uint32_t prov_rate;                             // Number of flows per second a process can record before they are aggregated (0 means no limit).
+	uint32_t prov_burst;                            // Number of flows a process can record in a burst.
+	uint32_t prov_usage_interval;                   // Milliseconds between two resource usage samples of tracked processes (0 means no sampling).
 };
 
 extern struct capture_policy prov_policy;
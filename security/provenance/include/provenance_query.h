@@ -15,6 +15,26 @@
 
 #include <linux/provenance_query.h>
 
+/* Long nodes are allocated with their query module state right after them. */
+#define long_prov_query_state(prov)     ((uint8_t *)(prov) + sizeof(union long_prov_elt))
+
+/*!
+ * @brief Return the state of query module @fcn for @node, or NULL if the module has no state or the node no state area.
+ *
+ * The state area of a node is pointed to by its "var_ptr", so copies of a node (e.g., its previous version) share it.
+ * Long nodes are never copied, their state area follows them (see "alloc_long_provenance").
+ */
+static __always_inline void *query_state(prov_entry_t *node, const struct provenance_query_hooks *fcn)
+{
+	if (!fcn->state_size)
+		return NULL;
+	if (provenance_is_long(node))
+		return long_prov_query_state(node) + fcn->state_offset;
+	if (!node->node_info.var_ptr)
+		return NULL;
+	return (uint8_t *)node->node_info.var_ptr + fcn->state_offset;
+}
+
 static inline int call_provenance_flow(prov_entry_t *from,
 				       prov_entry_t *edge,
 				       prov_entry_t *to)
@@ -26,7 +46,7 @@ static inline int call_provenance_flow(prov_entry_t *from,
 	list_for_each_safe(listentry, listtmp, &provenance_query_hooks) {
 		fcn = list_entry(listentry, struct provenance_query_hooks, list);
 		if (fcn->flow)
-			rc |= fcn->flow(from, edge, to);
+			rc |= fcn->flow(from, query_state(from, fcn), edge, to, query_state(to, fcn));
 	}
 	return rc;
 }
@@ -40,7 +60,7 @@ static inline int call_provenance_alloc(prov_entry_t *elt)
 	list_for_each_safe(listentry, listtmp, &provenance_query_hooks) {
 		fcn = list_entry(listentry, struct provenance_query_hooks, list);
 		if (fcn->alloc)
-			rc |= fcn->alloc(elt);
+			rc |= fcn->alloc(elt, query_state(elt, fcn));
 	}
 	return rc;
 }
@@ -54,7 +74,7 @@ static inline int call_provenance_free(prov_entry_t *elt)
 	list_for_each_safe(listentry, listtmp, &provenance_query_hooks) {
 		fcn = list_entry(listentry, struct provenance_query_hooks, list);
 		if (fcn->free)
-			rc |= fcn->free(elt);
+			rc |= fcn->free(elt, query_state(elt, fcn));
 	}
 	return rc;
 }
@@ -13,6 +13,8 @@
 #ifndef _PROVENANCE_RECORD_H
 #define _PROVENANCE_RECORD_H
 
+#include <linux/cred.h>
+
 #include "provenance.h"
 #include "provenance_relay.h"
 
@@ -63,9 +65,184 @@ static __always_inline int __update_version(const uint64_t type,
 	return rc;
 }
 
+#define PROV_THREADS_FLUSH      64      // Threads of a process never involved in a flow after which a summary is recorded.
+
+/*!
+ * @brief This function records a summary node, attached to a process by a relation of type @type.
+ *
+ * The summary is a transient ENT_STR node describing @count events of the process,
+ * @count is also carried in the flags of the relation.
+ * As for a name, the summary describes the process and therefore does not update its version.
+ * @param type RL_AGGREGATE or RL_AGGREGATE_THREADS.
+ * @param cprov The provenance node of the process.
+ * @param count The number of events summarized.
+ * @param what What the events are.
+ * @return 0 if no error occurred. -ENOMEM if no memory can be allocated for the summary node. Other error codes unknown.
+ *
+ */
+static inline int __record_summary(const uint64_t type, struct provenance *cprov, uint32_t count, const char *what)
+{
+	union long_prov_elt *str;
+	int rc;
+
+	str = alloc_long_provenance(ENT_STR);
+	if (!str)
+		return -ENOMEM;
+	str->str_info.length = snprintf(str->str_info.str, PATH_MAX, "%u %s", count, what);
+	rc = __write_relation(type, str, prov_entry(cprov), NULL, count);
+	free_long_provenance(str);
+	return rc;
+}
+
+/*!
+ * @brief This function records a summary of the flows of a process that were aggregated by rate limiting (RL_AGGREGATE).
+ *
+ * The caller holds the lock of @cprov, or is the last user of it.
+ * @param cprov The provenance node of the process.
+ * @return 0 if no error occurred. Other error codes inherited from "__record_summary".
+ *
+ */
+static inline int record_aggregate(struct provenance *cprov)
+{
+	uint32_t aggregated = atomic_xchg(&cprov->aggregated, 0);
+
+	if (!aggregated)
+		return 0;
+	return __record_summary(RL_AGGREGATE, cprov, aggregated, "flows aggregated");
+}
+
+/*!
+ * @brief This function records a summary of the threads of a process that were never involved in a flow (RL_AGGREGATE_THREADS).
+ *
+ * Such threads never get a node (see "provenance_task_free"); they are only counted,
+ * and summarized every PROV_THREADS_FLUSH threads and when the process is freed, independently of rate limiting.
+ * The caller holds the lock of @cprov, or is the last user of it.
+ * @param cprov The provenance node of the process.
+ * @return 0 if no error occurred. Other error codes inherited from "__record_summary".
+ *
+ */
+static inline int record_thread_summary(struct provenance *cprov)
+{
+	uint32_t threads = atomic_xchg(&cprov->threads, 0);
+
+	if (!threads)
+		return 0;
+	return __record_summary(RL_AGGREGATE_THREADS, cprov, threads, "threads never involved in a flow");
+}
+
+/*!
+ * @brief This function charges a flow to the budget of the current process.
+ *
+ * Each process (i.e., cred provenance node) has a token bucket refilled at "prov_rate" flows per second,
+ * holding at most "prov_burst" flows (or "prov_rate" if no burst is set).
+ * A flow is all the relations recorded by one call to "uses", "generates", "derives", "informs" and the like:
+ * it is charged once, and either recorded whole or dropped whole, so that no partial path reaches the graph.
+ * When the bucket is empty, the flow is counted as aggregated instead of being recorded.
+ * Once the bucket is refilled, a summary of the aggregated flows is recorded by the next hook of the process,
+ * under the lock of the process (see "get_cred_provenance").
+ * Callers may already hold the lock of the process, so the bucket is updated with atomic operations:
+ * only the thread moving the refill time forward refills it, and a token is only taken if one is left.
+ * Flows recorded outside of a process context (e.g., packets) are never limited, nor are names and versions, which are not flows.
+ * @return true if the flow should be aggregated (i.e., not recorded) or false if otherwise.
+ *
+ */
+static __always_inline bool filter_rate_limited_flow(void)
+{
+	struct provenance *cprov;
+	uint32_t rate = READ_ONCE(prov_policy.prov_rate);
+	uint32_t burst;
+	unsigned long last;
+	unsigned long now;
+	uint64_t refill;
+	int budget;
+
+	if (likely(rate == 0))
+		return false;
+	if (!in_task())
+		return false;
+	cprov = current_provenance();
+	if (!cprov)
+		return false;
+
+	burst = READ_ONCE(prov_policy.prov_burst);
+	if (!burst)
+		burst = rate;
+	now = jiffies;
+	last = READ_ONCE(cprov->budget_jiffies);
+	refill = ((uint64_t)(now - last) * rate) / HZ;
+	if (refill > 0 && cmpxchg(&cprov->budget_jiffies, last, now) == last) {
+		do {
+			budget = atomic_read(&cprov->budget);
+		} while (atomic_cmpxchg(&cprov->budget, budget,
+					min_t(uint64_t, burst, budget + refill)) != budget);
+	}
+	if (atomic_add_unless(&cprov->budget, -1, 0))
+		return false;
+	atomic_inc(&cprov->aggregated);
+	return true;
+}
+
+/*!
+ * @brief This function decides whether a relation would not change the dependencies between nodes.
+ *
+ * A node remembers the identifier and version of the source of the last relation it received.
+ * If the same version of the same source flows again into the node, the current version of the node already depends on it:
+ * either directly, or through the version relations recorded since (a new version is derived from the previous one).
+ * The relation is therefore redundant for ancestry and descendant queries, and the version update it would cause is unnecessary.
+ * As soon as the source receives new information, its version changes and the relation is no longer redundant.
+ * Relations are never considered redundant if one of the nodes has not been recorded in the current epoch.
+ * @param from The pointer to the source provenance node
+ * @param to The pointer to the destination provenance node
+ * @return true if the relation is redundant or false if otherwise.
+ *
+ */
+static __always_inline bool is_redundant_relation(prov_entry_t *from, prov_entry_t *to)
+{
+	if (!provenance_is_recorded(from) || !provenance_is_recorded(to))
+		return false;
+	return node_previous_id(to) == node_identifier(from).id
+	       && node_previous_version(to) == node_identifier(from).version;
+}
+
+/*!
+ * @brief Give the lazily initialized node of the current thread (see "init_lazy_provenance") its identifier, and record its creation.
+ *
+ * Called when a relation involving @node is about to be recorded,
+ * so that a thread never involved in a recorded flow never gets a node (see "provenance_task_alloc").
+ * The thread that created the current one is not known any more,
+ * its creation is recorded as RL_PROC_READ from its process.
+ * The caller holds the lock of the process provenance, as every hook recording a flow of the current thread does.
+ * Only the current thread records flows involving its own node, so the identifier is set without further synchronization.
+ * @param node The provenance node about to be recorded.
+ * @return 0 if no error occurred. Other error codes unknown.
+ *
+ */
+static __always_inline int materialize_task_provenance(prov_entry_t *node)
+{
+	struct provenance *cprov;
+
+	if (likely(prov_type(node) != ACT_TASK || node_identifier(node).id != 0))
+		return 0;
+	node_identifier(node).id = prov_next_node_id();
+	call_provenance_alloc(node);
+	cprov = current_provenance();
+	if (!cprov)
+		return 0;
+	node_previous_id(node) = node_identifier(prov_elt(cprov)).id;
+	node_previous_type(node) = RL_PROC_READ;
+	node_previous_version(node) = node_identifier(prov_elt(cprov)).version;
+	set_has_outgoing(prov_entry(cprov));
+	return __write_relation(RL_PROC_READ, prov_entry(cprov), node, NULL, CLONE_THREAD);
+}
+
 /*!
  * @brief This function records a provenance relation (i.e., edge) between two provenance nodes unless certain criteria are met.
  *
+ * Relations of a sampled type are dropped first, before any version is updated (see "filter_sampled_relation").
+ * Rate limiting applies to whole flows, before their first relation is recorded (see "filter_rate_limited_flow").
+ * A thread node not created yet is created before the relation is considered further (see "materialize_task_provenance").
+ * If the user chose to reduce the graph, relations that are filtered out or redundant (see "is_redundant_relation") are dropped,
+ * before they cause the version of the destination node to be updated.
  * Unless edges are to be compressed and certain criteria are met,
  * this function would attempt to update the version of the destination node,
  * and create a relation between the source node and the newer version (if version is updated) of the destination node.
@@ -95,15 +272,31 @@ static __always_inline int record_relation(const uint64_t type,
 
 	BUILD_BUG_ON(!prov_type_is_relation(type));
 
+	if (filter_sampled_relation(type))
+		return 0;
+
+	rc = materialize_task_provenance(from);
+	if (rc < 0)
+		return rc;
+	rc = materialize_task_provenance(to);
+	if (rc < 0)
+		return rc;
+
+	if (prov_policy.should_reduce) {
+		if (!should_record_relation(type, from, to))
+			return 0;
+		if (is_redundant_relation(from, to))
+			return 0;
+	}
+
 	if (prov_policy.should_compress_edge) {
 		if (node_previous_id(to) == node_identifier(from).id
 		    && node_previous_type(to) == type)
 			return 0;
-		else {
-			node_previous_id(to) = node_identifier(from).id;
-			node_previous_type(to) = type;
-		}
 	}
+	node_previous_id(to) = node_identifier(from).id;
+	node_previous_type(to) = type;
+	node_previous_version(to) = node_identifier(from).version;
 
 	rc = __update_version(type, to);
 	if (rc < 0)
@@ -146,6 +339,30 @@ static __always_inline int record_terminate(uint64_t type, struct provenance *pr
 	return rc;
 }
 
+/*!
+ * @brief Record the naming relation between the name node @fname_prov (ENT_PATH) and @node.
+ *
+ * The name node is written out unless it has already been recorded in this epoch,
+ * so a name node kept across calls (see provenance_name.h) is emitted once and referenced by identifier after that.
+ */
+static __always_inline int __record_node_name(struct provenance *node,
+					      union long_prov_elt *fname_prov)
+{
+	int rc;
+
+	// Here we record the relation.
+	spin_lock(prov_lock(node));
+	if (prov_type(prov_elt(node)) == ACT_TASK) {
+		rc = record_relation(RL_NAMED_PROCESS, fname_prov, prov_entry(node), NULL, 0);
+		set_name_recorded(prov_elt(node));
+	} else {
+		rc = record_relation(RL_NAMED, fname_prov, prov_entry(node), NULL, 0);
+		set_name_recorded(prov_elt(node));
+	}
+	spin_unlock(prov_lock(node));
+	return rc;
+}
+
 /*!
  * @brief This function records the name of a provenance node. The name itself is a provenance node so there exists a new relation between the name and the node.
  *
@@ -184,16 +401,7 @@ static inline int record_node_name(struct provenance *node,
 	strlcpy(fname_prov->file_name_info.name, name, PATH_MAX);
 	fname_prov->file_name_info.length = strnlen(fname_prov->file_name_info.name, PATH_MAX);
 
-	// Here we record the relation.
-	spin_lock(prov_lock(node));
-	if (prov_type(prov_elt(node)) == ACT_TASK) {
-		rc = record_relation(RL_NAMED_PROCESS, fname_prov, prov_entry(node), NULL, 0);
-		set_name_recorded(prov_elt(node));
-	} else {
-		rc = record_relation(RL_NAMED, fname_prov, prov_entry(node), NULL, 0);
-		set_name_recorded(prov_elt(node));
-	}
-	spin_unlock(prov_lock(node));
+	rc = __record_node_name(node, fname_prov);
 	free_long_provenance(fname_prov);
 	return rc;
 }
@@ -260,6 +468,8 @@ static __always_inline int uses(const uint64_t type,
 		return 0;
 	if (!should_record_relation(type, prov_entry(entity), prov_entry(activity)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 
 	rc = record_relation(type, prov_entry(entity), prov_entry(activity), file, flags);
 	if (rc < 0)
@@ -309,6 +519,8 @@ static __always_inline int uses_two(const uint64_t type,
 		return 0;
 	if (!should_record_relation(type, prov_entry(entity), prov_entry(activity)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 	rc = record_relation(type, prov_entry(entity), prov_entry(activity), file, flags);
 	if (rc < 0)
 		return rc;
@@ -369,6 +581,8 @@ static __always_inline int generates(const uint64_t type,
 
 	if (!should_record_relation(type, prov_entry(activity), prov_entry(entity)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 
 	rc = current_update_shst(activity_mem, true);
 	if (rc < 0)
@@ -420,6 +634,8 @@ static __always_inline int derives(const uint64_t type,
 		return 0;
 	if (!should_record_relation(type, prov_entry(from), prov_entry(to)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 
 	return record_relation(type, prov_entry(from), prov_entry(to), file, flags);
 }
@@ -463,6 +679,8 @@ static __always_inline int informs(const uint64_t type,
 		return 0;
 	if (!should_record_relation(type, prov_entry(from), prov_entry(to)))
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 	rc = record_kernel_link(prov_entry(from));
 	if (rc < 0)
 		return rc;
@@ -491,6 +709,8 @@ static __always_inline int record_influences_kernel(const uint64_t type,
 	    && !provenance_is_tracked(prov_elt(activity))
 	    && !prov_policy.prov_all)
 		return 0;
+	if (filter_rate_limited_flow())
+		return 0;
 	rc = record_relation(RL_LOAD_FILE, prov_entry(entity), prov_entry(activity), file, 0);
 	if (rc < 0)
 		goto out;
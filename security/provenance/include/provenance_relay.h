@@ -16,13 +16,15 @@
 #include <linux/relay.h>
 #include <linux/spinlock.h>
 #include <linux/jiffies.h>
+#include <uapi/linux/provenance_compact.h>
 
 #include "provenance_filter.h"
 #include "provenance_query.h"
+#include "provenance_compress.h"
 
-#define PROV_RELAY_BUFF_EXP             20
+#define PROV_RELAY_BUFF_EXP             CONFIG_SECURITY_PROVENANCE_RELAY_SUBBUF_SHIFT
 #define PROV_RELAY_BUFF_SIZE            ((1 << PROV_RELAY_BUFF_EXP) * sizeof(uint8_t))
-#define PROV_NB_SUBBUF                  64
+#define PROV_NB_SUBBUF                  CONFIG_SECURITY_PROVENANCE_RELAY_NB_SUBBUF
 #define PROV_INITIAL_BUFF_SIZE          (1024 * 16)
 #define PROV_INITIAL_LONG_BUFF_SIZE     512
 
@@ -36,11 +38,14 @@ struct relay_list {
 	char *name;                     // The name of the relay channel.
 	struct rchan *prov;             // Relay buffer for regular provenance entries.
 	struct rchan *long_prov;        // Relay buffer for long provenance entries.
+	int format;                     // PROV_FORMAT_RAW, PROV_FORMAT_COMPACT, PROV_FORMAT_LZ4 or PROV_FORMAT_SIZED.
+	uint64_t filters[PROV_CHANNEL_NB_FILTER];       // Types not written to this channel, indexed by PROV_CHANNEL_*_FILTER.
 };
 
 extern struct list_head relay_list;
 
-int prov_create_channel(char *buffer, size_t len);
+int prov_create_channel(char *buffer, size_t len, int format);
+void prov_compact_write(struct rchan *chan, const void *msg, bool is_long);
 void write_boot_buffer(void);
 bool is_relay_full(struct rchan *chan, int cpu);
 
@@ -48,21 +53,56 @@ extern bool relay_ready;
 
 /*!
  * @brief Add an element to the tail end of the relay list, which is identified by the "extern struct list_head relay_list" above.
- * @param name Member of the element in the relay list
+ * @param name Member of the element in the relay list (a copy is kept, the caller may free it).
  * @param prov Member of the element in the relay list. This is a relay channel pointer.
  * @param long_prov Member of the element in the relay list. This is a relay channel pointer.
+ * @param format Wire format of both relay channels.
+ * @return 0 if no error occurred; -ENOMEM if the element or the copy of its name could not be allocated.
  *
- * @todo Failure case checking is missing.
  */
-static inline void prov_add_relay(char *name, struct rchan *prov, struct rchan *long_prov)
+static inline int prov_add_relay(char *name, struct rchan *prov, struct rchan *long_prov, int format)
 {
 	struct relay_list *list;
 
 	list = kzalloc(sizeof(struct relay_list), GFP_KERNEL);
-	list->name = name;
+	if (!list)
+		return -ENOMEM;
+	list->name = kstrdup(name, GFP_KERNEL);
+	if (!list->name) {
+		kfree(list);
+		return -ENOMEM;
+	}
 	list->prov = prov;
 	list->long_prov = long_prov;
+	list->format = format;
 	list_add_tail(&(list->list), &relay_list);
+	return 0;
+}
+
+/*!
+ * @brief This function decides whether or not a record should be kept out of a relay channel.
+ *
+ * Records that passed the global capture policy are checked once more against the filters of each channel,
+ * so that consumers only interested in part of the graph do not pay for the rest.
+ * Filters follow the semantics of the global node and relation filters.
+ * @param channel The relay channel.
+ * @param type The type of the record.
+ * @return true if the record should not be written to this channel.
+ *
+ */
+static __always_inline bool filter_channel(const struct relay_list *channel, const uint64_t type)
+{
+	if (prov_type_is_node(type))
+		return HIT_FILTER(channel->filters[PROV_CHANNEL_NODE_FILTER], type);
+	if (prov_is_derived(type))
+		return HIT_FILTER(channel->filters[PROV_CHANNEL_DERIVED_FILTER], type);
+	if (prov_is_generated(type))
+		return HIT_FILTER(channel->filters[PROV_CHANNEL_GENERATED_FILTER], type);
+	if (prov_is_used(type))
+		return HIT_FILTER(channel->filters[PROV_CHANNEL_USED_FILTER], type);
+	if (prov_is_informed(type))
+		return HIT_FILTER(channel->filters[PROV_CHANNEL_INFORMED_FILTER], type);
+	return false;
 }
 
 struct prov_boot_buffer {
@@ -112,9 +152,11 @@ extern struct prov_boot_buffer *boot_buffer;
  * However, in an unlikely event that the boot buffer is full, an error is thrown.
  * Otherwise (i.e., boot buffer is not full) provenance information is written to the next empty slot in the boot buffer.
  * If relay buffer is ready, write to relay buffer.
- * It will write to every relay buffer in the relay_list for every CamQuery query use.
+ * It will write to every relay buffer in the relay_list for every CamQuery query use, unless the channel filters it out.
  * This is because once provenance is read from a relay buffer, it will be consumed from the buffer.
  * We therefore need to write to multiple relay buffers if we want to consume/use same provenance data multiple times.
+ * The record carries the size of the structure of its type, sized channels only emit that many bytes.
+ * A node pointing to its query module state is emitted from a copy without the pointer, a kernel address.
  * @param msg Provenance information to be written to either boot buffer or relay buffer.
  * @return NULL
  *
@@ -122,14 +164,30 @@ extern struct prov_boot_buffer *boot_buffer;
 static __always_inline void prov_write(union prov_elt *msg, size_t size)
 {
 	struct relay_list *tmp;
+	union prov_elt copy;
 
 	prov_jiffies(msg) = get_jiffies_64();
+	msg->msg_info.record_size = prov_record_size(prov_type(msg));
+	if (prov_is_node(msg) && msg->node_info.var_ptr) {
+		memcpy(&copy, msg, sizeof(union prov_elt));
+		copy.node_info.var_ptr = NULL;
+		msg = &copy;
+	}
 	if (unlikely(!relay_ready))
 		insert_boot_buffer(msg, boot_buffer);
 	else {
 		prov_policy.prov_written = true;
 		list_for_each_entry(tmp, &relay_list, list) {
-			relay_write(tmp->prov, msg, size);
+			if (filter_channel(tmp, prov_type(msg)))
+				continue;
+			if (tmp->format == PROV_FORMAT_COMPACT)
+				prov_compact_write(tmp->prov, msg, false);
+			else if (tmp->format == PROV_FORMAT_LZ4)
+				prov_lz4_write(tmp->prov, msg, size);
+			else if (tmp->format == PROV_FORMAT_SIZED)
+				relay_write(tmp->prov, msg, msg->msg_info.record_size);
+			else
+				relay_write(tmp->prov, msg, size);
 		}
 	}
 }
@@ -142,6 +200,8 @@ extern struct prov_long_boot_buffer *long_boot_buffer;
  *
  * This function performs the same function as "prov_write" function except that it writes a long provenance information,
  * instead of regular provenance information to the buffer.
+ * Long nodes find their query module state by address and never carry a pointer to it, they are emitted as they are.
+ * Sized channels only emit record_size bytes, which is less than the whole record for hashed xattr nodes (see "prov_long_record_size").
  * @param msg Long provenance information to be written to either long boot buffer or long relay buffer.
  *
  */
@@ -150,18 +210,30 @@ static inline void long_prov_write(union long_prov_elt *msg, size_t size)
 	struct relay_list *tmp;
 
 	prov_jiffies(msg) = get_jiffies_64();
+	msg->msg_info.record_size = prov_long_record_size(msg);
 	if (unlikely(!relay_ready))
 		insert_long_boot_buffer(msg, long_boot_buffer);
 	else {
 		prov_policy.prov_written = true;
 		list_for_each_entry(tmp, &relay_list, list) {
-			relay_write(tmp->long_prov, msg, size);
+			if (filter_channel(tmp, prov_type(msg)))
+				continue;
+			if (tmp->format == PROV_FORMAT_COMPACT)
+				prov_compact_write(tmp->long_prov, msg, true);
+			else if (tmp->format == PROV_FORMAT_LZ4)
+				prov_lz4_write(tmp->long_prov, msg, size);
+			else if (tmp->format == PROV_FORMAT_SIZED)
+				relay_write(tmp->long_prov, msg, msg->msg_info.record_size);
+			else
+				relay_write(tmp->long_prov, msg, size);
 		}
 	}
 }
 
 /*!
  * @brief Flush every relay buffer element in the relay list.
+ *
+ * LZ4 channels first compress and emit their partially filled blocks.
  */
 static inline void prov_flush(void)
 {
@@ -171,6 +243,10 @@ static inline void prov_flush(void)
 		return;
 
 	list_for_each_entry(tmp, &relay_list, list) {
+		if (tmp->format == PROV_FORMAT_LZ4) {
+			prov_lz4_flush(tmp->prov);
+			prov_lz4_flush(tmp->long_prov);
+		}
 		relay_flush(tmp->prov);
 		relay_flush(tmp->long_prov);
 	}
@@ -231,6 +307,7 @@ static __always_inline void prepare_relation(const uint64_t type,
 		relation->relation_info.offset = file->f_pos;
 	}
 	relation->relation_info.flags = flags;
+	relation->relation_info.weight = relation_sampling_weight(type);
 	relation->msg_info.epoch = epoch;
 }
 
@@ -0,0 +1,178 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _PROVENANCE_SB_H
+#define _PROVENANCE_SB_H
+
+#include <linux/fs.h>
+
+struct sb_filters {
+	struct list_head list;
+	struct sbinfo filter;
+};
+
+extern struct list_head sb_filters;
+
+static inline bool __sb_filter_same(const struct sbinfo *a, const struct sbinfo *b)
+{
+	return strncmp(a->fstype, b->fstype, PROV_FSTYPE_LEN) == 0
+	       && (a->fstype[0] != '\0' || memcmp(a->uuid, b->uuid, 16) == 0);
+}
+
+/*!
+ * @brief Return the capture mode of a superblock, from the sb_filters list.
+ *
+ * A filter naming the superblock (i.e., the mount) by its UUID takes precedence over one naming its file system type.
+ * @param sb The superblock, its provenance UUID must be set.
+ * @return PROV_SET_IGNORE, PROV_SET_OPAQUE or 0
+ *
+ */
+static inline uint8_t prov_sb_whichOP(const struct super_block *sb)
+{
+	const uint8_t *uuid = prov_elt((struct provenance *)sb->s_provenance)->sb_info.uuid;
+	struct list_head *listentry, *listtmp;
+	struct sb_filters *tmp;
+	uint8_t op = 0;
+
+	list_for_each_safe(listentry, listtmp, &sb_filters) {
+		tmp = list_entry(listentry, struct sb_filters, list);
+		if (tmp->filter.fstype[0] == '\0') {
+			if (memcmp(tmp->filter.uuid, uuid, 16) == 0)
+				return tmp->filter.op;
+		} else if (strncmp(tmp->filter.fstype, sb->s_type->name, PROV_FSTYPE_LEN) == 0)
+			op = tmp->filter.op;
+	}
+	return op;
+}
+
+/*!
+ * @brief Remove a superblock filter with the same file system type, or the same UUID, from the sb_filters list.
+ * @param f The filter to remove, freed.
+ * @return 0 if no error occurred. Other error codes unknown.
+ *
+ */
+static inline uint8_t prov_sb_delete(struct sb_filters *f)
+{
+	struct list_head *listentry, *listtmp;
+	struct sb_filters *tmp;
+
+	list_for_each_safe(listentry, listtmp, &sb_filters) {
+		tmp = list_entry(listentry, struct sb_filters, list);
+		if (__sb_filter_same(&tmp->filter, &f->filter)) {
+			list_del(listentry);
+			kfree(tmp);
+			break;
+		}
+	}
+	kfree(f);
+	return 0;
+}
+
+/*!
+ * @brief Update the op value of the superblock filter with the same file system type or UUID, or add the filter.
+ * @param f The filter, owned by the list once added, freed otherwise.
+ * @return 0 if no error occurred. Other error codes unknown.
+ *
+ */
+static inline uint8_t prov_sb_add_or_update(struct sb_filters *f)
+{
+	struct list_head *listentry, *listtmp;
+	struct sb_filters *tmp;
+
+	list_for_each_safe(listentry, listtmp, &sb_filters) {
+		tmp = list_entry(listentry, struct sb_filters, list);
+		if (__sb_filter_same(&tmp->filter, &f->filter)) {
+			tmp->filter.op = f->filter.op;
+			kfree(f);
+			return 0;
+		}
+	}
+	list_add_tail(&(f->list), &sb_filters);
+	return 0;
+}
+
+/*!
+ * @brief Make the inodes of a superblock opaque, once the superblock is set to opaque.
+ *
+ * Inodes allocated later are made opaque on allocation (see "provenance_inode_alloc_security").
+ * No provenance lock is held here, so the lock of each inode can be taken.
+ * @param sb The superblock.
+ *
+ */
+static inline void prov_sb_set_opaque(struct super_block *sb)
+{
+	struct provenance *iprov;
+	struct inode *inode;
+	unsigned long irqflags;
+
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		iprov = inode->i_provenance;
+		if (!iprov || provenance_is_opaque(prov_elt(iprov)))
+			continue;
+		spin_lock_irqsave_nested(prov_lock(iprov), irqflags, PROVENANCE_LOCK_INODE);
+		set_opaque(prov_elt(iprov));
+		spin_unlock_irqrestore(prov_lock(iprov), irqflags);
+	}
+	spin_unlock(&sb->s_inode_list_lock);
+}
+
+/*!
+ * @brief Set the capture mode stored on the provenance of a superblock from the filters.
+ *
+ * Called once the superblock is mounted, and on every superblock when the filters change.
+ * The inodes of a superblock that becomes opaque are made opaque, and stay so until evicted.
+ * @param sb The superblock.
+ * @param unused Unused, for iterate_supers.
+ *
+ */
+static inline void prov_sb_apply(struct super_block *sb, void *unused)
+{
+	struct provenance *sprov = sb->s_provenance;
+	uint8_t capture;
+
+	if (!sprov)
+		return;
+	capture = prov_sb_whichOP(sb);
+	if ((capture & PROV_SET_OPAQUE) && !(READ_ONCE(prov_elt(sprov)->sb_info.capture) & PROV_SET_OPAQUE)) {
+		WRITE_ONCE(prov_elt(sprov)->sb_info.capture, capture);
+		prov_sb_set_opaque(sb);
+		return;
+	}
+	WRITE_ONCE(prov_elt(sprov)->sb_info.capture, capture);
+}
+
+/*!
+ * @brief Whether provenance hooks on @inode should return straight away, its superblock being ignored.
+ *
+ * Checked before any cred or task lookup and before taking any lock.
+ */
+static __always_inline bool provenance_inode_is_ignored(const struct inode *inode)
+{
+	const struct provenance *sprov = inode->i_sb->s_provenance;
+
+	return unlikely(sprov && (READ_ONCE(prov_elt(sprov)->sb_info.capture) & PROV_SET_IGNORE));
+}
+
+/*!
+ * @brief Whether the superblock of @inode is set to opaque; its inodes are then made opaque.
+ */
+static __always_inline bool provenance_inode_sb_is_opaque(const struct inode *inode)
+{
+	const struct provenance *sprov = inode->i_sb->s_provenance;
+
+	return unlikely(sprov && (READ_ONCE(prov_elt(sprov)->sb_info.capture) & PROV_SET_OPAQUE));
+}
+
+#define provenance_dentry_is_ignored(dentry)    (d_backing_inode(dentry) && provenance_inode_is_ignored(d_backing_inode(dentry)))
+#define provenance_file_is_ignored(file)        provenance_inode_is_ignored(file_inode(file))
+#endif
@@ -216,8 +216,6 @@ static inline int record_task_name(struct task_struct *task,
 	struct provenance *fprov;
 	struct mm_struct *mm;
 	struct file *exe_file;
-	char *buffer;
-	char *ptr;
 	int rc = 0;
 
 	if (provenance_is_name_recorded(prov_elt(prov)) ||
@@ -235,17 +233,8 @@ static inline int record_task_name(struct task_struct *task,
 			goto out;
 		}
 
-		buffer = kcalloc(PATH_MAX, sizeof(char), GFP_ATOMIC);   // Memory allocation not allowed to sleep.
-		if (!buffer) {
-			pr_err("Provenance: could not allocate memory\n");
-			fput(exe_file); // Release the file.
-			rc = -ENOMEM;
-			goto out;
-		}
-		ptr = file_path(exe_file, buffer, PATH_MAX);
+		rc = record_dentry_name(prov, exe_file->f_path.dentry, exe_file->f_path.mnt, false);
 		fput(exe_file); // Release the file.
-		rc = record_node_name(prov, ptr, false);
-		kfree(buffer);
 	}
 out:
 	// put_cred(cred);
@@ -253,45 +242,43 @@ out:
 }
 
 /*!
- * @brief Update @prov with process performance information associated with @task.
+ * @brief Refresh the resource usage of the process node @prov from the counters of current.
  *
- * @param task The task whose performance information to be obtained.
- * @param prov The provenance entry to be updated.
+ * Used when periodic sampling is off (see usage.c), so that versions of the process node still carry usage.
+ * Only the counters of the calling thread are read, without adjusting CPU time or taking references:
+ * the mm of current cannot go away under it.
+ * @param prov The cred provenance entry of current, locked.
  *
  */
-static inline void update_proc_perf(struct task_struct *task,
-				    struct provenance *prov)
+static inline void refresh_proc_usage(struct provenance *prov)
 {
-	struct mm_struct *mm;
+	struct mm_struct *mm = current->mm;
 	uint64_t utime;
 	uint64_t stime;
 
 	// time
-	task_cputime_adjusted(task, &utime, &stime);
+	task_cputime(current, &utime, &stime);
 	prov_elt(prov)->proc_info.utime = div_u64(utime, NSEC_PER_USEC);
 	prov_elt(prov)->proc_info.stime = div_u64(stime, NSEC_PER_USEC);
 
 	// memory
-	mm = get_task_mm(task);
 	if (mm) {
 		// KB
-		prov_elt(prov)->proc_info.vm =  mm->total_vm  * PAGE_SIZE / KB;
+		prov_elt(prov)->proc_info.vm = mm->total_vm * PAGE_SIZE / KB;
 		prov_elt(prov)->proc_info.rss = get_mm_rss(mm) * PAGE_SIZE / KB;
 		prov_elt(prov)->proc_info.hw_vm = get_mm_hiwater_vm(mm) * PAGE_SIZE / KB;
 		prov_elt(prov)->proc_info.hw_rss = get_mm_hiwater_rss(mm) * PAGE_SIZE / KB;
-		mmput_async(mm);
 	}
 	// IO
 #ifdef CONFIG_TASK_IO_ACCOUNTING
 	// KB
-	prov_elt(prov)->proc_info.rbytes = task->ioac.read_bytes & KB_MASK;
-	prov_elt(prov)->proc_info.wbytes = task->ioac.write_bytes & KB_MASK;
-	prov_elt(prov)->proc_info.cancel_wbytes =
-		task->ioac.cancelled_write_bytes & KB_MASK;
+	prov_elt(prov)->proc_info.rbytes = current->ioac.read_bytes & KB_MASK;
+	prov_elt(prov)->proc_info.wbytes = current->ioac.write_bytes & KB_MASK;
+	prov_elt(prov)->proc_info.cancel_wbytes = current->ioac.cancelled_write_bytes & KB_MASK;
 #else
 	// KB
-	prov_elt(prov)->proc_info.rbytes = task->ioac.rchar & KB_MASK;
-	prov_elt(prov)->proc_info.wbytes = task->ioac.wchar & KB_MASK;
+	prov_elt(prov)->proc_info.rbytes = current->ioac.rchar & KB_MASK;
+	prov_elt(prov)->proc_info.wbytes = current->ioac.wchar & KB_MASK;
 	prov_elt(prov)->proc_info.cancel_wbytes = 0;
 #endif
 }
@@ -301,7 +288,11 @@ static inline void update_proc_perf(struct task_struct *task,
  *
  * This function records the name of the current process and associates it with the cred provenance entry,
  * unless the provenance is set to be opqaue, in which case no update is performed.
- * The cred provenance entry is also updated with UID, GID, namespaces, secid, and perform information.
+ * The cred provenance entry is also updated with UID, GID, namespaces and secid.
+ * Resource usage is sampled periodically (see usage.c); when sampling is off, it is refreshed here
+ * from the counters of current, only when the version of the node has not been recorded yet.
+ * Flows aggregated by rate limiting are summarized here once the budget of the process is refilled (see "filter_rate_limited_flow"),
+ * as the lock of the process is held.
  * @return The pointer to the cred provenance entry.
  *
  */
@@ -324,7 +315,10 @@ static inline struct provenance *get_cred_provenance(void)
 	prov_elt(prov)->proc_info.uid = __kuid_val(current_uid());
 	prov_elt(prov)->proc_info.gid = __kgid_val(current_gid());
 	security_task_getsecid(current, &(prov_elt(prov)->proc_info.secid));
-	update_proc_perf(current, prov);
+	if (!READ_ONCE(prov_policy.prov_usage_interval) && !provenance_is_recorded(prov_elt(prov)))
+		refresh_proc_usage(prov);
+	if (unlikely(atomic_read(&prov->aggregated)) && atomic_read(&prov->budget))
+		record_aggregate(prov);
 	spin_unlock_irqrestore(prov_lock(prov), irqflags);
 	return prov;
 }
@@ -580,6 +574,8 @@ static inline int record_args(struct provenance *prov,
 
 	if (!provenance_is_tracked(prov_elt(prov)) && !prov_policy.prov_all)
 		return 0;
+	if (filter_rate_limited_flow())         // The arguments are one flow.
+		return 0;
 	len = bprm->exec - bprm->p;
 	argv = kzalloc(len, GFP_KERNEL);
 	if (!argv)
@@ -0,0 +1,100 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#ifndef _PROVENANCE_XATTR_H
+#define _PROVENANCE_XATTR_H
+
+#include <linux/string.h>
+
+struct xattr_filters {
+	struct list_head list;
+	struct xattrinfo filter;
+};
+
+extern struct list_head xattr_filters;
+
+/*!
+ * @brief Return the op value of the xattr filter that best matches the xattr @name.
+ *
+ * A filter matches if its name is @name, if its name ends with '.' and prefixes @name (e.g., "security."),
+ * or if its name is empty. The longest matching filter wins.
+ * @param name The name of the xattr.
+ * @return op value or 0
+ *
+ */
+static inline uint8_t prov_xattr_whichOP(const char *name)
+{
+	struct list_head *listentry, *listtmp;
+	struct xattr_filters *tmp;
+	size_t len, best = 0;
+	uint8_t op = 0;
+
+	list_for_each_safe(listentry, listtmp, &xattr_filters) {
+		tmp = list_entry(listentry, struct xattr_filters, list);
+		len = strnlen(tmp->filter.name, PROV_XATTR_NAME_SIZE);
+		if (len > 0 && tmp->filter.name[len - 1] != '.') {
+			if (strcmp(tmp->filter.name, name) == 0)
+				return tmp->filter.op;
+		} else if (len >= best && strncmp(tmp->filter.name, name, len) == 0) {
+			best = len;
+			op = tmp->filter.op;
+		}
+	}
+	return op;
+}
+
+/*!
+ * @brief Remove the xattr filter with the same name from the xattr_filters list.
+ * @param f The filter to remove, freed.
+ * @return 0 if no error occurred. Other error codes unknown.
+ *
+ */
+static inline uint8_t prov_xattr_delete(struct xattr_filters *f)
+{
+	struct list_head *listentry, *listtmp;
+	struct xattr_filters *tmp;
+
+	list_for_each_safe(listentry, listtmp, &xattr_filters) {
+		tmp = list_entry(listentry, struct xattr_filters, list);
+		if (strcmp(tmp->filter.name, f->filter.name) == 0) {
+			list_del(listentry);
+			kfree(tmp);
+			break;
+		}
+	}
+	kfree(f);
+	return 0;
+}
+
+/*!
+ * @brief Update the op value of the xattr filter with the same name, or add the filter to the xattr_filters list.
+ * @param f The filter, owned by the list once added, freed otherwise.
+ * @return 0 if no error occurred. Other error codes unknown.
+ *
+ */
+static inline uint8_t prov_xattr_add_or_update(struct xattr_filters *f)
+{
+	struct list_head *listentry, *listtmp;
+	struct xattr_filters *tmp;
+
+	list_for_each_safe(listentry, listtmp, &xattr_filters) {
+		tmp = list_entry(listentry, struct xattr_filters, list);
+		if (strcmp(tmp->filter.name, f->filter.name) == 0) {
+			tmp->filter.op = f->filter.op;
+			kfree(f);
+			return 0;
+		}
+	}
+	list_add_tail(&(f->list), &xattr_filters);
+	return 0;
+}
+#endif
@@ -51,6 +51,7 @@ static unsigned int provenance_ipv4_out(void *priv,
 		if (provenance_records_packet(prov_elt(iprov)))
 			record_packet_content(skb, &pckprov);
 
+		prov_attach_query_state(&pckprov);
 		spin_lock_irqsave(prov_lock(iprov), irqflags);
 		call_provenance_alloc((prov_entry_t *)&pckprov);
 		derives(RL_SND_PACKET, iprov, &pckprov, NULL, 0);
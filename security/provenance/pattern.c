@@ -0,0 +1,232 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Incremental matching of path patterns (struct prov_pattern) over flows.
+ *
+ * A pattern of n steps is an automaton of n states: state i is reached at a node
+ * when a path from a node matching step 0 to that node matches steps 0 to i.
+ * State 0 is evaluated on the source of each flow, the last state is a complete match,
+ * and states 1 to n - 2 are kept in the query state of the node, one bit each.
+ * The bits of all the patterns fit in one word, which bounds the matching work and memory per node.
+ */
+#include <linux/bitops.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+
+#include "provenance.h"
+#include "provenance_pattern.h"
+#include "provenance_query.h"
+
+struct pattern_state {
+	uint32_t generation;    // Patterns the states were reached with, states of older patterns are void.
+	uint64_t reached;       // States reached at the node, bit "base + i - 1" for state i of a pattern.
+};
+
+static atomic_t pattern_generation = ATOMIC_INIT(1);
+static uint64_t pattern_states_used;    // Under pattern_lock.
+
+static __always_inline bool node_match(const struct prov_pattern_step *step, prov_entry_t *node)
+{
+	if (step->node && !prov_is_type(node_type(node), step->node))
+		return false;
+	if ((step->match & PROV_MATCH_UID) && node_uid(node) != step->uid)
+		return false;
+	if ((step->match & PROV_MATCH_GID) && node_gid(node) != step->gid)
+		return false;
+	if ((step->match & PROV_MATCH_TAINT) && !prov_bloom_in(prov_taint(node), step->taint))
+		return false;
+	if ((step->match & PROV_MATCH_TRACKED) && !provenance_is_tracked(node))
+		return false;
+	return true;
+}
+
+static __always_inline bool relation_match(const struct prov_pattern_step *step, prov_entry_t *edge)
+{
+	return !step->relation || prov_is_type(prov_type(edge), step->relation);
+}
+
+/*!
+ * @brief Advance the patterns over the flow @from -> @edge -> @to.
+ *
+ * Every state reached at @from (state 0 if @from matches the first step) is extended by @edge and @to:
+ * the next state is set at @to or, if it is the last, the action of the pattern is returned.
+ * States are only ever added to a node; its older versions share them.
+ *
+ */
+static int flow(prov_entry_t *from, void *from_state, prov_entry_t *edge, prov_entry_t *to, void *to_state)
+{
+	struct pattern_state *fstate = from_state;
+	struct pattern_state *tstate = to_state;
+	uint32_t generation = atomic_read(&pattern_generation);
+	const struct prov_pattern *pattern;
+	struct pattern_filters *p;
+	uint64_t reached;
+	unsigned int i;
+	int rc = 0;
+
+	if (list_empty(&pattern_filters) || !fstate || !tstate)
+		return 0;
+	reached = fstate->generation == generation ? fstate->reached : 0;
+	if (tstate->generation != generation) {
+		tstate->generation = generation;
+		tstate->reached = 0;
+	}
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(p, &pattern_filters, list) {
+		pattern = &p->filter;
+		for (i = 0; i + 1 < pattern->length; i++) {
+			if (i == 0) {
+				if (!node_match(&pattern->steps[0], from))
+					continue;
+			} else if (!(reached & BIT_ULL(p->base + i - 1)))
+				continue;
+			if (!relation_match(&pattern->steps[i + 1], edge)
+			    || !node_match(&pattern->steps[i + 1], to))
+				continue;
+			if (i + 2 < pattern->length) {
+				tstate->reached |= BIT_ULL(p->base + i);
+				continue;
+			}
+			atomic64_inc(&p->matches);
+			if (pattern->action & PROV_PATTERN_WARN)
+				rc |= PROVENANCE_RAISE_WARNING;
+			if (pattern->action & PROV_PATTERN_PREVENT)
+				rc |= PROVENANCE_PREVENT_FLOW;
+		}
+	}
+	rcu_read_unlock();
+	return rc;
+}
+
+/*!
+ * @brief Find @n free partial match states, and mark them used.
+ * @return The first of the states, or -ENOSPC if there is no room left.
+ */
+static int alloc_states(unsigned int n)
+{
+	uint64_t mask;
+	unsigned int base;
+
+	if (n == 0)
+		return 0;
+	for (base = 0; base + n <= PROV_PATTERN_STATES; base++) {
+		mask = GENMASK_ULL(base + n - 1, base);
+		if (!(pattern_states_used & mask)) {
+			pattern_states_used |= mask;
+			return base;
+		}
+	}
+	return -ENOSPC;
+}
+
+/* The partial match states of a pattern, none for a pattern of two steps. */
+static uint64_t states_mask(const struct pattern_filters *p)
+{
+	if (p->filter.length <= 2)
+		return 0;
+	return GENMASK_ULL(p->base + p->filter.length - 3, p->base);
+}
+
+static struct pattern_filters *find_pattern(uint32_t id)
+{
+	struct pattern_filters *tmp;
+
+	list_for_each_entry(tmp, &pattern_filters, list) {
+		if (tmp->filter.id == id)
+			return tmp;
+	}
+	return NULL;
+}
+
+/*!
+ * @brief Add a pattern to pattern_filters, or replace the pattern with the same id.
+ *
+ * Matching restarts from scratch: states reached with the previous patterns are void.
+ * @param f The pattern, owned by the list once added, freed otherwise.
+ * @return 0 if no error occurred; -EINVAL if the pattern is malformed; -ENOSPC if its states do not fit.
+ *
+ */
+int prov_pattern_add_or_update(struct pattern_filters *f)
+{
+	struct pattern_filters *old;
+	int base;
+
+	if (f->filter.length < 2 || f->filter.length > PROV_PATTERN_MAX_STEPS) {
+		kfree(f);
+		return -EINVAL;
+	}
+	f->filter.op = 0;
+	f->filter.matches = 0;
+	atomic64_set(&f->matches, 0);
+
+	mutex_lock(&pattern_lock);
+	old = find_pattern(f->filter.id);
+	if (old)
+		pattern_states_used &= ~states_mask(old);
+	base = alloc_states(f->filter.length - 2);
+	if (base < 0) {
+		if (old)
+			pattern_states_used |= states_mask(old);
+		mutex_unlock(&pattern_lock);
+		kfree(f);
+		return base;
+	}
+	f->base = base;
+	if (old) {
+		list_replace_rcu(&old->list, &f->list);
+		kfree_rcu(old, rcu);
+	} else
+		list_add_tail_rcu(&f->list, &pattern_filters);
+	atomic_inc(&pattern_generation);
+	mutex_unlock(&pattern_lock);
+	return 0;
+}
+
+/*!
+ * @brief Remove the pattern with the same id from pattern_filters.
+ * @param f The pattern to remove, freed.
+ *
+ */
+void prov_pattern_delete(struct pattern_filters *f)
+{
+	struct pattern_filters *old;
+
+	mutex_lock(&pattern_lock);
+	old = find_pattern(f->filter.id);
+	if (old) {
+		pattern_states_used &= ~states_mask(old);
+		list_del_rcu(&old->list);
+		kfree_rcu(old, rcu);
+		atomic_inc(&pattern_generation);
+	}
+	mutex_unlock(&pattern_lock);
+	kfree(f);
+}
+
+static struct provenance_query_hooks hooks = {
+	QUERY_HOOK_INIT(flow, flow),
+	.state_size = sizeof(struct pattern_state),
+};
+
+/*!
+ * Register the pattern matcher.
+ */
+static int __init init_prov_pattern(void)
+{
+	int rc = register_provenance_query_hooks(&hooks);
+
+	if (rc)
+		return rc;
+	pr_info("Provenance: pattern matcher ready.\n");
+	return 0;
+}
+early_initcall(init_prov_pattern);
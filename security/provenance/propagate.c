@@ -13,7 +13,7 @@
 #include "provenance.h"
 #include "provenance_query.h"
 
-static int flow(prov_entry_t *from, prov_entry_t *edge, prov_entry_t *to)
+static int flow(prov_entry_t *from, void *from_state, prov_entry_t *edge, prov_entry_t *to, void *to_state)
 {
 	if (provenance_does_propagate(from) && provenance_is_tracked(from))
 		// can propagate over edge?
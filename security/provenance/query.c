@@ -10,22 +10,44 @@
  * or (at your option) any later version.
  *
  */
+#include <linux/kernel.h>
 #include <linux/rculist.h>
+#include <linux/spinlock.h>
 #include <uapi/asm-generic/errno-base.h>
 
 #include "provenance_query.h"
 
+static DEFINE_SPINLOCK(query_state_lock);
+static size_t query_state_used;         // Bytes of the node state area given to query modules.
+
 /*!
  * @brief Register provenance query hooks.
  *
+ * If the hooks need per-node state, a share of the node state area (PROV_QUERY_STATE_SIZE bytes) is given to them.
+ * Shares are not given back on unregistration: state left in existing nodes by a module is never seen by another,
+ * and the state of a module is zero in nodes created before it registered.
  * @param hook The provenance_query_hooks pointer.
- * @return 0 if no error occurred; -ENOMEM if hook is NULL (does not exist yet).
+ * @return 0 if no error occurred; -ENOMEM if hook is NULL (does not exist yet); -ENOSPC if the node state area is full.
  *
  */
 int register_provenance_query_hooks(struct provenance_query_hooks *hook)
 {
+	size_t size;
+
 	if (!hook)
 		return -ENOMEM;
+	if (hook->state_size) {
+		size = ALIGN(hook->state_size, sizeof(uint64_t));
+		spin_lock(&query_state_lock);
+		if (query_state_used + size > PROV_QUERY_STATE_SIZE) {
+			spin_unlock(&query_state_lock);
+			pr_err("Provenance: no space left for query state (%zu bytes).\n", hook->state_size);
+			return -ENOSPC;
+		}
+		hook->state_offset = query_state_used;
+		query_state_used += size;
+		spin_unlock(&query_state_lock);
+	}
 	pr_info("Provenance: registering policy hook...\n");
 	list_add_tail_rcu(&(hook->list), &provenance_query_hooks);
 	return 0;
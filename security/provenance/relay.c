@@ -16,6 +16,8 @@
 #include <linux/async.h>
 #include <linux/delay.h>
 
+#include <uapi/linux/provenance_compact.h>
+
 #include "provenance.h"
 #include "provenance_relay.h"
 
@@ -68,12 +70,140 @@ static int remove_buf_file_handler(struct dentry *dentry)
 }
 
 
+/*!
+ * @brief Per-CPU encoding state of a channel using the compact wire format.
+ *
+ * It is the private data of the relay channel; raw channels have none.
+ */
+struct prov_compact_buf {
+	struct prov_compact_state state;
+	uint32_t sequence;                              // Sub-buffers started on this CPU.
+	uint8_t scratch[PROV_COMPACT_MAX_SIZE];         // Record being encoded.
+};
+
+/*!
+ * @brief Callback function of function "subbuf_start".
+ *
+ * Used by compact channels only. Behaves as the default callback (no overwrite when the buffer is full),
+ * then resets the encoder state and writes the sub-buffer header holding the boot and machine IDs,
+ * so that each sub-buffer can be decoded on its own.
+ */
+static int subbuf_start_handler(struct rchan_buf *buf,
+				void *subbuf,
+				void *prev_subbuf,
+				size_t prev_padding)
+{
+	struct prov_compact_buf __percpu *compact = buf->chan->private_data;
+	struct prov_compact_buf *cbuf;
+
+	if (relay_buf_full(buf))
+		return 0;
+	cbuf = per_cpu_ptr(compact, buf->cpu);
+	prov_compact_reset(&cbuf->state, prov_boot_id, prov_machine_id);
+	prov_compact_write_header(subbuf, &cbuf->state, cbuf->sequence++);
+	subbuf_start_reserve(buf, sizeof(struct prov_compact_header));
+	return 1;
+}
+
 /* Relay interface callback functions */
 static struct rchan_callbacks relay_callbacks = {
 	.create_buf_file = create_buf_file_handler,
 	.remove_buf_file = remove_buf_file_handler,
 };
 
+/* Relay interface callback functions of compact channels */
+static struct rchan_callbacks compact_relay_callbacks = {
+	.subbuf_start = subbuf_start_handler,
+	.create_buf_file = create_buf_file_handler,
+	.remove_buf_file = remove_buf_file_handler,
+};
+
+/*!
+ * @brief Write a record to a channel using the compact wire format.
+ *
+ * Mirrors relay_write: the record is encoded in the per-CPU scratch buffer,
+ * and if it does not fit in the current sub-buffer, we switch sub-buffers
+ * (which resets the encoder state) and encode it again.
+ * As with relay_write, the record is dropped if the buffer is full.
+ * @param chan The compact relay channel.
+ * @param msg The record.
+ * @param is_long Whether the record is a union long_prov_elt.
+ *
+ */
+void prov_compact_write(struct rchan *chan, const void *msg, bool is_long)
+{
+	struct prov_compact_buf __percpu *compact = chan->private_data;
+	struct prov_compact_buf *cbuf;
+	struct rchan_buf *buf;
+	unsigned long flags;
+	size_t len;
+
+	local_irq_save(flags);
+	buf = *this_cpu_ptr(chan->buf);
+	cbuf = this_cpu_ptr(compact);
+	len = prov_compact_encode(&cbuf->state, msg, is_long, cbuf->scratch);
+	if (unlikely(buf->offset + len > chan->subbuf_size)) {
+		if (!relay_switch_subbuf(buf, len))
+			goto out;
+		len = prov_compact_encode(&cbuf->state, msg, is_long, cbuf->scratch);
+	}
+	memcpy(buf->data + buf->offset, cbuf->scratch, len);
+	buf->offset += len;
+out:
+	local_irq_restore(flags);
+}
+
+/*!
+ * @brief Open a relay channel in the given format.
+ *
+ * The private data of the channel holds the per-CPU state of its format:
+ * struct prov_compact_buf for compact channels, struct prov_lz4_buf for LZ4 channels.
+ */
+static struct rchan *prov_open_channel(const char *name, int format)
+{
+	struct prov_compact_buf __percpu *compact;
+	struct prov_lz4_buf __percpu *lz4;
+	struct rchan *chan;
+
+	switch (format) {
+	case PROV_FORMAT_COMPACT:
+		compact = alloc_percpu(struct prov_compact_buf);
+		if (!compact)
+			return NULL;
+		chan = relay_open(name, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &compact_relay_callbacks, compact);
+		if (!chan)
+			free_percpu(compact);
+		return chan;
+	case PROV_FORMAT_LZ4:
+		lz4 = prov_lz4_alloc();
+		if (!lz4)
+			return NULL;
+		chan = relay_open(name, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &relay_callbacks, lz4);
+		if (!chan) {
+			prov_lz4_free(lz4);
+			return NULL;
+		}
+		prov_lz4_attach(lz4, chan);
+		return chan;
+	default:
+		return relay_open(name, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &relay_callbacks, NULL);
+	}
+}
+
+/*!
+ * @brief Close a relay channel opened by "prov_open_channel" and free the per-CPU state of its format.
+ */
+static void prov_close_channel(struct rchan *chan, int format)
+{
+	void __percpu *priv = chan->private_data;
+
+	relay_close(chan);
+	if (format == PROV_FORMAT_COMPACT)
+		free_percpu(priv);
+	else if (format == PROV_FORMAT_LZ4)
+		prov_lz4_free(priv);
+}
+
 static void __async_handle_boot_buffer(void *_buf, async_cookie_t cookie)
 {
 	int i;
@@ -189,10 +319,11 @@ void write_boot_buffer(void)
  * Each relay channel contains a relay buffer for regular provenance entries and a relay buffer for long provenance entries.
  * @param buffer Contains the name of the relay buffer for regular provenance entries (prepend "long_" for the relay buffer name for long provenance entries)
  * @param len The length of the name of the regular relay buffer.
- * @return 0 if no error occurred; -EFAULT if name already exists for relay buffer or opening new relay buffer failed; -ENOMEM if length of the name of the relay buffer is too long. Other error codes unknown.
+ * @param format PROV_FORMAT_RAW, PROV_FORMAT_COMPACT, PROV_FORMAT_LZ4 or PROV_FORMAT_SIZED (see include/uapi/linux/provenance_compact.h).
+ * @return 0 if no error occurred; -EFAULT if name already exists for relay buffer or opening new relay buffer failed; -ENOMEM if length of the name of the relay buffer is too long or the channel could not be added to the list. Other error codes unknown.
  *
  */
-int prov_create_channel(char *buffer, size_t len)
+int prov_create_channel(char *buffer, size_t len, int format)
 {
 	struct relay_list *tmp;
 	char *long_name = kzalloc(PATH_MAX, GFP_KERNEL);
@@ -211,17 +342,22 @@ int prov_create_channel(char *buffer, size_t len)
 	if (strlen(buffer) > len)
 		return -ENOMEM;
 	snprintf(long_name, PATH_MAX, "long_%s", buffer);
-	chan = relay_open(buffer, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &relay_callbacks, NULL);
+	chan = prov_open_channel(buffer, format);
 	if (!chan) {
 		rc = -EFAULT;
 		goto out;
 	}
-	long_chan = relay_open(long_name, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &relay_callbacks, NULL);
+	long_chan = prov_open_channel(long_name, format);
 	if (!long_chan) {
 		rc = -EFAULT;
-		goto out;
+		goto out_close;
 	}
-	prov_add_relay(buffer, chan, long_chan);
+	rc = prov_add_relay(buffer, chan, long_chan, format);
+	if (!rc)
+		goto out;
+	prov_close_channel(long_chan, format);
+out_close:
+	prov_close_channel(chan, format);
 out:
 	kfree(long_name);
 	return rc;
@@ -247,7 +383,8 @@ static int __init relay_prov_init(void)
 	long_prov_chan = relay_open(LONG_PROV_BASE_NAME, NULL, PROV_RELAY_BUFF_SIZE, PROV_NB_SUBBUF, &relay_callbacks, NULL);
 	if (!long_prov_chan)
 		panic("Provenance: relay_open failure\n");
-	prov_add_relay(PROV_BASE_NAME, prov_chan, long_prov_chan);
+	if (prov_add_relay(PROV_BASE_NAME, prov_chan, long_prov_chan, PROV_FORMAT_RAW))
+		panic("Provenance: relay list allocation failure\n");
 	relay_initialized = true;
 	write_boot_buffer();
 	pr_info("Provenance: relay ready.\n");
@@ -57,6 +57,8 @@ static const char RL_STR_NAMED_PROCESS[] = "named_process";
 static const char RL_STR_EXEC[] = "exec";                                                               // exec operation
 static const char RL_STR_EXEC_TASK[] = "exec_task";                                                     // exec operation
 static const char RL_STR_PCK_CNT[] = "packet_content";                                                  // connect netwrok packet to its content
+static const char RL_STR_AGGREGATE[] = "aggregate";                                                     // flows of a process aggregated by rate limiting
+static const char RL_STR_AGGREGATE_THREADS[] = "aggregate_threads";                                     // threads of a process never involved in a flow
 static const char RL_STR_CLONE[] = "clone";                                                             // clone operation
 static const char RL_STR_VERSION_TASK[] = "version_activity";                                           // connection two versions of an activity
 static const char RL_STR_SEARCH[] = "search";                                                           // search operation on directory
@@ -136,6 +138,7 @@ static const char ND_STR_PCKCNT[] = "packet_content";
 static const char ND_STR_ARG[] = "argv";                                        // argument passed to a process
 static const char ND_STR_ENV[] = "envp";                                        // environment parameter
 static const char ND_STR_PROC[] = "process_memory";                             // process memory
+static const char ND_STR_USAGE[] = "resource_usage";                            // periodic resource usage sample of a process
 
 #define MATCH_AND_RETURN(str1, str2, v)    if (strcmp(str1, str2) == 0) return v
 /* transform from relation ID to string representation */
@@ -222,6 +225,10 @@ const char *relation_str(uint64_t type)
 		return RL_STR_EXEC_TASK;
 	case RL_PCK_CNT:
 		return RL_STR_PCK_CNT;
+	case RL_AGGREGATE:
+		return RL_STR_AGGREGATE;
+	case RL_AGGREGATE_THREADS:
+		return RL_STR_AGGREGATE_THREADS;
 	case RL_CLONE:
 		return RL_STR_CLONE;
 	case RL_VERSION_TASK:
@@ -376,6 +383,8 @@ uint64_t relation_id(const char *str)
 	MATCH_AND_RETURN(str, RL_STR_EXEC, RL_EXEC);
 	MATCH_AND_RETURN(str, RL_STR_EXEC_TASK, RL_EXEC_TASK);
 	MATCH_AND_RETURN(str, RL_STR_PCK_CNT, RL_PCK_CNT);
+	MATCH_AND_RETURN(str, RL_STR_AGGREGATE, RL_AGGREGATE);
+	MATCH_AND_RETURN(str, RL_STR_AGGREGATE_THREADS, RL_AGGREGATE_THREADS);
 	MATCH_AND_RETURN(str, RL_STR_CLONE, RL_CLONE);
 	MATCH_AND_RETURN(str, RL_STR_VERSION_TASK, RL_VERSION_TASK);
 	MATCH_AND_RETURN(str, RL_STR_SEARCH, RL_SEARCH);
@@ -487,6 +496,8 @@ const char *node_str(uint64_t type)
 		return ND_STR_ENV;
 	case ENT_PROC:
 		return ND_STR_PROC;
+	case ENT_USAGE:
+		return ND_STR_USAGE;
 	default:
 		return ND_STR_UNKNOWN;
 	}
@@ -521,6 +532,7 @@ uint64_t node_id(const char *str)
 	MATCH_AND_RETURN(str, ND_STR_ARG, ENT_ARG);
 	MATCH_AND_RETURN(str, ND_STR_ENV, ENT_ENV);
 	MATCH_AND_RETURN(str, ND_STR_PROC, ENT_PROC);
+	MATCH_AND_RETURN(str, ND_STR_USAGE, ENT_USAGE);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(node_id);
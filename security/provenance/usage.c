@@ -0,0 +1,163 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ */
+#include <linux/workqueue.h>
+#include <linux/task_io_accounting_ops.h>
+
+#include "provenance.h"
+#include "provenance_relay.h"
+#include "provenance_task.h"
+#include "provenance_usage.h"
+
+static void prov_usage_sample(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(prov_usage_work, prov_usage_sample);
+
+/*!
+ * @brief Fill @usage with the resource usage of the process (i.e., thread group) of @task.
+ *
+ * CPU time and I/O are summed over the threads alive and the threads that exited, as in /proc/<pid>/stat and io.
+ * @param task A task of the process.
+ * @param usage The usage record to fill.
+ *
+ */
+static void update_proc_usage(struct task_struct *task, struct usage_struct *usage)
+{
+	struct task_io_accounting acct;
+	struct task_struct *t;
+	struct mm_struct *mm;
+	unsigned long flags;
+	uint64_t utime;
+	uint64_t stime;
+
+	// time
+	thread_group_cputime_adjusted(task, &utime, &stime);
+	usage->utime = div_u64(utime, NSEC_PER_USEC);
+	usage->stime = div_u64(stime, NSEC_PER_USEC);
+
+	// memory
+	mm = get_task_mm(task);
+	if (mm) {
+		// KB
+		usage->vm = mm->total_vm * PAGE_SIZE / KB;
+		usage->rss = get_mm_rss(mm) * PAGE_SIZE / KB;
+		usage->hw_vm = get_mm_hiwater_vm(mm) * PAGE_SIZE / KB;
+		usage->hw_rss = get_mm_hiwater_rss(mm) * PAGE_SIZE / KB;
+		mmput_async(mm);
+	}
+
+	// IO
+	if (!lock_task_sighand(task, &flags))
+		return;
+	acct = task->signal->ioac;
+	for_each_thread(task, t)
+		task_io_accounting_add(&acct, &t->ioac);
+	unlock_task_sighand(task, &flags);
+#ifdef CONFIG_TASK_IO_ACCOUNTING
+	// KB
+	usage->rbytes = acct.read_bytes & KB_MASK;
+	usage->wbytes = acct.write_bytes & KB_MASK;
+	usage->cancel_wbytes = acct.cancelled_write_bytes & KB_MASK;
+#else
+	// KB
+	usage->rbytes = acct.rchar & KB_MASK;
+	usage->wbytes = acct.wchar & KB_MASK;
+	usage->cancel_wbytes = 0;
+#endif
+}
+
+/*!
+ * @brief Record a resource usage sample of the process of @task, if the process is tracked.
+ *
+ * The sample is identified as the process node (ENT_PROC) it describes, with its type set to ENT_USAGE,
+ * and is written directly: it is not a version of the process node and does not create any relation.
+ * The counters of the process node are refreshed with the sample, for consumers of its next version.
+ * @param task The thread group leader of the process.
+ *
+ */
+static void record_proc_usage(struct task_struct *task)
+{
+	struct provenance *cprov = __task_cred(task)->provenance;
+	union prov_elt usage;
+	unsigned long irqflags;
+
+	if (!cprov || provenance_is_opaque(prov_elt(cprov)))
+		return;
+	if (!provenance_is_tracked(prov_elt(cprov)) && !prov_policy.prov_all)
+		return;
+	if (HIT_FILTER(prov_policy.prov_node_filter, ENT_USAGE))
+		return;
+
+	memset(&usage, 0, sizeof(union prov_elt));
+	update_proc_usage(task, &usage.usage_info);
+	usage.usage_info.tgid = task_tgid_nr(task);
+
+	spin_lock_irqsave_nested(prov_lock(cprov), irqflags, PROVENANCE_LOCK_PROC);
+	node_identifier(&usage) = node_identifier(prov_elt(cprov));
+	usage.usage_info.epoch = prov_elt(cprov)->proc_info.epoch;
+	usage.usage_info.uid = prov_elt(cprov)->proc_info.uid;
+	usage.usage_info.gid = prov_elt(cprov)->proc_info.gid;
+	usage.usage_info.secid = prov_elt(cprov)->proc_info.secid;
+	prov_elt(cprov)->proc_info.utime = usage.usage_info.utime;
+	prov_elt(cprov)->proc_info.stime = usage.usage_info.stime;
+	prov_elt(cprov)->proc_info.vm = usage.usage_info.vm;
+	prov_elt(cprov)->proc_info.rss = usage.usage_info.rss;
+	prov_elt(cprov)->proc_info.hw_vm = usage.usage_info.hw_vm;
+	prov_elt(cprov)->proc_info.hw_rss = usage.usage_info.hw_rss;
+	prov_elt(cprov)->proc_info.rbytes = usage.usage_info.rbytes;
+	prov_elt(cprov)->proc_info.wbytes = usage.usage_info.wbytes;
+	prov_elt(cprov)->proc_info.cancel_wbytes = usage.usage_info.cancel_wbytes;
+	spin_unlock_irqrestore(prov_lock(cprov), irqflags);
+
+	node_identifier(&usage).type = ENT_USAGE;
+	tighten_identifier(&get_prov_identifier(&usage));
+	prov_write(&usage, sizeof(union prov_elt));
+}
+
+/*!
+ * @brief Sample the resource usage of every tracked process, and schedule the next sample.
+ *
+ * The work is deferrable: an idle CPU is not woken up to sample, the sample is taken on its next wake up.
+ * Nothing is scheduled once the interval is set to 0, writing a new interval restarts sampling.
+ *
+ */
+static void prov_usage_sample(struct work_struct *work)
+{
+	uint32_t interval = READ_ONCE(prov_policy.prov_usage_interval);
+	struct task_struct *task;
+
+	if (!interval)
+		return;
+	if (prov_policy.prov_enabled && relay_ready) {
+		rcu_read_lock();
+		for_each_process(task) {
+			if (task->flags & PF_KTHREAD)
+				continue;
+			record_proc_usage(task);
+		}
+		rcu_read_unlock();
+	}
+	schedule_delayed_work(&prov_usage_work, msecs_to_jiffies(interval));
+}
+
+/*!
+ * @brief (Re)start sampling resource usage, every "prov_usage_interval" milliseconds.
+ *
+ * Called when the interval is set; the first sample is taken after one interval.
+ *
+ */
+void prov_usage_start(void)
+{
+	uint32_t interval = READ_ONCE(prov_policy.prov_usage_interval);
+
+	if (interval)
+		mod_delayed_work(system_wq, &prov_usage_work, msecs_to_jiffies(interval));
+}
@@ -0,0 +1,921 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Columnar provenance archive.
+ * Relay dumps are split into one partition file per node/relation type. Each
+ * partition is a sequence of blocks; within a block every identifier field is
+ * stored as its own column (ids and jiffies delta/zigzag varint encoded,
+ * boot_id, machine_id and types dictionary encoded), the remaining bytes of
+ * the records form a payload column, and every column is deflated
+ * separately. A zone map (record count, id and jiffies ranges) per block sits
+ * in the partition footer so scans can skip blocks without inflating them.
+ *
+ * Layout of <archive>/:
+ *   dict               type, boot_id and machine_id dictionaries
+ *   <type name>.col    one partition per type
+ *
+ * Partition: header | block* | zone map[nb_blocks] | trailer
+ * Block: count, nb_columns, (raw_len, deflated_len)[nb_columns], data
+ */
+#define _GNU_SOURCE
+#include "prov_tools.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <zlib.h>
+
+#define ARCHIVE_MAGIC           "CFCOL001"
+#define ARCHIVE_DICT_MAGIC      "CFDICT01"
+#define ARCHIVE_MAGIC_LEN       8
+#define ARCHIVE_BLOCK_RECORDS   16384
+#define ARCHIVE_BLOCK_BYTES     (8 << 20)
+#define ARCHIVE_MAX_PARTITIONS  512
+
+enum encoding {
+	ENC_VARINT,     // unsigned value
+	ENC_ZIGZAG,     // signed value
+	ENC_DELTA,      // zigzag delta against the previous row of the block
+	ENC_TYPE,       // index in the type dictionary
+	ENC_BOOT,       // index in the boot_id dictionary
+	ENC_MACHINE,    // index in the machine_id dictionary
+};
+
+#define FIELD_ALL               0
+#define FIELD_NODE              1
+#define FIELD_RELATION          2
+
+struct field {
+	const char *name;
+	size_t offset;
+	uint8_t width;
+	uint8_t encoding;
+	uint8_t kind;
+};
+
+#define elt_field(name, member, enc, kind) \
+	{ name, offsetof(union prov_elt, member), sizeof(((union prov_elt *)0)->member), enc, kind }
+
+/* Everything not listed here stays in the payload column. */
+static const struct field fields[] = {
+	elt_field("id", node_info.identifier.node_id.id, ENC_DELTA, FIELD_ALL),
+	elt_field("boot_id", node_info.identifier.node_id.boot_id, ENC_BOOT, FIELD_ALL),
+	elt_field("machine_id", node_info.identifier.node_id.machine_id, ENC_MACHINE, FIELD_ALL),
+	elt_field("version", node_info.identifier.node_id.version, ENC_VARINT, FIELD_ALL),
+	elt_field("epoch", msg_info.epoch, ENC_VARINT, FIELD_ALL),
+	elt_field("nepoch", msg_info.nepoch, ENC_VARINT, FIELD_ALL),
+	elt_field("flag", msg_info.internal_flag, ENC_VARINT, FIELD_ALL),
+	elt_field("jiffies", msg_info.jiffies, ENC_DELTA, FIELD_ALL),
+	elt_field("previous_id", node_info.previous_id, ENC_DELTA, FIELD_NODE),
+	elt_field("previous_type", node_info.previous_type, ENC_TYPE, FIELD_NODE),
+	elt_field("previous_version", node_info.previous_version, ENC_VARINT, FIELD_NODE),
+	elt_field("snd_type", relation_info.snd.node_id.type, ENC_TYPE, FIELD_RELATION),
+	elt_field("snd_id", relation_info.snd.node_id.id, ENC_DELTA, FIELD_RELATION),
+	elt_field("snd_boot_id", relation_info.snd.node_id.boot_id, ENC_BOOT, FIELD_RELATION),
+	elt_field("snd_machine_id", relation_info.snd.node_id.machine_id, ENC_MACHINE, FIELD_RELATION),
+	elt_field("snd_version", relation_info.snd.node_id.version, ENC_VARINT, FIELD_RELATION),
+	elt_field("rcv_type", relation_info.rcv.node_id.type, ENC_TYPE, FIELD_RELATION),
+	elt_field("rcv_id", relation_info.rcv.node_id.id, ENC_DELTA, FIELD_RELATION),
+	elt_field("rcv_boot_id", relation_info.rcv.node_id.boot_id, ENC_BOOT, FIELD_RELATION),
+	elt_field("rcv_machine_id", relation_info.rcv.node_id.machine_id, ENC_MACHINE, FIELD_RELATION),
+	elt_field("rcv_version", relation_info.rcv.node_id.version, ENC_VARINT, FIELD_RELATION),
+	elt_field("offset", relation_info.offset, ENC_ZIGZAG, FIELD_RELATION),
+	elt_field("flags", relation_info.flags, ENC_VARINT, FIELD_RELATION),
+};
+
+#define NB_FIELDS               (sizeof(fields) / sizeof(fields[0]))
+#define COL_ID                  0
+#define COL_JIFFIES             7
+#define COL_PAYLOAD             NB_FIELDS
+#define NB_COLUMNS              (NB_FIELDS + 1)
+
+/* kernel pointer, meaningless outside the kernel: not archived */
+#define VAR_PTR_OFFSET          offsetof(union prov_elt, node_info.var_ptr)
+
+struct dict {
+	uint64_t *values;
+	uint32_t *slots;        // open addressing, index + 1
+	uint32_t nb;
+	uint32_t cap;
+};
+
+enum {
+	DICT_TYPE,
+	DICT_BOOT,
+	DICT_MACHINE,
+	NB_DICTS,
+};
+
+static struct dict dicts[NB_DICTS];
+
+struct zone_map {
+	uint64_t offset;
+	uint32_t count;
+	uint32_t pad;
+	uint64_t min_id;
+	uint64_t max_id;
+	uint64_t min_jiffies;
+	uint64_t max_jiffies;
+};
+
+struct partition_header {
+	char magic[ARCHIVE_MAGIC_LEN];
+	uint64_t type;
+	uint32_t record_size;
+	uint32_t nb_columns;
+};
+
+struct partition_trailer {
+	uint64_t zone_offset;
+	uint64_t nb_blocks;
+	char magic[ARCHIVE_MAGIC_LEN];
+};
+
+struct partition {
+	uint64_t type;
+	uint32_t record_size;
+	bool relation;
+	FILE *file;
+	uint64_t offset;
+	uint8_t *pending;
+	uint32_t nb_pending;
+	uint32_t max_pending;
+	struct zone_map *zones;
+	uint64_t nb_zones;
+	uint64_t records;
+	uint64_t raw_bytes;
+};
+
+static struct partition partitions[ARCHIVE_MAX_PARTITIONS];
+static unsigned int nb_partitions;
+static int zlevel = 6;
+static uint32_t block_records = ARCHIVE_BLOCK_RECORDS;
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "archive: %s: %s\n", msg, errno ? strerror(errno) : "invalid input");
+	exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+
+	if (!p)
+		die("out of memory");
+	return p;
+}
+
+static inline uint64_t hash_u64(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	return v;
+}
+
+static void dict_grow(struct dict *d)
+{
+	uint32_t i, j, cap = d->cap ? d->cap * 2 : 256;
+
+	free(d->slots);
+	d->values = realloc(d->values, cap * sizeof(uint64_t));
+	d->slots = calloc(cap * 2, sizeof(uint32_t));
+	if (!d->values || !d->slots)
+		die("out of memory");
+	d->cap = cap;
+	for (i = 0; i < d->nb; i++) {
+		j = hash_u64(d->values[i]) & (cap * 2 - 1);
+		while (d->slots[j])
+			j = (j + 1) & (cap * 2 - 1);
+		d->slots[j] = i + 1;
+	}
+}
+
+static uint32_t dict_index(struct dict *d, uint64_t v)
+{
+	uint32_t j;
+
+	if (d->nb == d->cap)
+		dict_grow(d);
+	j = hash_u64(v) & (d->cap * 2 - 1);
+	while (d->slots[j]) {
+		if (d->values[d->slots[j] - 1] == v)
+			return d->slots[j] - 1;
+		j = (j + 1) & (d->cap * 2 - 1);
+	}
+	d->values[d->nb] = v;
+	d->slots[j] = ++d->nb;
+	return d->nb - 1;
+}
+
+static inline bool field_applies(const struct field *f, bool relation)
+{
+	if (f->kind == FIELD_NODE)
+		return !relation;
+	if (f->kind == FIELD_RELATION)
+		return relation;
+	return true;
+}
+
+static inline uint64_t load_field(const uint8_t *rec, const struct field *f)
+{
+	uint64_t v = 0;
+
+	memcpy(&v, rec + f->offset, f->width);
+	if (f->encoding == ENC_ZIGZAG && f->width < 8 && (v >> (f->width * 8 - 1)))
+		v |= ~0ULL << (f->width * 8);
+	return v;
+}
+
+static inline void store_field(uint8_t *rec, const struct field *f, uint64_t v)
+{
+	memcpy(rec + f->offset, &v, f->width);
+}
+
+static const char *partition_name(uint64_t type, char *buf, size_t len)
+{
+	const char *name = prov_type_str(type);
+
+	if (!strcmp(name, "unknown"))
+		snprintf(buf, len, "type-%016llx", (unsigned long long)type);
+	else
+		snprintf(buf, len, "%s", name);
+	return buf;
+}
+
+static void write_all(FILE *f, const void *buf, size_t len)
+{
+	if (len && fwrite(buf, 1, len, f) != len)
+		die("write failed");
+}
+
+static struct partition *get_partition(const char *dir, uint64_t type, uint32_t record_size)
+{
+	struct partition_header header;
+	struct partition *p;
+	char name[64], path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < nb_partitions; i++) {
+		if (partitions[i].type == type && partitions[i].record_size == record_size)
+			return &partitions[i];
+	}
+	if (nb_partitions == ARCHIVE_MAX_PARTITIONS)
+		die("too many partitions");
+	p = &partitions[nb_partitions++];
+	memset(p, 0, sizeof(*p));
+	p->type = type;
+	p->record_size = record_size;
+	p->relation = prov_type_is_relation(type);
+	dict_index(&dicts[DICT_TYPE], type);
+	p->max_pending = block_records;
+	if ((uint64_t)p->max_pending * record_size > ARCHIVE_BLOCK_BYTES)
+		p->max_pending = ARCHIVE_BLOCK_BYTES / record_size;
+	p->pending = xmalloc((size_t)p->max_pending * record_size);
+	partition_name(type, name, sizeof(name));
+	snprintf(path, sizeof(path), "%s/%s%s.col", dir, name,
+		 record_size == sizeof(union prov_elt) ? "" : ".long");
+	p->file = fopen(path, "w");
+	if (!p->file)
+		die(path);
+	memcpy(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN);
+	header.type = type;
+	header.record_size = record_size;
+	header.nb_columns = NB_COLUMNS;
+	write_all(p->file, &header, sizeof(header));
+	p->offset = sizeof(header);
+	return p;
+}
+
+static size_t encode_column(const struct partition *p, const struct field *f, uint8_t *out)
+{
+	const uint8_t *rec = p->pending;
+	uint8_t *o = out;
+	uint64_t v, prev = 0;
+	uint32_t i;
+
+	if (!field_applies(f, p->relation))
+		return 0;
+	for (i = 0; i < p->nb_pending; i++, rec += p->record_size) {
+		v = load_field(rec, f);
+		switch (f->encoding) {
+		case ENC_VARINT:
+			o = prov_put_varint(o, v);
+			break;
+		case ENC_ZIGZAG:
+			o = prov_put_varint(o, prov_zigzag((int64_t)v));
+			break;
+		case ENC_DELTA:
+			o = prov_put_varint(o, prov_zigzag((int64_t)(v - prev)));
+			prev = v;
+			break;
+		case ENC_TYPE:
+			o = prov_put_varint(o, dict_index(&dicts[DICT_TYPE], v));
+			break;
+		case ENC_BOOT:
+			o = prov_put_varint(o, dict_index(&dicts[DICT_BOOT], v));
+			break;
+		case ENC_MACHINE:
+			o = prov_put_varint(o, dict_index(&dicts[DICT_MACHINE], v));
+			break;
+		}
+	}
+	return o - out;
+}
+
+static size_t encode_payload(const struct partition *p, uint8_t *out)
+{
+	const uint8_t *rec = p->pending;
+	uint8_t *o = out;
+	unsigned int j;
+	uint32_t i;
+
+	for (i = 0; i < p->nb_pending; i++, rec += p->record_size, o += p->record_size) {
+		memcpy(o, rec, p->record_size);
+		memset(o + offsetof(union prov_elt, node_info.identifier.node_id.type), 0, sizeof(uint64_t));
+		for (j = 0; j < NB_FIELDS; j++) {
+			if (field_applies(&fields[j], p->relation))
+				memset(o + fields[j].offset, 0, fields[j].width);
+		}
+		if (!p->relation)
+			memset(o + VAR_PTR_OFFSET, 0, sizeof(void *));
+	}
+	return o - out;
+}
+
+static void flush_block(struct partition *p)
+{
+	uint32_t dir[NB_COLUMNS][2];
+	uint32_t header[2];
+	struct zone_map *zone;
+	size_t raw_cap = (size_t)p->nb_pending * (p->record_size > 10 ? p->record_size : 10);
+	uint8_t *raw = xmalloc(raw_cap);
+	uint8_t *deflated = xmalloc(compressBound(raw_cap));
+	uint8_t **data = xmalloc(NB_COLUMNS * sizeof(uint8_t *));
+	const uint8_t *rec;
+	uLongf dlen;
+	uint64_t v;
+	unsigned int c;
+	uint32_t i;
+
+	if (!p->nb_pending)
+		goto out;
+
+	p->zones = realloc(p->zones, (p->nb_zones + 1) * sizeof(struct zone_map));
+	if (!p->zones)
+		die("out of memory");
+	zone = &p->zones[p->nb_zones++];
+	memset(zone, 0, sizeof(*zone));
+	zone->offset = p->offset;
+	zone->count = p->nb_pending;
+	zone->min_id = zone->min_jiffies = UINT64_MAX;
+	for (i = 0, rec = p->pending; i < p->nb_pending; i++, rec += p->record_size) {
+		v = load_field(rec, &fields[COL_ID]);
+		if (v < zone->min_id)
+			zone->min_id = v;
+		if (v > zone->max_id)
+			zone->max_id = v;
+		v = load_field(rec, &fields[COL_JIFFIES]);
+		if (v < zone->min_jiffies)
+			zone->min_jiffies = v;
+		if (v > zone->max_jiffies)
+			zone->max_jiffies = v;
+	}
+
+	for (c = 0; c < NB_COLUMNS; c++) {
+		if (c < NB_FIELDS)
+			dir[c][0] = encode_column(p, &fields[c], raw);
+		else
+			dir[c][0] = encode_payload(p, raw);
+		dlen = compressBound(raw_cap);
+		if (dir[c][0] && compress2(deflated, &dlen, raw, dir[c][0], zlevel) != Z_OK)
+			die("deflate failed");
+		dir[c][1] = dir[c][0] ? dlen : 0;
+		data[c] = xmalloc(dir[c][1]);
+		memcpy(data[c], deflated, dir[c][1]);
+	}
+	header[0] = p->nb_pending;
+	header[1] = NB_COLUMNS;
+	write_all(p->file, header, sizeof(header));
+	write_all(p->file, dir, sizeof(dir));
+	p->offset += sizeof(header) + sizeof(dir);
+	for (c = 0; c < NB_COLUMNS; c++) {
+		write_all(p->file, data[c], dir[c][1]);
+		p->offset += dir[c][1];
+		free(data[c]);
+	}
+	p->nb_pending = 0;
+out:
+	free(data);
+	free(deflated);
+	free(raw);
+}
+
+static void close_partition(struct partition *p)
+{
+	struct partition_trailer trailer;
+
+	flush_block(p);
+	trailer.zone_offset = p->offset;
+	trailer.nb_blocks = p->nb_zones;
+	memcpy(trailer.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN);
+	write_all(p->file, p->zones, p->nb_zones * sizeof(struct zone_map));
+	write_all(p->file, &trailer, sizeof(trailer));
+	p->offset += p->nb_zones * sizeof(struct zone_map) + sizeof(trailer);
+	fclose(p->file);
+	free(p->pending);
+	free(p->zones);
+}
+
+static void write_dicts(const char *dir)
+{
+	char path[PATH_MAX];
+	const char *name;
+	uint32_t i, len;
+	unsigned int d;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/dict", dir);
+	f = fopen(path, "w");
+	if (!f)
+		die(path);
+	write_all(f, ARCHIVE_DICT_MAGIC, ARCHIVE_MAGIC_LEN);
+	for (d = 0; d < NB_DICTS; d++) {
+		write_all(f, &dicts[d].nb, sizeof(uint32_t));
+		write_all(f, dicts[d].values, dicts[d].nb * sizeof(uint64_t));
+	}
+	/* type names, for readers that do not link type.c */
+	for (i = 0; i < dicts[DICT_TYPE].nb; i++) {
+		name = prov_type_str(dicts[DICT_TYPE].values[i]);
+		len = strlen(name);
+		write_all(f, &len, sizeof(len));
+		write_all(f, name, len);
+	}
+	fclose(f);
+}
+
+static void read_dicts(const char *dir)
+{
+	char path[PATH_MAX];
+	char magic[ARCHIVE_MAGIC_LEN];
+	unsigned int d;
+	uint32_t nb;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/dict", dir);
+	f = fopen(path, "r");
+	if (!f)
+		die(path);
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, ARCHIVE_DICT_MAGIC, sizeof(magic)))
+		die("bad dictionary");
+	for (d = 0; d < NB_DICTS; d++) {
+		if (fread(&nb, sizeof(nb), 1, f) != 1)
+			die("bad dictionary");
+		dicts[d].values = xmalloc(nb * sizeof(uint64_t));
+		dicts[d].nb = nb;
+		if (nb && fread(dicts[d].values, sizeof(uint64_t), nb, f) != nb)
+			die("bad dictionary");
+	}
+	fclose(f);
+}
+
+static uint64_t archive_dumps(const char *dir, char **paths, int nb_paths)
+{
+	struct prov_map map;
+	struct partition *p;
+	union prov_elt *elt;
+	uint64_t raw = 0;
+	size_t size, off;
+	unsigned int i;
+	int n;
+
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		die(dir);
+	for (n = 0; n < nb_paths; n++) {
+		if (prov_map_file(paths[n], &map))
+			die(paths[n]);
+		size = prov_is_long_dump(paths[n]) ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+		for (off = 0; off + size <= map.size; off += size) {
+			elt = (union prov_elt *)(map.data + off);
+			p = get_partition(dir, prov_type(elt), size);
+			memcpy(p->pending + (size_t)p->nb_pending * size, elt, size);
+			p->records++;
+			p->raw_bytes += size;
+			if (++p->nb_pending == p->max_pending)
+				flush_block(p);
+		}
+		if (off != map.size)
+			fprintf(stderr, "archive: %s: ignoring %zu trailing bytes\n", paths[n], map.size - off);
+		raw += off;
+		prov_unmap_file(&map);
+	}
+	for (i = 0; i < nb_partitions; i++)
+		close_partition(&partitions[i]);
+	write_dicts(dir);
+	return raw;
+}
+
+/* Reading side */
+
+struct partition_reader {
+	struct prov_map map;
+	const struct partition_header *header;
+	const struct zone_map *zones;
+	uint64_t nb_blocks;
+	bool relation;
+};
+
+static int open_reader(const char *path, struct partition_reader *r)
+{
+	const struct partition_trailer *trailer;
+
+	if (prov_map_file(path, &r->map))
+		return -1;
+	if (r->map.size < sizeof(struct partition_header) + sizeof(struct partition_trailer))
+		goto bad;
+	r->header = (const struct partition_header *)r->map.data;
+	trailer = (const struct partition_trailer *)(r->map.data + r->map.size - sizeof(*trailer));
+	if (memcmp(r->header->magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) ||
+	    memcmp(trailer->magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) ||
+	    r->header->nb_columns != NB_COLUMNS ||
+	    trailer->zone_offset + trailer->nb_blocks * sizeof(struct zone_map) > r->map.size)
+		goto bad;
+	r->zones = (const struct zone_map *)(r->map.data + trailer->zone_offset);
+	r->nb_blocks = trailer->nb_blocks;
+	r->relation = prov_type_is_relation(r->header->type);
+	return 0;
+bad:
+	prov_unmap_file(&r->map);
+	errno = 0;
+	return -1;
+}
+
+/* Inflate one column of a block. Returns the raw length or -1. */
+static ssize_t read_column(const struct partition_reader *r, const struct zone_map *zone,
+			   unsigned int col, uint8_t *out, size_t cap)
+{
+	const uint8_t *block = r->map.data + zone->offset;
+	const uint32_t *dir = (const uint32_t *)(block + 2 * sizeof(uint32_t));
+	const uint8_t *data = (const uint8_t *)(dir + 2 * NB_COLUMNS);
+	uLongf len = cap;
+	unsigned int c;
+
+	for (c = 0; c < col; c++)
+		data += dir[2 * c + 1];
+	if (!dir[2 * col])
+		return 0;
+	if (dir[2 * col] > cap || data + dir[2 * col + 1] > r->map.data + r->map.size)
+		return -1;
+	if (uncompress(out, &len, data, dir[2 * col + 1]) != Z_OK)
+		return -1;
+	return len;
+}
+
+static int decode_column(const struct field *f, const uint8_t *in, size_t len,
+			 uint32_t count, uint64_t *values)
+{
+	const uint8_t *end = in + len;
+	uint64_t v, prev = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		in = prov_get_varint(in, end, &v);
+		if (!in)
+			return -1;
+		switch (f->encoding) {
+		case ENC_ZIGZAG:
+			v = (uint64_t)prov_unzigzag(v);
+			break;
+		case ENC_DELTA:
+			v = prev + (uint64_t)prov_unzigzag(v);
+			prev = v;
+			break;
+		case ENC_TYPE:
+		case ENC_BOOT:
+		case ENC_MACHINE:
+			if (v >= dicts[f->encoding - ENC_TYPE].nb)
+				return -1;
+			v = dicts[f->encoding - ENC_TYPE].values[v];
+			break;
+		}
+		values[i] = v;
+	}
+	return 0;
+}
+
+static int load_column(const struct partition_reader *r, const struct zone_map *zone,
+		       unsigned int col, uint8_t *scratch, size_t cap, uint64_t *values)
+{
+	ssize_t len = read_column(r, zone, col, scratch, cap);
+
+	if (len < 0)
+		return -1;
+	return decode_column(&fields[col], scratch, len, zone->count, values);
+}
+
+static int list_partitions(const char *dir, char ***paths)
+{
+	struct dirent *de;
+	DIR *d = opendir(dir);
+	char path[PATH_MAX];
+	size_t len;
+	int nb = 0;
+
+	if (!d)
+		die(dir);
+	*paths = NULL;
+	while ((de = readdir(d))) {
+		len = strlen(de->d_name);
+		if (len < 4 || strcmp(de->d_name + len - 4, ".col"))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		*paths = realloc(*paths, (nb + 1) * sizeof(char *));
+		if (!*paths)
+			die("out of memory");
+		(*paths)[nb++] = strdup(path);
+	}
+	closedir(d);
+	return nb;
+}
+
+/* Rebuild the raw records of every partition. */
+static void extract(const char *dir, const char *output)
+{
+	struct partition_reader r;
+	char path[PATH_MAX];
+	uint64_t *values[NB_FIELDS];
+	uint8_t *scratch, *payload;
+	size_t cap, rec_size;
+	FILE *out[2];
+	char **paths;
+	unsigned int c;
+	uint64_t b;
+	uint32_t i;
+	int n, nb;
+
+	read_dicts(dir);
+	snprintf(path, sizeof(path), "%s.long", output);
+	out[0] = fopen(output, "w");
+	out[1] = fopen(path, "w");
+	if (!out[0] || !out[1])
+		die(output);
+	nb = list_partitions(dir, &paths);
+	for (n = 0; n < nb; n++) {
+		if (open_reader(paths[n], &r))
+			die(paths[n]);
+		rec_size = r.header->record_size;
+		cap = (size_t)(ARCHIVE_BLOCK_BYTES > block_records * 10 ? ARCHIVE_BLOCK_BYTES : block_records * 10);
+		scratch = xmalloc(cap);
+		payload = xmalloc(cap);
+		for (c = 0; c < NB_FIELDS; c++)
+			values[c] = xmalloc(cap / 8 * sizeof(uint64_t));
+		for (b = 0; b < r.nb_blocks; b++) {
+			const struct zone_map *zone = &r.zones[b];
+			uint8_t *rec;
+
+			if ((size_t)zone->count * rec_size > cap ||
+			    read_column(&r, zone, COL_PAYLOAD, payload, cap) != (ssize_t)(zone->count * rec_size))
+				die("corrupted payload");
+			for (c = 0; c < NB_FIELDS; c++) {
+				if (field_applies(&fields[c], r.relation) &&
+				    load_column(&r, zone, c, scratch, cap, values[c]))
+					die("corrupted column");
+			}
+			for (i = 0, rec = payload; i < zone->count; i++, rec += rec_size) {
+				memcpy(rec + offsetof(union prov_elt, node_info.identifier.node_id.type),
+				       &r.header->type, sizeof(uint64_t));
+				for (c = 0; c < NB_FIELDS; c++) {
+					if (field_applies(&fields[c], r.relation))
+						store_field(rec, &fields[c], values[c][i]);
+				}
+			}
+			write_all(out[rec_size != sizeof(union prov_elt)], payload, (size_t)zone->count * rec_size);
+		}
+		for (c = 0; c < NB_FIELDS; c++)
+			free(values[c]);
+		free(payload);
+		free(scratch);
+		prov_unmap_file(&r.map);
+		free(paths[n]);
+	}
+	free(paths);
+	fclose(out[0]);
+	fclose(out[1]);
+}
+
+/* Scans: count records in a jiffies window and checksum their ids. */
+struct scan_result {
+	uint64_t records;
+	uint64_t matched;
+	uint64_t checksum;
+	uint64_t blocks;
+	uint64_t skipped;
+	double seconds;
+};
+
+static void scan_raw(char **paths, int nb_paths, uint64_t lo, uint64_t hi, struct scan_result *res)
+{
+	const union prov_elt *elt;
+	struct prov_map map;
+	size_t size, off;
+	double start = prov_now();
+	int n;
+
+	memset(res, 0, sizeof(*res));
+	for (n = 0; n < nb_paths; n++) {
+		if (prov_map_file(paths[n], &map))
+			die(paths[n]);
+		size = prov_is_long_dump(paths[n]) ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+		for (off = 0; off + size <= map.size; off += size) {
+			elt = (const union prov_elt *)(map.data + off);
+			res->records++;
+			if (prov_jiffies(elt) >= lo && prov_jiffies(elt) <= hi) {
+				res->matched++;
+				res->checksum += node_identifier(elt).id;
+			}
+		}
+		prov_unmap_file(&map);
+	}
+	res->seconds = prov_now() - start;
+}
+
+static void scan_archive(const char *dir, uint64_t lo, uint64_t hi, struct scan_result *res)
+{
+	struct partition_reader r;
+	uint64_t *ids, *jiffies;
+	size_t cap = block_records * 10;
+	uint8_t *scratch = xmalloc(cap);
+	double start = prov_now();
+	char **paths;
+	uint64_t b;
+	uint32_t i;
+	int n, nb;
+
+	memset(res, 0, sizeof(*res));
+	ids = xmalloc(block_records * sizeof(uint64_t));
+	jiffies = xmalloc(block_records * sizeof(uint64_t));
+	nb = list_partitions(dir, &paths);
+	for (n = 0; n < nb; n++) {
+		if (open_reader(paths[n], &r))
+			die(paths[n]);
+		for (b = 0; b < r.nb_blocks; b++) {
+			const struct zone_map *zone = &r.zones[b];
+
+			res->blocks++;
+			res->records += zone->count;
+			if (zone->max_jiffies < lo || zone->min_jiffies > hi) {
+				res->skipped++;
+				continue;
+			}
+			if (zone->count > block_records)
+				die("block larger than -b");
+			if (load_column(&r, zone, COL_JIFFIES, scratch, cap, jiffies) ||
+			    load_column(&r, zone, COL_ID, scratch, cap, ids))
+				die("corrupted column");
+			for (i = 0; i < zone->count; i++) {
+				if (jiffies[i] >= lo && jiffies[i] <= hi) {
+					res->matched++;
+					res->checksum += ids[i];
+				}
+			}
+		}
+		prov_unmap_file(&r.map);
+		free(paths[n]);
+	}
+	free(paths);
+	free(jiffies);
+	free(ids);
+	free(scratch);
+	res->seconds = prov_now() - start;
+}
+
+static void print_scan(const char *name, const struct scan_result *res, uint64_t bytes)
+{
+	printf("%-22s %12llu records %12llu matched %8.3fs %12.0f records/s %10.1f MB/s",
+	       name, (unsigned long long)res->records, (unsigned long long)res->matched,
+	       res->seconds, res->records / res->seconds, bytes / res->seconds / (1024 * 1024));
+	if (res->blocks)
+		printf(" (%llu/%llu blocks skipped)", (unsigned long long)res->skipped,
+		       (unsigned long long)res->blocks);
+	printf("\n");
+}
+
+static void report(const char *dir, char **paths, int nb_paths, uint64_t raw, double build)
+{
+	struct scan_result rs, as;
+	uint64_t archived = 0, lo = UINT64_MAX, hi = 0, q_lo, q_hi;
+	char name[64];
+	unsigned int i;
+
+	printf("%-32s %12s %14s %14s %8s\n", "partition", "records", "raw bytes", "archive bytes", "ratio");
+	for (i = 0; i < nb_partitions; i++) {
+		struct partition *p = &partitions[i];
+
+		archived += p->offset;
+		partition_name(p->type, name, sizeof(name));
+		printf("%-27s%5s %12llu %14llu %14llu %7.1fx\n", name,
+		       p->record_size == sizeof(union prov_elt) ? "" : " long",
+		       (unsigned long long)p->records, (unsigned long long)p->raw_bytes,
+		       (unsigned long long)p->offset, (double)p->raw_bytes / p->offset);
+	}
+	printf("\n%llu bytes raw, %llu bytes archived (%.1fx) in %.3fs (%.1f MB/s)\n\n",
+	       (unsigned long long)raw, (unsigned long long)archived, (double)raw / archived,
+	       build, raw / build / (1024 * 1024));
+
+	/* full scan, then a selective one over the middle tenth of the time range */
+	scan_raw(paths, nb_paths, 0, UINT64_MAX, &rs);
+	scan_archive(dir, 0, UINT64_MAX, &as);
+	print_scan("raw full scan", &rs, raw);
+	print_scan("archive full scan", &as, raw);
+	if (rs.checksum != as.checksum || rs.matched != as.matched)
+		fprintf(stderr, "archive: scan mismatch between raw and archive!\n");
+
+	for (i = 0; i < (unsigned int)nb_paths; i++) {
+		struct prov_map map;
+		size_t size, off;
+
+		if (prov_map_file(paths[i], &map))
+			die(paths[i]);
+		size = prov_is_long_dump(paths[i]) ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+		for (off = 0; off + size <= map.size; off += size) {
+			uint64_t j = prov_jiffies((const union prov_elt *)(map.data + off));
+
+			if (j < lo)
+				lo = j;
+			if (j > hi)
+				hi = j;
+		}
+		prov_unmap_file(&map);
+	}
+	if (lo > hi)
+		return;
+	q_lo = lo + (hi - lo) / 10 * 4;
+	q_hi = lo + (hi - lo) / 10 * 5;
+	scan_raw(paths, nb_paths, q_lo, q_hi, &rs);
+	scan_archive(dir, q_lo, q_hi, &as);
+	print_scan("raw window scan", &rs, raw);
+	print_scan("archive window scan", &as, raw);
+	if (rs.checksum != as.checksum || rs.matched != as.matched)
+		fprintf(stderr, "archive: scan mismatch between raw and archive!\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-z level] [-b records] -o <archive> <dump>...\n", name);
+	fprintf(stderr, "       %s -x <archive> <output>\n", name);
+	fprintf(stderr, "dumps whose name contains \"long\" hold long records\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = NULL;
+	const char *xdir = NULL;
+	double start;
+	uint64_t raw;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:x:z:b:")) != -1) {
+		switch (opt) {
+		case 'o':
+			dir = optarg;
+			break;
+		case 'x':
+			xdir = optarg;
+			break;
+		case 'z':
+			zlevel = atoi(optarg);
+			break;
+		case 'b':
+			block_records = strtoul(optarg, NULL, 0);
+			if (!block_records)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (xdir) {
+		if (optind != argc - 1)
+			usage(argv[0]);
+		extract(xdir, argv[optind]);
+		return EXIT_SUCCESS;
+	}
+	if (!dir || optind == argc)
+		usage(argv[0]);
+	start = prov_now();
+	raw = archive_dumps(dir, &argv[optind], argc - optind);
+	report(dir, &argv[optind], argc - optind, raw, prov_now() - start);
+	return EXIT_SUCCESS;
+}
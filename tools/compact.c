@@ -0,0 +1,290 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Decoder for the compact relay wire format, see include/uapi/linux/provenance_compact.h.
+ * Compact dumps are decoded back to raw records; raw dumps can be encoded the way
+ * a compact channel would have emitted them, and checked for an exact round trip.
+ */
+#define _GNU_SOURCE
+#include "prov_tools.h"
+#include <linux/provenance_compact.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+
+#define SUBBUF_SIZE     (1 << 20)       // PROV_RELAY_BUFF_SIZE
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d <compact dump> <raw out>\n", name);
+	fprintf(stderr, "       %s -e [-s subbuf size] <raw dump> <compact out>\n", name);
+	fprintf(stderr, "       %s -c [-s subbuf size] <raw dump>...\n", name);
+	fprintf(stderr, "  -d  decode a dump read from a compact channel\n");
+	fprintf(stderr, "  -e  encode a raw dump as a compact channel would have\n");
+	fprintf(stderr, "  -c  check the round trip and report the bytes per record\n");
+	fprintf(stderr, "dumps whose name contains \"long\" hold long records\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Same framing as the kernel: a header opens every sub-buffer, records never straddle two. */
+struct framer {
+	struct prov_compact_state state;
+	size_t subbuf_size;
+	size_t offset;          // in the current sub-buffer
+	uint32_t sequence;
+	uint8_t *out;           // whole stream, padding excluded as read() does
+	size_t len;
+	size_t cap;
+	uint8_t scratch[PROV_COMPACT_MAX_SIZE];
+};
+
+static void framer_reserve(struct framer *f, size_t len)
+{
+	if (f->len + len <= f->cap)
+		return;
+	f->cap = (f->cap + len) * 2;
+	f->out = realloc(f->out, f->cap);
+	if (!f->out) {
+		perror("compact");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void framer_subbuf_start(struct framer *f, uint32_t boot_id, uint32_t machine_id)
+{
+	prov_compact_reset(&f->state, boot_id, machine_id);
+	framer_reserve(f, sizeof(struct prov_compact_header));
+	prov_compact_write_header(f->out + f->len, &f->state, f->sequence++);
+	f->len += sizeof(struct prov_compact_header);
+	f->offset = sizeof(struct prov_compact_header);
+}
+
+static void framer_write(struct framer *f, const void *record, bool is_long)
+{
+	const union long_prov_elt *elt = record;
+	size_t len;
+
+	if (!f->sequence)
+		framer_subbuf_start(f, node_identifier(elt).boot_id, node_identifier(elt).machine_id);
+	len = prov_compact_encode(&f->state, record, is_long, f->scratch);
+	if (f->offset + len > f->subbuf_size) {
+		framer_subbuf_start(f, f->state.boot_id, f->state.machine_id);
+		len = prov_compact_encode(&f->state, record, is_long, f->scratch);
+	}
+	framer_reserve(f, len);
+	memcpy(f->out + f->len, f->scratch, len);
+	f->len += len;
+	f->offset += len;
+}
+
+/* Zero what the compact format does not carry and derive record_size, for comparison. */
+static void normalize(union long_prov_elt *elt, bool is_long)
+{
+	elt->msg_info.nepoch = 0;
+	elt->msg_info.record_size = is_long ? prov_long_record_size(elt) : prov_record_size(prov_type(elt));
+	if (prov_is_relation(elt)) {
+		elt->relation_info.internal_flag = 0;
+		elt->relation_info.identifier.node_id.version = 0;
+		return;
+	}
+	elt->node_info.k_version = 0;
+	elt->node_info.var_ptr = NULL;
+}
+
+static int encode(const char *in, const char *out, size_t subbuf_size)
+{
+	struct framer *f = calloc(1, sizeof(struct framer));
+	bool is_long = prov_is_long_dump(in);
+	size_t size = is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+	struct prov_map map;
+	size_t off;
+	FILE *fp;
+
+	if (!f)
+		return -1;
+	if (prov_map_file(in, &map)) {
+		fprintf(stderr, "compact: %s: %s\n", in, strerror(errno));
+		return -1;
+	}
+	f->subbuf_size = subbuf_size;
+	for (off = 0; off + size <= map.size; off += size)
+		framer_write(f, map.data + off, is_long);
+	prov_unmap_file(&map);
+	fp = fopen(out, "w");
+	if (!fp || fwrite(f->out, 1, f->len, fp) != f->len || fclose(fp)) {
+		fprintf(stderr, "compact: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	free(f->out);
+	free(f);
+	return 0;
+}
+
+static int decode(const char *in, const char *out)
+{
+	union long_prov_elt *elt = malloc(sizeof(union long_prov_elt));
+	struct prov_compact_state state;
+	struct prov_map map;
+	bool synced = false;
+	size_t off = 0, skipped = 0;
+	uint64_t records = 0;
+	int kind;
+	long len;
+	FILE *fp;
+
+	if (!elt)
+		return -1;
+	if (prov_map_file(in, &map)) {
+		fprintf(stderr, "compact: %s: %s\n", in, strerror(errno));
+		return -1;
+	}
+	fp = fopen(out, "w");
+	if (!fp) {
+		fprintf(stderr, "compact: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	while (off < map.size) {
+		len = prov_compact_decode(&state, map.data + off, map.size - off, elt, &kind);
+		/* resynchronise on the next sub-buffer header */
+		if (len < 0 || (!synced && kind != PROV_COMPACT_HEADER)) {
+			synced = false;
+			off++;
+			skipped++;
+			continue;
+		}
+		off += len;
+		if (kind == PROV_COMPACT_HEADER) {
+			synced = true;
+			continue;
+		}
+		fwrite(elt, 1, kind == PROV_COMPACT_LONG_NODE ? sizeof(union long_prov_elt) : sizeof(union prov_elt), fp);
+		records++;
+	}
+	prov_unmap_file(&map);
+	free(elt);
+	if (fclose(fp)) {
+		fprintf(stderr, "compact: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	fprintf(stderr, "compact: %llu records decoded, %zu bytes skipped\n", (unsigned long long)records, skipped);
+	return 0;
+}
+
+static int check(const char *path, size_t subbuf_size)
+{
+	struct framer *f = calloc(1, sizeof(struct framer));
+	union long_prov_elt *elt = malloc(sizeof(union long_prov_elt));
+	union long_prov_elt *ref = malloc(sizeof(union long_prov_elt));
+	bool is_long = prov_is_long_dump(path);
+	size_t size = is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+	uint64_t nb[4] = { 0 }, bytes[4] = { 0 }, errors = 0;
+	struct prov_compact_state state;
+	struct prov_map map;
+	size_t off, in_off;
+	double t;
+	int kind;
+	long len;
+
+	if (!f || !elt || !ref)
+		return -1;
+	if (prov_map_file(path, &map)) {
+		fprintf(stderr, "compact: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	f->subbuf_size = subbuf_size;
+	t = prov_now();
+	for (off = 0; off + size <= map.size; off += size)
+		framer_write(f, map.data + off, is_long);
+	t = prov_now() - t;
+
+	for (off = 0, in_off = 0; off < f->len;) {
+		len = prov_compact_decode(&state, f->out + off, f->len - off, elt, &kind);
+		if (len < 0) {
+			fprintf(stderr, "compact: %s: corrupt stream at %zu\n", path, off);
+			return -1;
+		}
+		off += len;
+		nb[kind]++;
+		bytes[kind] += len;
+		if (kind == PROV_COMPACT_HEADER)
+			continue;
+		memcpy(ref, map.data + in_off, size);
+		normalize(ref, is_long);
+		if (memcmp(ref, elt, size))
+			errors++;
+		in_off += size;
+	}
+	printf("%s: %llu records, %zu sub-buffers, %.1f MB raw, %.1f MB compact (%.2fx), encode %.0f MB/s\n",
+	       path, (unsigned long long)(nb[1] + nb[2] + nb[3]), (size_t)nb[0],
+	       map.size / (1024.0 * 1024), f->len / (1024.0 * 1024), (double)map.size / f->len,
+	       map.size / t / (1024 * 1024));
+	if (nb[PROV_COMPACT_RELATION])
+		printf("  relations   %6.1f bytes/record (raw %zu)\n",
+		       (double)bytes[PROV_COMPACT_RELATION] / nb[PROV_COMPACT_RELATION], size);
+	if (nb[PROV_COMPACT_NODE])
+		printf("  nodes       %6.1f bytes/record (raw %zu)\n",
+		       (double)bytes[PROV_COMPACT_NODE] / nb[PROV_COMPACT_NODE], size);
+	if (nb[PROV_COMPACT_LONG_NODE])
+		printf("  long nodes  %6.1f bytes/record (raw %zu)\n",
+		       (double)bytes[PROV_COMPACT_LONG_NODE] / nb[PROV_COMPACT_LONG_NODE], size);
+	if (in_off != map.size - map.size % size)
+		errors++;
+	printf("  round trip  %s (%llu mismatches)\n", errors ? "FAILED" : "ok", (unsigned long long)errors);
+	prov_unmap_file(&map);
+	free(f->out);
+	free(f);
+	free(elt);
+	free(ref);
+	return errors ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t subbuf_size = SUBBUF_SIZE;
+	int opt, i, mode = 0, rc = 0;
+
+	while ((opt = getopt(argc, argv, "decs:")) != -1) {
+		switch (opt) {
+		case 'd':
+		case 'e':
+		case 'c':
+			mode = opt;
+			break;
+		case 's':
+			subbuf_size = strtoul(optarg, NULL, 0);
+			if (subbuf_size < sizeof(struct prov_compact_header) + PROV_COMPACT_MAX_SIZE)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	switch (mode) {
+	case 'd':
+		if (argc - optind != 2)
+			usage(argv[0]);
+		return decode(argv[optind], argv[optind + 1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+	case 'e':
+		if (argc - optind != 2)
+			usage(argv[0]);
+		return encode(argv[optind], argv[optind + 1], subbuf_size) ? EXIT_FAILURE : EXIT_SUCCESS;
+	case 'c':
+		if (optind == argc)
+			usage(argv[0]);
+		for (i = optind; i < argc; i++)
+			rc |= check(argv[i], subbuf_size);
+		return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+	default:
+		usage(argv[0]);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,607 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Reference relay consumer.
+ * One thread per CPU, pinned to that CPU, drains the regular and long relay
+ * buffers of a channel. With -N, one thread per NUMA node, pinned to the CPUs
+ * of that node, drains the buffers of all of them, so that reads never cross
+ * the interconnect while fewer threads wake up. Data is moved with splice(2) (relay -> pipe -> output)
+ * so that records are never copied to userspace; read(2) of whole
+ * sub-buffers is used as a fallback when splice is not supported by the
+ * output. Threads sleep in poll(2) between sub-buffer switches.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <linux/provenance.h>
+#include <linux/provenance_types.h>
+
+/* default geometry of security/provenance/include/provenance_relay.h, reads work with any */
+#define PROV_RELAY_BUFF_SIZE    (1 << 20)
+#define PROV_NB_SUBBUF          64
+
+#define CONSUMER_POLL_MS        100
+#define CONSUMER_PIPE_SIZE      PROV_RELAY_BUFF_SIZE
+
+enum {
+	CHAN_REGULAR = 0,
+	CHAN_LONG,
+	CHAN_NB,
+};
+
+struct relay_stream {
+	int in;                 // relay file
+	int out;                // output file or socket
+	int pipe[2];            // splice staging pipe
+	bool splice;            // false once splice is not supported
+	size_t record_size;
+	uint64_t bytes;         // updated atomically, read by the reporter
+};
+
+struct cpu_consumer {
+	int cpu;
+	int node;
+	struct relay_stream stream[CHAN_NB];
+} __attribute__((aligned(64)));
+
+/* A thread draining the buffers of one CPU, or of every CPU of a NUMA node. */
+struct reader {
+	pthread_t thread;
+	int node;
+	cpu_set_t cpus;         // where the thread is allowed to run
+	struct cpu_consumer **consumers;
+	int nb;
+};
+
+static struct cpu_consumer *consumers;
+static int nb_consumers;
+static struct reader *readers;
+static int nb_readers;
+static volatile sig_atomic_t stop;
+static int flushed;             // set once the final flush is done, readers drain after it
+
+static const char *channel = "provenance";
+static const char *output;
+static const char *host;
+static const char *port;
+static unsigned int duration;
+static unsigned int interval = 1;
+static bool flush_on_exit = true;
+static bool per_node;
+static bool bytes_only;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c channel] [-o prefix | -s host:port] [-t seconds] [-i seconds] [-n] [-N] [-b]\n", name);
+	fprintf(stderr, "  -c  relay channel to consume (default provenance)\n");
+	fprintf(stderr, "  -o  write records to <prefix>.<cpu> and <prefix>.long.<cpu>\n");
+	fprintf(stderr, "  -s  stream records over one TCP connection per buffer\n");
+	fprintf(stderr, "  -t  stop after the given number of seconds\n");
+	fprintf(stderr, "  -i  throughput report interval (default 1s, 0 to disable)\n");
+	fprintf(stderr, "  -n  do not flush relay buffers on exit\n");
+	fprintf(stderr, "  -N  one reader thread per NUMA node instead of one per CPU\n");
+	fprintf(stderr, "  -b  report bytes only, for compact, LZ4 or sized channels whose records vary in size\n");
+	exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_socket(void)
+{
+	struct addrinfo hints, *res, *rp;
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res))
+		return -1;
+	for (rp = res; rp; rp = rp->ai_next) {
+		fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, rp->ai_addr, rp->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int open_output(int cpu, int chan)
+{
+	char path[PATH_MAX];
+
+	if (host)
+		return open_socket();
+	if (!output)
+		return open("/dev/null", O_WRONLY);
+	if (chan == CHAN_LONG)
+		snprintf(path, sizeof(path), "%s.long.%d", output, cpu);
+	else
+		snprintf(path, sizeof(path), "%s.%d", output, cpu);
+	return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+}
+
+static int open_stream(struct relay_stream *s, int cpu, int chan)
+{
+	char path[PATH_MAX];
+
+	if (chan == CHAN_LONG) {
+		snprintf(path, sizeof(path), "%slong_%s%d", PROV_CHANNEL_ROOT, channel, cpu);
+		s->record_size = sizeof(union long_prov_elt);
+	} else {
+		snprintf(path, sizeof(path), "%s%s%d", PROV_CHANNEL_ROOT, channel, cpu);
+		s->record_size = sizeof(union prov_elt);
+	}
+	s->in = open(path, O_RDONLY | O_NONBLOCK);
+	if (s->in < 0)
+		return -errno;
+	s->out = open_output(cpu, chan);
+	if (s->out < 0) {
+		fprintf(stderr, "consumer: cannot open output for cpu %d: %s\n", cpu, strerror(errno));
+		return -errno;
+	}
+	s->splice = true;
+	if (pipe2(s->pipe, O_NONBLOCK)) {
+		s->splice = false;
+		return 0;
+	}
+	/* best effort, a pipe holding a full sub-buffer halves the syscalls */
+	fcntl(s->pipe[1], F_SETPIPE_SZ, CONSUMER_PIPE_SIZE);
+	return 0;
+}
+
+static void close_stream(struct relay_stream *s)
+{
+	if (s->splice) {
+		close(s->pipe[0]);
+		close(s->pipe[1]);
+	}
+	if (s->out >= 0)
+		close(s->out);
+	if (s->in >= 0)
+		close(s->in);
+}
+
+/* Move everything sitting in the pipe to the output. */
+static int flush_pipe(struct relay_stream *s, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = splice(s->pipe[0], NULL, s->out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		len -= rc;
+	}
+	return 0;
+}
+
+static ssize_t drain_splice(struct relay_stream *s)
+{
+	ssize_t rc;
+	ssize_t total = 0;
+
+	for (;;) {
+		rc = splice(s->in, NULL, s->pipe[1], NULL, CONSUMER_PIPE_SIZE,
+			    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (rc == 0)
+			break;
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -errno;
+		}
+		if (flush_pipe(s, rc))
+			return -errno;
+		total += rc;
+	}
+	return total;
+}
+
+static ssize_t drain_read_fd(struct relay_stream *s, int fd, uint8_t *buf)
+{
+	ssize_t rc, w, off;
+	ssize_t total = 0;
+
+	for (;;) {
+		rc = read(fd, buf, PROV_RELAY_BUFF_SIZE);
+		if (rc == 0)
+			break;
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -errno;
+		}
+		for (off = 0; off < rc; off += w) {
+			w = write(s->out, buf + off, rc - off);
+			if (w < 0) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				return -errno;
+			}
+		}
+		total += rc;
+	}
+	return total;
+}
+
+static int drain(struct relay_stream *s, uint8_t **buf)
+{
+	ssize_t rc;
+
+	if (s->splice) {
+		rc = drain_splice(s);
+		if (rc != -EINVAL)
+			goto out;
+	}
+	/* only the read(2) fallback copies to userspace */
+	if (!*buf) {
+		*buf = malloc(PROV_RELAY_BUFF_SIZE);
+		if (!*buf)
+			return -ENOMEM;
+	}
+	if (s->splice) {
+		/* output does not support splice, fall back to whole sub-buffer reads */
+		s->splice = false;
+		close(s->pipe[1]);
+		rc = drain_read_fd(s, s->pipe[0], *buf);
+		close(s->pipe[0]);
+		if (rc < 0)
+			return rc;
+		__atomic_add_fetch(&s->bytes, rc, __ATOMIC_RELAXED);
+	}
+	rc = drain_read_fd(s, s->in, *buf);
+out:
+	if (rc < 0)
+		return rc;
+	/* a splice may end mid-record, records are only counted from the total (see total_records) */
+	__atomic_add_fetch(&s->bytes, rc, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void *consume(void *arg)
+{
+	struct reader *r = arg;
+	struct cpu_consumer *c;
+	struct pollfd *fds;
+	uint8_t *buf = NULL;    // allocated once pinned, so on the local node
+	int i, j, rc;
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &r->cpus))
+		fprintf(stderr, "consumer: could not pin reader of node %d\n", r->node);
+
+	fds = calloc(r->nb * CHAN_NB, sizeof(struct pollfd));
+	if (!fds) {
+		stop = 1;
+		return NULL;
+	}
+	for (i = 0; i < r->nb; i++) {
+		for (j = 0; j < CHAN_NB; j++) {
+			fds[i * CHAN_NB + j].fd = r->consumers[i]->stream[j].in;
+			fds[i * CHAN_NB + j].events = POLLIN;
+		}
+	}
+	while (!stop) {
+		/* relay signals on sub-buffer switch, the timeout picks up partial ones */
+		rc = poll(fds, r->nb * CHAN_NB, CONSUMER_POLL_MS);
+		if (rc < 0 && errno != EINTR)
+			break;
+		for (i = 0; i < r->nb; i++) {
+			c = r->consumers[i];
+			for (j = 0; j < CHAN_NB; j++) {
+				rc = drain(&c->stream[j], &buf);
+				if (rc < 0) {
+					fprintf(stderr, "consumer: cpu %d: %s\n", c->cpu, strerror(-rc));
+					stop = 1;
+				}
+			}
+		}
+	}
+	/* pick up what the final flush pushed out, once it is done */
+	while (!__atomic_load_n(&flushed, __ATOMIC_ACQUIRE))
+		usleep(1000);
+	for (i = 0; i < r->nb; i++)
+		for (j = 0; j < CHAN_NB; j++)
+			drain(&r->consumers[i]->stream[j], &buf);
+	free(fds);
+	free(buf);
+	return NULL;
+}
+
+/* NUMA node of a CPU, as exported by the provenance LSM, or by sysfs on older kernels. */
+static int cpu_node(int cpu)
+{
+	static uint32_t *map;
+	static int map_size = -1;
+	char path[PATH_MAX];
+	struct dirent *d;
+	ssize_t rc;
+	DIR *dir;
+	int fd, node = 0;
+
+	if (map_size < 0) {
+		map_size = 0;
+		map = calloc(CPU_SETSIZE, sizeof(uint32_t));
+		fd = open(PROV_CPU_NODE_FILE, O_RDONLY);
+		if (map && fd >= 0) {
+			rc = read(fd, map, CPU_SETSIZE * sizeof(uint32_t));
+			if (rc > 0)
+				map_size = rc / sizeof(uint32_t);
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+	if (cpu < map_size)
+		return map[cpu] == PROV_NO_NODE ? 0 : map[cpu];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	while ((d = readdir(dir))) {
+		if (!strncmp(d->d_name, "node", 4) && sscanf(d->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+	closedir(dir);
+	return node;
+}
+
+static int setup_readers(void)
+{
+	struct reader *r;
+	int i, j;
+
+	readers = calloc(nb_consumers, sizeof(struct reader));
+	if (!readers)
+		return -1;
+	for (i = 0; i < nb_consumers; i++) {
+		for (j = 0; j < nb_readers; j++)
+			if (per_node && readers[j].node == consumers[i].node)
+				break;
+		r = &readers[j];
+		if (j == nb_readers) {
+			nb_readers++;
+			r->node = consumers[i].node;
+			CPU_ZERO(&r->cpus);
+			r->consumers = calloc(nb_consumers, sizeof(struct cpu_consumer *));
+			if (!r->consumers)
+				return -1;
+		}
+		CPU_SET(consumers[i].cpu, &r->cpus);
+		r->consumers[r->nb++] = &consumers[i];
+	}
+	return 0;
+}
+
+static void flush_relay(void)
+{
+	int fd = open(PROV_FLUSH_FILE, O_WRONLY);
+
+	if (fd < 0)
+		return;
+	if (write(fd, "1", 1) < 0)
+		fprintf(stderr, "consumer: flush failed: %s\n", strerror(errno));
+	close(fd);
+}
+
+static uint64_t total_bytes(void)
+{
+	uint64_t total = 0;
+	int i, j;
+
+	for (i = 0; i < nb_consumers; i++)
+		for (j = 0; j < CHAN_NB; j++)
+			total += __atomic_load_n(&consumers[i].stream[j].bytes, __ATOMIC_RELAXED);
+	return total;
+}
+
+/*
+ * Records of fixed size channels. Relay never splits a record across
+ * sub-buffers and padding is skipped, so each stream holds whole records.
+ */
+static uint64_t total_records(void)
+{
+	struct relay_stream *s;
+	uint64_t total = 0;
+	int i, j;
+
+	for (i = 0; i < nb_consumers; i++) {
+		for (j = 0; j < CHAN_NB; j++) {
+			s = &consumers[i].stream[j];
+			total += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED) / s->record_size;
+		}
+	}
+	return total;
+}
+
+static void parse_host(char *arg)
+{
+	char *sep = strrchr(arg, ':');
+
+	if (!sep)
+		usage("consumer");
+	*sep = '\0';
+	host = arg;
+	port = sep + 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	double start, last, t;
+	uint64_t count, prev = 0;
+	uint64_t records, bytes;
+	int nb_cpus, cpu, i, j, opt;
+
+	while ((opt = getopt(argc, argv, "c:o:s:t:i:nNb")) != -1) {
+		switch (opt) {
+		case 'c':
+			channel = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			parse_host(optarg);
+			break;
+		case 't':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			flush_on_exit = false;
+			break;
+		case 'N':
+			per_node = true;
+			break;
+		case 'b':
+			bytes_only = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	consumers = aligned_alloc(64, nb_cpus * sizeof(struct cpu_consumer));
+	if (!consumers)
+		return EXIT_FAILURE;
+	memset(consumers, 0, nb_cpus * sizeof(struct cpu_consumer));
+
+	/* relay only creates buffers for CPUs that were online, skip the others */
+	for (cpu = 0; cpu < nb_cpus; cpu++) {
+		struct cpu_consumer *c = &consumers[nb_consumers];
+
+		c->cpu = cpu;
+		c->node = cpu_node(cpu);
+		for (i = 0; i < CHAN_NB; i++) {
+			c->stream[i].in = -1;
+			c->stream[i].out = -1;
+		}
+		for (i = 0; i < CHAN_NB; i++) {
+			if (open_stream(&c->stream[i], cpu, i))
+				break;
+		}
+		if (i < CHAN_NB) {
+			for (j = 0; j <= i && j < CHAN_NB; j++)
+				if (c->stream[j].in >= 0)
+					close_stream(&c->stream[j]);
+			continue;
+		}
+		nb_consumers++;
+	}
+	if (!nb_consumers) {
+		fprintf(stderr, "consumer: no relay buffer found for channel %s (is debugfs mounted?)\n", channel);
+		return EXIT_FAILURE;
+	}
+
+	if (setup_readers())
+		return EXIT_FAILURE;
+	for (i = 0; i < nb_readers; i++) {
+		if (pthread_create(&readers[i].thread, NULL, consume, &readers[i])) {
+			fprintf(stderr, "consumer: cannot start reader for node %d\n", readers[i].node);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fprintf(stderr, "consumer: %d cpus, %d readers, %zu bytes per record, %zu bytes per long record, %d x %d bytes per buffer\n",
+		nb_consumers, nb_readers, sizeof(union prov_elt), sizeof(union long_prov_elt),
+		PROV_NB_SUBBUF, PROV_RELAY_BUFF_SIZE);
+	if (per_node) {
+		for (i = 0; i < nb_readers; i++)
+			fprintf(stderr, "consumer: node %d, %d cpus\n", readers[i].node, readers[i].nb);
+	}
+	start = last = now();
+	while (!stop) {
+		sleep(interval ? interval : 1);
+		t = now();
+		if (duration && t - start >= duration)
+			stop = 1;
+		if (!interval)
+			continue;
+		count = bytes_only ? total_bytes() : total_records();
+		if (bytes_only)
+			fprintf(stderr, "consumer: %.2f MB/s\n", (count - prev) / (t - last) / (1024 * 1024));
+		else
+			fprintf(stderr, "consumer: %.0f records/s\n", (count - prev) / (t - last));
+		prev = count;
+		last = t;
+	}
+
+	if (flush_on_exit)
+		flush_relay();
+	__atomic_store_n(&flushed, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < nb_readers; i++)
+		pthread_join(readers[i].thread, NULL);
+	t = now();
+	records = total_records();
+	bytes = total_bytes();
+	for (i = 0; i < nb_consumers; i++)
+		for (j = 0; j < CHAN_NB; j++)
+			close_stream(&consumers[i].stream[j]);
+	if (bytes_only)
+		fprintf(stderr, "consumer: %llu bytes in %.2fs, sustained %.2f MB/s\n",
+			(unsigned long long)bytes, t - start, bytes / (t - start) / (1024 * 1024));
+	else
+		fprintf(stderr, "consumer: %llu records, %llu bytes in %.2fs, sustained %.0f records/s (%.2f MB/s)\n",
+			(unsigned long long)records, (unsigned long long)bytes, t - start,
+			records / (t - start), bytes / (t - start) / (1024 * 1024));
+	for (i = 0; i < nb_readers; i++)
+		free(readers[i].consumers);
+	free(readers);
+	free(consumers);
+	return EXIT_SUCCESS;
+}
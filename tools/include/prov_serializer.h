@@ -0,0 +1,55 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Streaming serializer from relay records to W3C PROV-JSON or CBOR.
+ * Every record becomes one self-contained PROV-JSON document (one per line)
+ * or one CBOR data item (an RFC 8742 CBOR sequence) holding the same
+ * structure, so output can be produced as records arrive.
+ */
+#ifndef _TOOLS_PROV_SERIALIZER_H
+#define _TOOLS_PROV_SERIALIZER_H
+
+#include "prov_tools.h"
+
+#define PROV_FORMAT_JSON        0
+#define PROV_FORMAT_CBOR        1
+
+#define PROV_WRITER_BUFFER      (1 << 20)
+#define PROV_WRITER_DEPTH       8
+
+/* Called whenever the buffer fills up; returns 0 on success. */
+typedef int (*prov_sink_t)(void *ctx, const uint8_t *buf, size_t len);
+
+struct prov_writer {
+	int format;
+	prov_sink_t sink;
+	void *ctx;
+	uint8_t *buf;
+	size_t len;
+	int depth;
+	bool first[PROV_WRITER_DEPTH];  // JSON: no comma before the next member
+	bool scalar;                    // disable the vectorized string paths
+	int error;
+	uint64_t bytes;                 // total bytes handed to the sink
+};
+
+int prov_writer_init(struct prov_writer *w, int format, prov_sink_t sink, void *ctx);
+void prov_writer_free(struct prov_writer *w);
+int prov_writer_flush(struct prov_writer *w);
+
+int prov_write_elt(struct prov_writer *w, const union prov_elt *elt);
+int prov_write_long_elt(struct prov_writer *w, const union long_prov_elt *elt);
+
+/* exposed for testing and benchmarking */
+size_t prov_json_escape(uint8_t *out, const uint8_t *in, size_t len, bool scalar);
+bool prov_utf8_valid(const uint8_t *in, size_t len, bool scalar);
+
+#endif /* _TOOLS_PROV_SERIALIZER_H */
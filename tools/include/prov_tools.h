@@ -0,0 +1,156 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Helpers shared by the userspace tools.
+ */
+#ifndef _TOOLS_PROV_TOOLS_H
+#define _TOOLS_PROV_TOOLS_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+/* libc's LONG_BIT collides with the provenance flag bit of the same name */
+#undef LONG_BIT
+#include <linux/provenance.h>
+#include <linux/provenance_types.h>
+
+/* security/provenance/type.c */
+const char *relation_str(uint64_t type);
+uint64_t relation_id(const char *str);
+const char *node_str(uint64_t type);
+uint64_t node_id(const char *str);
+
+static inline const char *prov_type_str(uint64_t type)
+{
+	if (prov_type_is_relation(type))
+		return relation_str(type);
+	return node_str(type);
+}
+
+static inline double prov_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Relay dumps of the long channel are named after PROV_LONG_RELAY_NAME. */
+static inline bool prov_is_long_dump(const char *path)
+{
+	const char *base = strrchr(path, '/');
+
+	base = base ? base + 1 : path;
+	return strstr(base, "long") != NULL;
+}
+
+struct prov_map {
+	uint8_t *data;
+	size_t size;
+};
+
+static inline int prov_map_file(const char *path, struct prov_map *map)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	map->size = st.st_size;
+	map->data = NULL;
+	if (map->size) {
+		map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map->data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(map->data, map->size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	return 0;
+}
+
+static inline void prov_unmap_file(struct prov_map *map)
+{
+	if (map->data)
+		munmap(map->data, map->size);
+}
+
+/*
+ * Records of sized channels (PROV_FORMAT_SIZED) are only as long as their record_size.
+ * Copy the record at off, zero-extended to a full union, and return its size;
+ * 0 at the end of the dump or on a corrupt size.
+ */
+static inline size_t prov_read_sized(const struct prov_map *map, size_t off, union long_prov_elt *elt)
+{
+	uint32_t size;
+
+	if (off + sizeof(struct msg_struct) > map->size)
+		return 0;
+	memcpy(&size, map->data + off + offsetof(struct msg_struct, record_size), sizeof(size));
+	if (size < sizeof(struct msg_struct) || size > sizeof(union long_prov_elt) || off + size > map->size)
+		return 0;
+	memset(elt, 0, size > sizeof(union prov_elt) ? sizeof(union long_prov_elt) : sizeof(union prov_elt));
+	memcpy(elt, map->data + off, size);
+	return size;
+}
+
+/* LEB128 varints, zigzag for signed deltas */
+static inline uint8_t *prov_put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline const uint8_t *prov_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	unsigned int shift = 0;
+
+	while (p < end && shift < 64) {
+		r |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*v = r;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+static inline uint64_t prov_zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t prov_unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif /* _TOOLS_PROV_TOOLS_H */
@@ -0,0 +1,23 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Userspace stand-in for security/provenance/include/provenance.h, so that
+ * security/provenance/type.c can be linked into the tools and type names
+ * stay identical to the ones the kernel uses.
+ */
+#ifndef _TOOLS_PROVENANCE_H
+#define _TOOLS_PROVENANCE_H
+
+#include "prov_tools.h"
+
+#define EXPORT_SYMBOL_GPL(sym)
+
+#endif /* _TOOLS_PROVENANCE_H */
@@ -0,0 +1,693 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Lineage index and query engine.
+ * "index" builds, from relay dumps, the vertex table of every (id, version)
+ * pair seen as a relation end point and two CSR adjacency arrays: forward
+ * (sender -> receiver, "what did this affect") and backward (receiver ->
+ * sender, "what influenced this"). "query" maps the index and runs a
+ * level-synchronous breadth first traversal, bounded in depth and restricted
+ * to relations whose jiffies fall in a window; every level's frontier is
+ * split in batches between worker threads. "bench" does the same on a
+ * synthetic graph and reports build and query throughput.
+ *
+ * Index: header | vertex[nb_vertices] | fwd offsets[nb_vertices + 1] |
+ *        fwd edges[nb_edges] | bwd offsets[nb_vertices + 1] | bwd edges[nb_edges]
+ */
+#define _GNU_SOURCE
+#include "prov_tools.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define LINEAGE_MAGIC           "CFLIN001"
+#define LINEAGE_BATCH           256
+#define LINEAGE_MAX_THREADS     256
+
+struct vertex {
+	uint64_t id;
+	uint32_t version;
+	uint32_t pad;
+};
+
+struct edge {
+	uint32_t target;
+	uint32_t pad;
+	uint64_t jiffies;
+};
+
+struct index_header {
+	char magic[8];
+	uint64_t nb_vertices;
+	uint64_t nb_edges;
+};
+
+struct raw_edge {
+	struct vertex snd;
+	struct vertex rcv;
+	uint64_t jiffies;
+};
+
+struct lineage_index {
+	struct prov_map map;
+	uint64_t nb_vertices;
+	uint64_t nb_edges;
+	const struct vertex *vertices;
+	const uint64_t *offsets[2];
+	const struct edge *edges[2];
+};
+
+#define DIR_FORWARD             0
+#define DIR_BACKWARD            1
+
+static unsigned int nb_threads = 1;
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "lineage: %s: %s\n", msg, errno ? strerror(errno) : "invalid input");
+	exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+
+	if (!p)
+		die("out of memory");
+	return p;
+}
+
+static int cmp_vertex(const void *a, const void *b)
+{
+	const struct vertex *va = a, *vb = b;
+
+	if (va->id != vb->id)
+		return va->id < vb->id ? -1 : 1;
+	if (va->version != vb->version)
+		return va->version < vb->version ? -1 : 1;
+	return 0;
+}
+
+/* First vertex >= (id, version). */
+static uint64_t lower_bound(const struct vertex *v, uint64_t n, uint64_t id, uint32_t version)
+{
+	struct vertex key = { .id = id, .version = version };
+	uint64_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cmp_vertex(&v[mid], &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void write_all(FILE *f, const void *buf, size_t len)
+{
+	if (len && fwrite(buf, 1, len, f) != len)
+		die("write failed");
+}
+
+/* Build the index from a list of relations; consumes raw. */
+static void build_index(struct raw_edge *raw, uint64_t nb_edges, const char *path)
+{
+	struct index_header header;
+	struct vertex *vertices;
+	uint32_t *src, *dst;
+	uint64_t *offsets, *cursor;
+	struct edge *edges;
+	uint64_t i, n = 0;
+	int d;
+	FILE *f;
+
+	vertices = xmalloc(2 * nb_edges * sizeof(struct vertex));
+	for (i = 0; i < nb_edges; i++) {
+		vertices[2 * i] = raw[i].snd;
+		vertices[2 * i + 1] = raw[i].rcv;
+	}
+	qsort(vertices, 2 * nb_edges, sizeof(struct vertex), cmp_vertex);
+	for (i = 0; i < 2 * nb_edges; i++) {
+		if (!n || cmp_vertex(&vertices[n - 1], &vertices[i]))
+			vertices[n++] = vertices[i];
+	}
+	if (n > UINT32_MAX)
+		die("too many vertices");
+
+	src = xmalloc(nb_edges * sizeof(uint32_t));
+	dst = xmalloc(nb_edges * sizeof(uint32_t));
+	for (i = 0; i < nb_edges; i++) {
+		src[i] = lower_bound(vertices, n, raw[i].snd.id, raw[i].snd.version);
+		dst[i] = lower_bound(vertices, n, raw[i].rcv.id, raw[i].rcv.version);
+	}
+
+	f = fopen(path, "w");
+	if (!f)
+		die(path);
+	memcpy(header.magic, LINEAGE_MAGIC, sizeof(header.magic));
+	header.nb_vertices = n;
+	header.nb_edges = nb_edges;
+	write_all(f, &header, sizeof(header));
+	write_all(f, vertices, n * sizeof(struct vertex));
+
+	offsets = xmalloc((n + 1) * sizeof(uint64_t));
+	cursor = xmalloc(n * sizeof(uint64_t));
+	edges = xmalloc(nb_edges * sizeof(struct edge));
+	for (d = DIR_FORWARD; d <= DIR_BACKWARD; d++) {
+		const uint32_t *from = d == DIR_FORWARD ? src : dst;
+		const uint32_t *to = d == DIR_FORWARD ? dst : src;
+
+		/* counting sort by source vertex */
+		memset(offsets, 0, (n + 1) * sizeof(uint64_t));
+		for (i = 0; i < nb_edges; i++)
+			offsets[from[i] + 1]++;
+		for (i = 0; i < n; i++)
+			offsets[i + 1] += offsets[i];
+		memcpy(cursor, offsets, n * sizeof(uint64_t));
+		for (i = 0; i < nb_edges; i++) {
+			struct edge *e = &edges[cursor[from[i]]++];
+
+			e->target = to[i];
+			e->pad = 0;
+			e->jiffies = raw[i].jiffies;
+		}
+		write_all(f, offsets, (n + 1) * sizeof(uint64_t));
+		write_all(f, edges, nb_edges * sizeof(struct edge));
+	}
+	if (fclose(f))
+		die(path);
+	free(edges);
+	free(cursor);
+	free(offsets);
+	free(dst);
+	free(src);
+	free(vertices);
+}
+
+static struct raw_edge *load_dumps(char **paths, int nb_paths, uint64_t *nb_edges)
+{
+	const union prov_elt *elt;
+	struct raw_edge *raw = NULL;
+	struct prov_map map;
+	uint64_t n = 0, cap = 0;
+	size_t off;
+	int p;
+
+	for (p = 0; p < nb_paths; p++) {
+		/* long records are all nodes */
+		if (prov_is_long_dump(paths[p]))
+			continue;
+		if (prov_map_file(paths[p], &map))
+			die(paths[p]);
+		for (off = 0; off + sizeof(union prov_elt) <= map.size; off += sizeof(union prov_elt)) {
+			elt = (const union prov_elt *)(map.data + off);
+			if (!prov_is_relation(elt))
+				continue;
+			if (n == cap) {
+				cap = cap ? cap * 2 : 1 << 20;
+				raw = realloc(raw, cap * sizeof(struct raw_edge));
+				if (!raw)
+					die("out of memory");
+			}
+			memset(&raw[n], 0, sizeof(raw[n]));
+			raw[n].snd.id = elt->relation_info.snd.node_id.id;
+			raw[n].snd.version = elt->relation_info.snd.node_id.version;
+			raw[n].rcv.id = elt->relation_info.rcv.node_id.id;
+			raw[n].rcv.version = elt->relation_info.rcv.node_id.version;
+			raw[n].jiffies = prov_jiffies(elt);
+			n++;
+		}
+		prov_unmap_file(&map);
+	}
+	*nb_edges = n;
+	return raw;
+}
+
+static void open_index(const char *path, struct lineage_index *idx)
+{
+	const struct index_header *header;
+	const uint8_t *p;
+	uint64_t n, m;
+	int d;
+
+	if (prov_map_file(path, &idx->map))
+		die(path);
+	errno = 0;
+	if (idx->map.size < sizeof(*header))
+		die(path);
+	header = (const struct index_header *)idx->map.data;
+	if (memcmp(header->magic, LINEAGE_MAGIC, sizeof(header->magic)))
+		die(path);
+	n = idx->nb_vertices = header->nb_vertices;
+	m = idx->nb_edges = header->nb_edges;
+	if (idx->map.size != sizeof(*header) + n * sizeof(struct vertex) +
+	    2 * ((n + 1) * sizeof(uint64_t) + m * sizeof(struct edge)))
+		die(path);
+	/* traversals jump around, do not let readahead get in the way */
+	madvise(idx->map.data, idx->map.size, MADV_RANDOM);
+	p = idx->map.data + sizeof(*header);
+	idx->vertices = (const struct vertex *)p;
+	p += n * sizeof(struct vertex);
+	for (d = DIR_FORWARD; d <= DIR_BACKWARD; d++) {
+		idx->offsets[d] = (const uint64_t *)p;
+		p += (n + 1) * sizeof(uint64_t);
+		idx->edges[d] = (const struct edge *)p;
+		p += m * sizeof(struct edge);
+	}
+}
+
+/* Traversal */
+
+struct result {
+	uint32_t vertex;
+	uint32_t depth;
+};
+
+struct traversal {
+	const struct lineage_index *idx;
+	int dir;
+	uint64_t lo;
+	uint64_t hi;
+	uint32_t max_depth;
+	uint64_t *visited;
+	const uint32_t *frontier;
+	uint64_t nb_frontier;
+	uint64_t cursor;
+	uint64_t edges_scanned;
+	bool done;
+	pthread_barrier_t start;
+	pthread_barrier_t end;
+	struct worker {
+		pthread_t thread;
+		struct traversal *t;
+		uint32_t *next;
+		uint64_t nb_next;
+		uint64_t cap;
+		uint64_t scanned;
+	} workers[LINEAGE_MAX_THREADS];
+};
+
+static inline bool mark_visited(uint64_t *visited, uint32_t v)
+{
+	uint64_t bit = 1ULL << (v & 63);
+
+	if (__atomic_load_n(&visited[v >> 6], __ATOMIC_RELAXED) & bit)
+		return false;
+	return !(__atomic_fetch_or(&visited[v >> 6], bit, __ATOMIC_RELAXED) & bit);
+}
+
+static void push_next(struct worker *w, uint32_t v)
+{
+	if (w->nb_next == w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 4096;
+		w->next = realloc(w->next, w->cap * sizeof(uint32_t));
+		if (!w->next)
+			die("out of memory");
+	}
+	w->next[w->nb_next++] = v;
+}
+
+static void expand_level(struct traversal *t, struct worker *w)
+{
+	const uint64_t *offsets = t->idx->offsets[t->dir];
+	const struct edge *edges = t->idx->edges[t->dir];
+	uint64_t b, i, e;
+	uint32_t v;
+
+	for (;;) {
+		b = __atomic_fetch_add(&t->cursor, LINEAGE_BATCH, __ATOMIC_RELAXED);
+		if (b >= t->nb_frontier)
+			break;
+		for (i = b; i < b + LINEAGE_BATCH && i < t->nb_frontier; i++) {
+			v = t->frontier[i];
+			for (e = offsets[v]; e < offsets[v + 1]; e++) {
+				w->scanned++;
+				if (edges[e].jiffies < t->lo || edges[e].jiffies > t->hi)
+					continue;
+				if (mark_visited(t->visited, edges[e].target))
+					push_next(w, edges[e].target);
+			}
+		}
+	}
+}
+
+static void *traversal_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct traversal *t = w->t;
+
+	for (;;) {
+		pthread_barrier_wait(&t->start);
+		if (t->done)
+			break;
+		expand_level(t, w);
+		pthread_barrier_wait(&t->end);
+	}
+	return NULL;
+}
+
+/* Returns the reached vertices (start vertices included, at depth 0). */
+static struct result *traverse(const struct lineage_index *idx, int dir,
+			       const uint32_t *start, uint64_t nb_start,
+			       uint64_t lo, uint64_t hi, uint32_t max_depth,
+			       uint64_t *nb_results, uint64_t *edges_scanned)
+{
+	struct traversal *t = calloc(1, sizeof(*t));
+	struct result *results;
+	uint32_t *frontier;
+	uint64_t i, n = 0, cap, nb_frontier;
+	uint32_t depth = 0;
+	unsigned int w;
+
+	if (!t)
+		die("out of memory");
+	t->idx = idx;
+	t->dir = dir;
+	t->lo = lo;
+	t->hi = hi;
+	t->visited = calloc((idx->nb_vertices + 63) / 64, sizeof(uint64_t));
+	cap = nb_start + 1024;
+	results = xmalloc(cap * sizeof(struct result));
+	frontier = xmalloc((nb_start ? nb_start : 1) * sizeof(uint32_t));
+	if (!t->visited)
+		die("out of memory");
+	nb_frontier = 0;
+	for (i = 0; i < nb_start; i++) {
+		if (!mark_visited(t->visited, start[i]))
+			continue;
+		frontier[nb_frontier++] = start[i];
+		results[n].vertex = start[i];
+		results[n++].depth = 0;
+	}
+
+	pthread_barrier_init(&t->start, NULL, nb_threads);
+	pthread_barrier_init(&t->end, NULL, nb_threads);
+	for (w = 0; w < nb_threads; w++) {
+		t->workers[w].t = t;
+		if (w && pthread_create(&t->workers[w].thread, NULL, traversal_worker, &t->workers[w]))
+			die("cannot start thread");
+	}
+
+	while (nb_frontier && depth < max_depth) {
+		t->frontier = frontier;
+		t->nb_frontier = nb_frontier;
+		t->cursor = 0;
+		for (w = 0; w < nb_threads; w++)
+			t->workers[w].nb_next = 0;
+		pthread_barrier_wait(&t->start);
+		expand_level(t, &t->workers[0]);
+		pthread_barrier_wait(&t->end);
+
+		depth++;
+		nb_frontier = 0;
+		for (w = 0; w < nb_threads; w++)
+			nb_frontier += t->workers[w].nb_next;
+		free(frontier);
+		frontier = xmalloc((nb_frontier ? nb_frontier : 1) * sizeof(uint32_t));
+		if (n + nb_frontier > cap) {
+			cap = (n + nb_frontier) * 2;
+			results = realloc(results, cap * sizeof(struct result));
+			if (!results)
+				die("out of memory");
+		}
+		nb_frontier = 0;
+		for (w = 0; w < nb_threads; w++) {
+			for (i = 0; i < t->workers[w].nb_next; i++) {
+				frontier[nb_frontier++] = t->workers[w].next[i];
+				results[n].vertex = t->workers[w].next[i];
+				results[n++].depth = depth;
+			}
+		}
+	}
+
+	t->done = true;
+	pthread_barrier_wait(&t->start);
+	*edges_scanned = 0;
+	for (w = 0; w < nb_threads; w++) {
+		if (w)
+			pthread_join(t->workers[w].thread, NULL);
+		*edges_scanned += t->workers[w].scanned;
+		free(t->workers[w].next);
+	}
+	pthread_barrier_destroy(&t->start);
+	pthread_barrier_destroy(&t->end);
+	free(frontier);
+	free(t->visited);
+	free(t);
+	*nb_results = n;
+	return results;
+}
+
+/* "id" selects every version, "id:version" a single one. */
+static uint32_t *lookup(const struct lineage_index *idx, const char *arg, uint64_t *nb)
+{
+	const char *sep = strchr(arg, ':');
+	uint64_t id = strtoull(arg, NULL, 0);
+	uint64_t first, last, i;
+	uint32_t *start;
+
+	if (sep) {
+		uint32_t version = strtoul(sep + 1, NULL, 0);
+
+		first = lower_bound(idx->vertices, idx->nb_vertices, id, version);
+		last = first;
+		if (first < idx->nb_vertices && idx->vertices[first].id == id &&
+		    idx->vertices[first].version == version)
+			last = first + 1;
+	} else {
+		first = lower_bound(idx->vertices, idx->nb_vertices, id, 0);
+		for (last = first; last < idx->nb_vertices && idx->vertices[last].id == id; last++)
+			;
+	}
+	*nb = last - first;
+	start = xmalloc((*nb ? *nb : 1) * sizeof(uint32_t));
+	for (i = first; i < last; i++)
+		start[i - first] = i;
+	return start;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s index <index> <dump>...\n", name);
+	fprintf(stderr, "       %s query [-j threads] [-a | -d] [-m depth] [-s jiffies] [-e jiffies] [-c] <index> <id[:version]>\n", name);
+	fprintf(stderr, "       %s bench [-j threads] [-n vertices] [-r edges/vertex] [-q queries] <index>\n", name);
+	fprintf(stderr, "  -a  ancestors, what influenced the vertex (default)\n");
+	fprintf(stderr, "  -d  descendants, what the vertex affected\n");
+	fprintf(stderr, "  -m  maximum depth (default unbounded)\n");
+	fprintf(stderr, "  -s/-e  only follow relations recorded in [start, end] jiffies\n");
+	fprintf(stderr, "  -c  only print the number of vertices reached\n");
+	exit(EXIT_FAILURE);
+}
+
+static int do_index(int argc, char *argv[])
+{
+	struct raw_edge *raw;
+	uint64_t nb_edges;
+	double start;
+
+	if (argc < 3)
+		usage("lineage");
+	start = prov_now();
+	raw = load_dumps(&argv[2], argc - 2, &nb_edges);
+	build_index(raw, nb_edges, argv[1]);
+	free(raw);
+	fprintf(stderr, "lineage: indexed %llu relations in %.3fs\n",
+		(unsigned long long)nb_edges, prov_now() - start);
+	return EXIT_SUCCESS;
+}
+
+static int do_query(int argc, char *argv[])
+{
+	struct lineage_index idx;
+	struct result *results;
+	uint64_t lo = 0, hi = UINT64_MAX;
+	uint64_t nb_start, nb_results, scanned, i;
+	uint32_t max_depth = UINT32_MAX;
+	uint32_t *start;
+	bool count = false;
+	int dir = DIR_BACKWARD;
+	double t;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:adm:s:e:c")) != -1) {
+		switch (opt) {
+		case 'j':
+			nb_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			dir = DIR_BACKWARD;
+			break;
+		case 'd':
+			dir = DIR_FORWARD;
+			break;
+		case 'm':
+			max_depth = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			lo = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			hi = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			count = true;
+			break;
+		default:
+			usage("lineage");
+		}
+	}
+	if (optind != argc - 2 || !nb_threads || nb_threads > LINEAGE_MAX_THREADS)
+		usage("lineage");
+	open_index(argv[optind], &idx);
+	start = lookup(&idx, argv[optind + 1], &nb_start);
+	if (!nb_start) {
+		fprintf(stderr, "lineage: %s not in index\n", argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+	t = prov_now();
+	results = traverse(&idx, dir, start, nb_start, lo, hi, max_depth, &nb_results, &scanned);
+	t = prov_now() - t;
+	if (count) {
+		printf("%llu\n", (unsigned long long)nb_results);
+	} else {
+		for (i = 0; i < nb_results; i++) {
+			const struct vertex *v = &idx.vertices[results[i].vertex];
+
+			printf("%llu:%u %u\n", (unsigned long long)v->id, v->version, results[i].depth);
+		}
+	}
+	fprintf(stderr, "lineage: %llu vertices, %llu relations scanned in %.3fms\n",
+		(unsigned long long)nb_results, (unsigned long long)scanned, t * 1000);
+	free(results);
+	free(start);
+	prov_unmap_file(&idx.map);
+	return EXIT_SUCCESS;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/*
+ * Synthetic graph shaped like a capture: most relations link nearby
+ * identifiers (a process and the objects it touches), a few link far apart
+ * ones, and a quarter of the objects get a new version.
+ */
+static struct raw_edge *synthetic(uint64_t nb_vertices, unsigned int degree, uint64_t *nb_edges)
+{
+	uint64_t m = nb_vertices * degree, i, s = 0x9e3779b97f4a7c15ULL;
+	struct raw_edge *raw = xmalloc(m * sizeof(struct raw_edge));
+
+	for (i = 0; i < m; i++) {
+		uint64_t snd = i / degree;
+		uint64_t rcv = xorshift(&s) % 16 ? snd + 1 + xorshift(&s) % 64 : xorshift(&s) % nb_vertices;
+
+		memset(&raw[i], 0, sizeof(raw[i]));
+		raw[i].snd.id = snd + 1;
+		raw[i].snd.version = xorshift(&s) % 4 == 0;
+		raw[i].rcv.id = (rcv % nb_vertices) + 1;
+		raw[i].rcv.version = xorshift(&s) % 4 == 0;
+		raw[i].jiffies = i;
+	}
+	*nb_edges = m;
+	return raw;
+}
+
+static int do_bench(int argc, char *argv[])
+{
+	struct lineage_index idx;
+	struct raw_edge *raw;
+	struct result *results;
+	uint64_t nb_vertices = 1000000, nb_edges, nb_results, scanned, total_scanned, total_results;
+	unsigned int degree = 8, queries = 20, q, d, threads, max_threads = 1;
+	uint32_t depths[] = { 4, UINT32_MAX };
+	uint64_t s;
+	uint32_t start;
+	double t, build;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:n:r:q:")) != -1) {
+		switch (opt) {
+		case 'j':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nb_vertices = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			degree = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			queries = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage("lineage");
+		}
+	}
+	if (optind != argc - 1 || !max_threads || max_threads > LINEAGE_MAX_THREADS || !nb_vertices || !degree)
+		usage("lineage");
+
+	t = prov_now();
+	raw = synthetic(nb_vertices, degree, &nb_edges);
+	build_index(raw, nb_edges, argv[optind]);
+	free(raw);
+	build = prov_now() - t;
+	open_index(argv[optind], &idx);
+	printf("index: %llu vertices, %llu relations, %.1f MB, built in %.3fs (%.0f relations/s)\n",
+	       (unsigned long long)idx.nb_vertices, (unsigned long long)idx.nb_edges,
+	       idx.map.size / (1024.0 * 1024), build, idx.nb_edges / build);
+
+	for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+		for (threads = 1;; threads = threads * 2 > max_threads ? max_threads : threads * 2) {
+			nb_threads = threads;
+			total_scanned = total_results = 0;
+			s = 42; /* same queries for every thread count */
+			t = prov_now();
+			for (q = 0; q < queries; q++) {
+				start = xorshift(&s) % idx.nb_vertices;
+				results = traverse(&idx, q & 1 ? DIR_FORWARD : DIR_BACKWARD, &start, 1,
+						   0, UINT64_MAX, depths[d], &nb_results, &scanned);
+				total_scanned += scanned;
+				total_results += nb_results;
+				free(results);
+			}
+			t = prov_now() - t;
+			printf("depth %-10s %3u threads: %8.3fms/query %10llu vertices/query %12.0f relations/s\n",
+			       depths[d] == UINT32_MAX ? "unbounded" : "4", threads, t * 1000 / queries,
+			       (unsigned long long)(total_results / queries), total_scanned / t);
+			if (threads == max_threads)
+				break;
+		}
+	}
+	prov_unmap_file(&idx.map);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+		usage(argv[0]);
+	if (!strcmp(argv[1], "index"))
+		return do_index(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "query"))
+		return do_query(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "bench"))
+		return do_bench(argc - 1, argv + 1);
+	usage(argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,319 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Decoder for LZ4 framed relay channels, see include/uapi/linux/provenance_lz4.h,
+ * and benchmark of the CPU versus bytes tradeoff of the relay formats.
+ */
+#define _GNU_SOURCE
+#include "prov_tools.h"
+#include <linux/provenance_compact.h>
+#include <linux/provenance_lz4.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <lz4.h>
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s -d <lz4 dump> <raw out>\n", name);
+	fprintf(stderr, "       %s -e <raw dump> <lz4 out>\n", name);
+	fprintf(stderr, "       %s -b [-r rounds] <raw dump>...\n", name);
+	fprintf(stderr, "  -d  decode a dump read from an LZ4 channel\n");
+	fprintf(stderr, "  -e  frame a raw dump as an LZ4 channel would have\n");
+	fprintf(stderr, "  -b  compare bytes and CPU cost of raw, compact and LZ4 channels\n");
+	fprintf(stderr, "dumps whose name contains \"long\" hold long records\n");
+	exit(EXIT_FAILURE);
+}
+
+static int decode(const char *in, const char *out)
+{
+	char *block = malloc(PROV_LZ4_BLOCK_SIZE);
+	struct prov_lz4_frame frame;
+	uint64_t frames = 0, bytes = 0, lost = 0;
+	size_t off = 0, skipped = 0;
+	struct prov_map map;
+	int size;
+	FILE *fp;
+
+	if (!block)
+		return -1;
+	if (prov_map_file(in, &map)) {
+		fprintf(stderr, "lz4: %s: %s\n", in, strerror(errno));
+		return -1;
+	}
+	fp = fopen(out, "w");
+	if (!fp) {
+		fprintf(stderr, "lz4: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	while (off + sizeof(struct prov_lz4_frame) <= map.size) {
+		memcpy(&frame, map.data + off, sizeof(struct prov_lz4_frame));
+		/* resynchronise on the next frame header */
+		if (frame.magic != PROV_LZ4_MAGIC || frame.version != PROV_LZ4_VERSION
+		    || frame.size > PROV_LZ4_BLOCK_SIZE
+		    || frame.csize > map.size - off - sizeof(struct prov_lz4_frame)) {
+			off++;
+			skipped++;
+			continue;
+		}
+		if (frame.flags & PROV_LZ4_STORED) {
+			if (frame.csize != frame.size) {
+				off++;
+				skipped++;
+				continue;
+			}
+			memcpy(block, map.data + off + sizeof(struct prov_lz4_frame), frame.size);
+			size = frame.size;
+		} else {
+			size = LZ4_decompress_safe((const char *)map.data + off + sizeof(struct prov_lz4_frame),
+						   block, frame.csize, PROV_LZ4_BLOCK_SIZE);
+			if (size != (int)frame.size) {
+				off++;
+				skipped++;
+				continue;
+			}
+		}
+		fwrite(block, 1, size, fp);
+		off += sizeof(struct prov_lz4_frame) + frame.csize;
+		frames++;
+		bytes += size;
+		lost += frame.lost;
+	}
+	prov_unmap_file(&map);
+	free(block);
+	if (fclose(fp)) {
+		fprintf(stderr, "lz4: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	fprintf(stderr, "lz4: %llu frames, %llu bytes decoded, %llu records lost in kernel, %zu bytes skipped\n",
+		(unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)lost, skipped);
+	return 0;
+}
+
+/* Frame a raw dump as an LZ4 channel would have, records are never split across blocks. */
+static int encode(const char *in, const char *out)
+{
+	bool is_long = prov_is_long_dump(in);
+	size_t size = is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+	size_t block = PROV_LZ4_BLOCK_SIZE - PROV_LZ4_BLOCK_SIZE % size;
+	char *buf = malloc(sizeof(struct prov_lz4_frame) + LZ4_COMPRESSBOUND(PROV_LZ4_BLOCK_SIZE));
+	struct prov_lz4_frame *frame = (struct prov_lz4_frame *)buf;
+	struct prov_map map;
+	size_t off, len;
+	int csize;
+	FILE *fp;
+
+	if (!buf)
+		return -1;
+	if (prov_map_file(in, &map)) {
+		fprintf(stderr, "lz4: %s: %s\n", in, strerror(errno));
+		return -1;
+	}
+	fp = fopen(out, "w");
+	if (!fp) {
+		fprintf(stderr, "lz4: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	memset(frame, 0, sizeof(struct prov_lz4_frame));
+	for (off = 0; off + size <= map.size; off += len) {
+		len = map.size - off < block ? map.size - off - (map.size - off) % size : block;
+		frame->magic = PROV_LZ4_MAGIC;
+		frame->version = PROV_LZ4_VERSION;
+		frame->size = len;
+		csize = LZ4_compress_default((const char *)map.data + off, buf + sizeof(struct prov_lz4_frame),
+					     len, LZ4_COMPRESSBOUND(PROV_LZ4_BLOCK_SIZE));
+		if (csize > 0 && (size_t)csize < len) {
+			frame->flags = 0;
+			frame->csize = csize;
+		} else {
+			frame->flags = PROV_LZ4_STORED;
+			frame->csize = len;
+			memcpy(buf + sizeof(struct prov_lz4_frame), map.data + off, len);
+		}
+		fwrite(buf, 1, sizeof(struct prov_lz4_frame) + frame->csize, fp);
+		frame->sequence++;
+	}
+	prov_unmap_file(&map);
+	free(buf);
+	if (fclose(fp)) {
+		fprintf(stderr, "lz4: %s: %s\n", out, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+struct result {
+	const char *name;
+	uint64_t bytes;         // emitted to the relay
+	double encode;          // seconds
+	double decode;          // seconds
+};
+
+/* Compress input in blocks of PROV_LZ4_BLOCK_SIZE as the kernel does, then decompress it. */
+static void bench_lz4(struct result *r, const uint8_t *in, size_t len, size_t record_size,
+		      int acceleration, unsigned int rounds)
+{
+	size_t block = PROV_LZ4_BLOCK_SIZE - PROV_LZ4_BLOCK_SIZE % record_size;
+	char *out = malloc(len / block * LZ4_COMPRESSBOUND(block) + LZ4_COMPRESSBOUND(block)
+			   + (len / block + 1) * sizeof(struct prov_lz4_frame));
+	char *dec = malloc(PROV_LZ4_BLOCK_SIZE);
+	int csizes[len / block + 1];
+	size_t off, n, o;
+	unsigned int i;
+	double t;
+
+	if (!out || !dec)
+		exit(EXIT_FAILURE);
+	t = prov_now();
+	for (i = 0; i < rounds; i++) {
+		for (off = 0, o = 0, n = 0; off < len; off += block, n++) {
+			csizes[n] = LZ4_compress_fast((const char *)in + off, out + o + sizeof(struct prov_lz4_frame),
+						      len - off < block ? len - off : block,
+						      LZ4_COMPRESSBOUND(block), acceleration);
+			o += sizeof(struct prov_lz4_frame) + csizes[n];
+		}
+	}
+	r->encode += (prov_now() - t) / rounds;
+	r->bytes = o;
+	t = prov_now();
+	for (i = 0; i < rounds; i++) {
+		for (off = 0, o = 0, n = 0; off < len; off += block, n++) {
+			if (LZ4_decompress_safe(out + o + sizeof(struct prov_lz4_frame), dec, csizes[n], PROV_LZ4_BLOCK_SIZE) < 0)
+				exit(EXIT_FAILURE);
+			o += sizeof(struct prov_lz4_frame) + csizes[n];
+		}
+	}
+	r->decode = (prov_now() - t) / rounds;
+	free(out);
+	free(dec);
+}
+
+/* Encode records in the compact format, headers included, as the kernel does. */
+static size_t encode_compact(const uint8_t *in, size_t len, size_t record_size, bool is_long, uint8_t *out)
+{
+	const union long_prov_elt *elt;
+	struct prov_compact_state state;
+	size_t off, n, o = 0, subbuf = 0;
+
+	for (off = 0; off + record_size <= len; off += record_size) {
+		elt = (const union long_prov_elt *)(in + off);
+		/* conservative: a new sub-buffer whenever the largest record may not fit */
+		if (!subbuf || subbuf + PROV_COMPACT_MAX_SIZE > (1 << 20)) {
+			prov_compact_reset(&state, node_identifier(elt).boot_id, node_identifier(elt).machine_id);
+			prov_compact_write_header(out + o, &state, 0);
+			o += sizeof(struct prov_compact_header);
+			subbuf = sizeof(struct prov_compact_header);
+		}
+		n = prov_compact_encode(&state, elt, is_long, out + o);
+		o += n;
+		subbuf += n;
+	}
+	return o;
+}
+
+static int bench(const char *path, unsigned int rounds)
+{
+	bool is_long = prov_is_long_dump(path);
+	size_t size = is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+	struct result res[5];
+	struct prov_map map;
+	uint8_t *compact;
+	size_t len, clen = 0, nb, i;
+	unsigned int r;
+	double t;
+
+	if (prov_map_file(path, &map)) {
+		fprintf(stderr, "lz4: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	len = map.size - map.size % size;
+	nb = len / size;
+	if (!nb) {
+		prov_unmap_file(&map);
+		return 0;
+	}
+	compact = malloc(len + nb * (PROV_COMPACT_MAX_SIZE - sizeof(union long_prov_elt)) + (len >> 20) * 64 + 64);
+	if (!compact)
+		exit(EXIT_FAILURE);
+	memset(res, 0, sizeof(res));
+
+	res[0].name = "raw";
+	res[0].bytes = len;
+
+	res[1].name = "compact";
+	t = prov_now();
+	for (r = 0; r < rounds; r++)
+		clen = encode_compact(map.data, len, size, is_long, compact);
+	res[1].encode = (prov_now() - t) / rounds;
+	res[1].bytes = clen;
+
+	res[2].name = "lz4";
+	bench_lz4(&res[2], map.data, len, size, 1, rounds);
+	res[3].name = "lz4 accel 8";
+	bench_lz4(&res[3], map.data, len, size, 8, rounds);
+	/* for reference only, no channel does both: the encoding cost adds up */
+	res[4].name = "compact+lz4";
+	bench_lz4(&res[4], compact, clen, 1, 1, rounds);
+	res[4].encode += res[1].encode;
+
+	printf("%s: %zu records, %.1f MB raw\n", path, nb, len / (1024.0 * 1024));
+	printf("  %-12s %12s %8s %10s %14s %14s\n", "format", "bytes/record", "ratio", "MB out", "encode ns/rec", "decode ns/rec");
+	for (i = 0; i < sizeof(res) / sizeof(res[0]); i++)
+		printf("  %-12s %12.1f %7.2fx %10.1f %14.1f %14.1f\n", res[i].name,
+		       (double)res[i].bytes / nb, (double)len / res[i].bytes, res[i].bytes / (1024.0 * 1024),
+		       res[i].encode * 1e9 / nb, res[i].decode * 1e9 / nb);
+	free(compact);
+	prov_unmap_file(&map);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int rounds = 3;
+	int opt, i, mode = 0, rc = 0;
+
+	while ((opt = getopt(argc, argv, "debr:")) != -1) {
+		switch (opt) {
+		case 'd':
+		case 'e':
+		case 'b':
+			mode = opt;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			if (!rounds)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	switch (mode) {
+	case 'd':
+		if (argc - optind != 2)
+			usage(argv[0]);
+		return decode(argv[optind], argv[optind + 1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+	case 'e':
+		if (argc - optind != 2)
+			usage(argv[0]);
+		return encode(argv[optind], argv[optind + 1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+	case 'b':
+		if (optind == argc)
+			usage(argv[0]);
+		for (i = optind; i < argc; i++)
+			rc |= bench(argv[i], rounds);
+		return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+	default:
+		usage(argv[0]);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Compiler and loader of the path patterns matched in the kernel, see struct prov_pattern.
+ *
+ * A pattern is written on one line as:
+ *   <id> <action> <node> [<relation> <node>]...
+ * action:   warn, prevent, warn+prevent, or count (matches are only counted)
+ * node:     <type>[{<predicate>,...}]
+ *           type is a node type name (e.g., file, process_memory), entity, activity, agent or *
+ *           predicate is tracked, uid=<n>, gid=<n> or taint=<n>
+ * relation: -<type>-> where type is a relation type name (e.g., read), used, generated, informed or derived,
+ *           or -> for any relation
+ * Relations go the way information flows: used from an entity to an activity (e.g., file -read-> task),
+ * generated from an activity to an entity, informed between activities and derived between entities.
+ * A relation whose end points can never be of the kinds of the nodes around it is rejected.
+ * e.g., "1 warn file{taint=42} -read-> task{tracked} -send-> socket"
+ *       "2 count file{taint=42} -read-> task -memory_write-> process_memory -memory_read-> task -write-> file"
+ */
+#define _GNU_SOURCE
+#include "prov_tools.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+
+struct category {
+	const char *name;
+	uint64_t type;
+};
+
+static const struct category node_categories[] = {
+	{ "*",          0 },
+	{ "entity",     DM_ENTITY },
+	{ "activity",   DM_ACTIVITY },
+	{ "agent",      DM_AGENT },
+	{ NULL,         0 },
+};
+
+static const struct category relation_categories[] = {
+	{ "",           0 },
+	{ "used",       RL_USED },
+	{ "generated",  RL_GENERATED },
+	{ "informed",   RL_INFORMED },
+	{ "derived",    RL_DERIVED },
+	{ NULL,         0 },
+};
+
+/* Kinds of the end points of the relations of a category, as the kernel records them. */
+struct endpoints {
+	uint64_t relation;
+	uint64_t from;
+	uint64_t to;
+};
+
+static const struct endpoints relation_endpoints[] = {
+	{ RL_USED,      DM_ENTITY,      DM_ACTIVITY },
+	{ RL_GENERATED, DM_ACTIVITY,    DM_ENTITY },
+	{ RL_INFORMED,  DM_ACTIVITY,    DM_ACTIVITY },
+	{ RL_DERIVED,   DM_ENTITY,      DM_ENTITY },
+	{ 0,            0,              0 },
+};
+
+#define NODE_KINDS      (DM_ENTITY | DM_ACTIVITY | DM_AGENT)
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n] <pattern>...\n", name);
+	fprintf(stderr, "       %s [-n] -f <file>\n", name);
+	fprintf(stderr, "       %s -d <id>\n", name);
+	fprintf(stderr, "       %s -l\n", name);
+	fprintf(stderr, "  -n  compile and print the patterns without loading them\n");
+	fprintf(stderr, "  -f  load the patterns of a file, one per line, '#' starts a comment\n");
+	fprintf(stderr, "  -d  delete a pattern\n");
+	fprintf(stderr, "  -l  list the patterns loaded and their number of matches\n");
+	fprintf(stderr, "pattern: <id> <action> <node> [<relation> <node>]..., see %s\n", __FILE__);
+	exit(EXIT_FAILURE);
+}
+
+static bool category_type(const struct category *c, const char *name, uint64_t *type)
+{
+	for (; c->name; c++) {
+		if (strcmp(c->name, name) == 0) {
+			*type = c->type;
+			return true;
+		}
+	}
+	return false;
+}
+
+static const char *category_str(const struct category *c, uint64_t type)
+{
+	for (; c->name; c++) {
+		if (c->type == type)
+			return c->name;
+	}
+	return NULL;
+}
+
+static int parse_uint(const char *s, uint64_t *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoull(s, &end, 0);
+	return (errno || end == s || *end != '\0') ? -1 : 0;
+}
+
+static int parse_predicate(char *pred, struct prov_pattern_step *step)
+{
+	char *value = strchr(pred, '=');
+	uint64_t val;
+
+	if (!value) {
+		if (strcmp(pred, "tracked"))
+			return -1;
+		step->match |= PROV_MATCH_TRACKED;
+		return 0;
+	}
+	*value++ = '\0';
+	if (parse_uint(value, &val))
+		return -1;
+	if (strcmp(pred, "uid") == 0) {
+		step->uid = val;
+		step->match |= PROV_MATCH_UID;
+	} else if (strcmp(pred, "gid") == 0) {
+		step->gid = val;
+		step->match |= PROV_MATCH_GID;
+	} else if (strcmp(pred, "taint") == 0) {
+		step->taint = val;
+		step->match |= PROV_MATCH_TAINT;
+	} else
+		return -1;
+	return 0;
+}
+
+static int parse_node(char *tok, struct prov_pattern_step *step)
+{
+	char *preds = strchr(tok, '{');
+	char *pred, *save;
+	size_t len;
+
+	if (preds) {
+		len = strlen(preds);
+		if (len < 2 || preds[len - 1] != '}')
+			return -1;
+		preds[len - 1] = '\0';
+		*preds++ = '\0';
+		for (pred = strtok_r(preds, ",", &save); pred; pred = strtok_r(NULL, ",", &save)) {
+			if (parse_predicate(pred, step))
+				return -1;
+		}
+	}
+	if (category_type(node_categories, tok, &step->node))
+		return 0;
+	step->node = node_id(tok);
+	return step->node ? 0 : -1;
+}
+
+static int parse_relation(char *tok, struct prov_pattern_step *step)
+{
+	size_t len = strlen(tok);
+
+	if (strcmp(tok, "->") == 0) {
+		step->relation = 0;
+		return 0;
+	}
+	if (len < 3 || tok[0] != '-' || strcmp(tok + len - 2, "->"))
+		return -1;
+	tok[len - 2] = '\0';
+	tok++;
+	if (category_type(relation_categories, tok, &step->relation))
+		return 0;
+	step->relation = relation_id(tok);
+	return step->relation ? 0 : -1;
+}
+
+/*
+ * Whether a relation can lead from a node of the kind of from to one of the kind of to.
+ * The names of process memory and the summaries of rate limited flows and of threads are used,
+ * but received by process memory, an entity; a used category may end on either.
+ */
+static bool relation_fits(uint64_t relation, uint64_t from, uint64_t to)
+{
+	const struct endpoints *e;
+	uint64_t to_kinds;
+
+	if (!relation)
+		return true;
+	from &= NODE_KINDS;
+	to &= NODE_KINDS;
+	for (e = relation_endpoints; e->relation; e++) {
+		if ((relation & e->relation) != e->relation)
+			continue;
+		to_kinds = e->to;
+		if (relation == RL_NAMED_PROCESS || relation == RL_AGGREGATE || relation == RL_AGGREGATE_THREADS)
+			to_kinds = DM_ENTITY;
+		else if (relation == RL_USED)
+			to_kinds |= DM_ENTITY;
+		return (!from || (from & e->from)) && (!to || (to & to_kinds));
+	}
+	return true;
+}
+
+static int parse_action(const char *tok, uint8_t *action)
+{
+	if (strcmp(tok, "count") == 0)
+		*action = 0;
+	else if (strcmp(tok, "warn") == 0)
+		*action = PROV_PATTERN_WARN;
+	else if (strcmp(tok, "prevent") == 0)
+		*action = PROV_PATTERN_PREVENT;
+	else if (strcmp(tok, "warn+prevent") == 0)
+		*action = PROV_PATTERN_WARN | PROV_PATTERN_PREVENT;
+	else
+		return -1;
+	return 0;
+}
+
+static int compile(char *line, struct prov_pattern *pattern)
+{
+	struct prov_pattern_step *step;
+	char *tok, *save;
+	uint64_t id;
+	int i;
+
+	memset(pattern, 0, sizeof(struct prov_pattern));
+	tok = strtok_r(line, " \t\n", &save);
+	if (!tok || parse_uint(tok, &id) || id > UINT32_MAX)
+		return -1;
+	pattern->id = id;
+	tok = strtok_r(NULL, " \t\n", &save);
+	if (!tok || parse_action(tok, &pattern->action))
+		return -1;
+	for (i = 0; (tok = strtok_r(NULL, " \t\n", &save)); i++) {
+		if (pattern->length == PROV_PATTERN_MAX_STEPS)
+			return -1;
+		step = &pattern->steps[pattern->length];
+		if (i % 2 == 0) {
+			if (parse_node(tok, step))
+				return -1;
+			pattern->length++;
+		} else if (parse_relation(tok, step)) {
+			return -1;
+		}
+	}
+	/* a pattern ends on a node, and has at least one relation */
+	if (pattern->length < 2 || i % 2 == 0)
+		return -1;
+	for (i = 1; i < pattern->length; i++) {
+		step = &pattern->steps[i];
+		if (!relation_fits(step->relation, pattern->steps[i - 1].node, step->node)) {
+			fprintf(stderr, "pattern: step %d: relation %s never leads from %s to %s\n", i,
+				category_str(relation_categories, step->relation) ? : relation_str(step->relation),
+				category_str(node_categories, pattern->steps[i - 1].node) ? : node_str(pattern->steps[i - 1].node),
+				category_str(node_categories, step->node) ? : node_str(step->node));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void print_step(FILE *fp, const struct prov_pattern_step *step)
+{
+	const char *sep = "{";
+	const char *name;
+
+	name = category_str(node_categories, step->node);
+	fprintf(fp, "%s", name ? name : node_str(step->node));
+	if (step->match & PROV_MATCH_TRACKED) {
+		fprintf(fp, "%stracked", sep);
+		sep = ",";
+	}
+	if (step->match & PROV_MATCH_UID) {
+		fprintf(fp, "%suid=%u", sep, step->uid);
+		sep = ",";
+	}
+	if (step->match & PROV_MATCH_GID) {
+		fprintf(fp, "%sgid=%u", sep, step->gid);
+		sep = ",";
+	}
+	if (step->match & PROV_MATCH_TAINT) {
+		fprintf(fp, "%staint=%llu", sep, (unsigned long long)step->taint);
+		sep = ",";
+	}
+	if (sep[0] == ',')
+		fprintf(fp, "}");
+}
+
+static void print_pattern(FILE *fp, const struct prov_pattern *pattern, bool matches)
+{
+	static const char * const actions[] = { "count", "warn", "prevent", "warn+prevent" };
+	const char *name;
+	int i;
+
+	fprintf(fp, "%u %s ", pattern->id, actions[pattern->action & 3]);
+	for (i = 0; i < pattern->length && i < PROV_PATTERN_MAX_STEPS; i++) {
+		if (i > 0 && !pattern->steps[i].relation) {
+			fprintf(fp, " -> ");
+		} else if (i > 0) {
+			name = category_str(relation_categories, pattern->steps[i].relation);
+			fprintf(fp, " -%s-> ", name ? name : relation_str(pattern->steps[i].relation));
+		}
+		print_step(fp, &pattern->steps[i]);
+	}
+	if (matches)
+		fprintf(fp, "  # %llu matches", (unsigned long long)pattern->matches);
+	fprintf(fp, "\n");
+}
+
+static int write_pattern(const struct prov_pattern *pattern)
+{
+	int fd = open(PROV_PATTERN_FILE, O_WRONLY);
+	ssize_t rc;
+
+	if (fd < 0) {
+		fprintf(stderr, "pattern: %s: %s\n", PROV_PATTERN_FILE, strerror(errno));
+		return -1;
+	}
+	rc = write(fd, pattern, sizeof(struct prov_pattern));
+	if (rc < 0)
+		fprintf(stderr, "pattern: %u: %s\n", pattern->id, strerror(errno));
+	close(fd);
+	return rc < 0 ? -1 : 0;
+}
+
+static int load(char *line, bool dry_run)
+{
+	struct prov_pattern pattern;
+	char *copy = strdup(line);
+	int rc;
+
+	if (!copy)
+		return -1;
+	rc = compile(copy, &pattern);
+	free(copy);
+	if (rc) {
+		fprintf(stderr, "pattern: invalid pattern: %s\n", line);
+		return -1;
+	}
+	if (dry_run) {
+		print_pattern(stdout, &pattern, false);
+		return 0;
+	}
+	return write_pattern(&pattern);
+}
+
+static int load_file(const char *path, bool dry_run)
+{
+	char *line = NULL, *comment;
+	size_t size = 0;
+	int rc = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		fprintf(stderr, "pattern: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (getline(&line, &size, fp) != -1) {
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+		line[strcspn(line, "\n")] = '\0';
+		if (line[strspn(line, " \t")] == '\0')
+			continue;
+		rc |= load(line, dry_run);
+	}
+	free(line);
+	fclose(fp);
+	return rc;
+}
+
+static int delete(const char *arg)
+{
+	struct prov_pattern pattern;
+	uint64_t id;
+
+	if (parse_uint(arg, &id) || id > UINT32_MAX) {
+		fprintf(stderr, "pattern: invalid id: %s\n", arg);
+		return -1;
+	}
+	memset(&pattern, 0, sizeof(struct prov_pattern));
+	pattern.id = id;
+	pattern.op = PROV_SET_DELETE;
+	return write_pattern(&pattern);
+}
+
+static int list(void)
+{
+	struct prov_pattern *patterns = NULL, *tmp;
+	size_t i, n = 16;
+	ssize_t rc;
+	int fd;
+
+	fd = open(PROV_PATTERN_FILE, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "pattern: %s: %s\n", PROV_PATTERN_FILE, strerror(errno));
+		return -1;
+	}
+	/* the kernel refuses to return part of the list, retry with more room */
+	do {
+		n *= 2;
+		tmp = realloc(patterns, n * sizeof(struct prov_pattern));
+		if (!tmp) {
+			rc = -1;
+			break;
+		}
+		patterns = tmp;
+		rc = pread(fd, patterns, n * sizeof(struct prov_pattern), 0);
+	} while (rc < 0 && errno == ENOMEM);
+	close(fd);
+	if (rc < 0)
+		fprintf(stderr, "pattern: %s: %s\n", PROV_PATTERN_FILE, strerror(errno));
+	for (i = 0; rc > 0 && i < rc / sizeof(struct prov_pattern); i++)
+		print_pattern(stdout, &patterns[i], true);
+	free(patterns);
+	return rc < 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *file = NULL;
+	bool dry_run = false;
+	int opt, i, rc = 0;
+
+	while ((opt = getopt(argc, argv, "nf:d:l")) != -1) {
+		switch (opt) {
+		case 'n':
+			dry_run = true;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'd':
+			return delete(optarg) ? EXIT_FAILURE : EXIT_SUCCESS;
+		case 'l':
+			return list() ? EXIT_FAILURE : EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (file)
+		return load_file(file, dry_run) ? EXIT_FAILURE : EXIT_SUCCESS;
+	if (optind == argc)
+		usage(argv[0]);
+	for (i = optind; i < argc; i++)
+		rc |= load(argv[i], dry_run);
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
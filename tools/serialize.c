@@ -0,0 +1,325 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Convert relay dumps to PROV-JSON or CBOR, or benchmark the serializer.
+ */
+#define _GNU_SOURCE
+#include "prov_serializer.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+
+static int sink_stdout(void *ctx, const uint8_t *buf, size_t len)
+{
+	return fwrite(buf, 1, len, stdout) == len ? 0 : -1;
+}
+
+static int sink_discard(void *ctx, const uint8_t *buf, size_t len)
+{
+	/* keep the compiler from eliding the work */
+	*(volatile uint8_t *)ctx ^= buf[len - 1];
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f json|cbor] [-S] [-z] <dump>...\n", name);
+	fprintf(stderr, "       %s -b [-f json|cbor] [-r rounds] [<dump>...]\n", name);
+	fprintf(stderr, "  -S  disable the vectorized string paths\n");
+	fprintf(stderr, "  -z  dumps come from sized channels, records are record_size long\n");
+	fprintf(stderr, "  -b  benchmark, on the given dumps or on synthetic string-heavy records\n");
+	fprintf(stderr, "dumps whose name contains \"long\" hold long records\n");
+	exit(EXIT_FAILURE);
+}
+
+static int serialize_sized_dump(struct prov_writer *w, const struct prov_map *map, bool is_long)
+{
+	union long_prov_elt *elt = malloc(sizeof(union long_prov_elt));
+	size_t size, off;
+
+	if (!elt)
+		return -1;
+	for (off = 0; (size = prov_read_sized(map, off, elt)) && !w->error; off += size) {
+		if (is_long)
+			prov_write_long_elt(w, elt);
+		else
+			prov_write_elt(w, (const union prov_elt *)elt);
+	}
+	free(elt);
+	return w->error;
+}
+
+static int serialize_dump(struct prov_writer *w, const char *path, bool sized)
+{
+	struct prov_map map;
+	size_t size, off;
+	int rc;
+	bool is_long = prov_is_long_dump(path);
+
+	if (prov_map_file(path, &map)) {
+		fprintf(stderr, "serialize: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (sized) {
+		rc = serialize_sized_dump(w, &map, is_long);
+		prov_unmap_file(&map);
+		return rc;
+	}
+	size = is_long ? sizeof(union long_prov_elt) : sizeof(union prov_elt);
+	for (off = 0; off + size <= map.size && !w->error; off += size) {
+		if (is_long)
+			prov_write_long_elt(w, (const union long_prov_elt *)(map.data + off));
+		else
+			prov_write_elt(w, (const union prov_elt *)(map.data + off));
+	}
+	prov_unmap_file(&map);
+	return w->error;
+}
+
+struct corpus {
+	uint8_t *data;
+	size_t size;
+	size_t nb;
+	size_t nb_long;
+	size_t long_offset;     // regular records first, long ones after
+};
+
+static void load_corpus(struct corpus *c, char **paths, int nb_paths)
+{
+	struct prov_map map;
+	size_t size = 0, reg = 0;
+	uint8_t *p;
+	int i, pass;
+
+	memset(c, 0, sizeof(*c));
+	/* two passes: regular dumps first, then long ones */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nb_paths; i++) {
+			if (prov_is_long_dump(paths[i]) != pass)
+				continue;
+			if (prov_map_file(paths[i], &map))
+				continue;
+			p = realloc(c->data, size + map.size);
+			if (!p)
+				exit(EXIT_FAILURE);
+			c->data = p;
+			memcpy(c->data + size, map.data, map.size);
+			size += map.size;
+			prov_unmap_file(&map);
+		}
+		if (!pass)
+			reg = size;
+	}
+	c->long_offset = reg - reg % sizeof(union prov_elt);
+	c->nb = c->long_offset / sizeof(union prov_elt);
+	c->nb_long = (size - reg) / sizeof(union long_prov_elt);
+	c->size = c->long_offset + c->nb_long * sizeof(union long_prov_elt);
+	if (reg != c->long_offset) {
+		memmove(c->data + c->long_offset, c->data + reg, c->nb_long * sizeof(union long_prov_elt));
+	}
+}
+
+/* Paths, arguments and logs with the occasional quote, tab and UTF-8 name. */
+static void synthetic_corpus(struct corpus *c, size_t nb)
+{
+	static const char *words[] = {
+		"usr", "lib", "x86_64-linux-gnu", "share", "locale", "home", "alice",
+		"Документы", "résumé", "config", "\"quoted\"", "tab\there", "camflow",
+		"provenance", "node_modules", "site-packages", "写真", "build",
+	};
+	union long_prov_elt *elt;
+	uint64_t s = 0x2545f4914f6cdd1dULL;
+	size_t i, len;
+	char *str;
+
+	memset(c, 0, sizeof(*c));
+	c->nb_long = nb;
+	c->size = nb * sizeof(union long_prov_elt);
+	c->data = calloc(nb, sizeof(union long_prov_elt));
+	if (!c->data)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < nb; i++) {
+		elt = (union long_prov_elt *)c->data + i;
+		switch (i % 3) {
+		case 0:
+			node_identifier(elt).type = ENT_PATH;
+			str = elt->file_name_info.name;
+			break;
+		case 1:
+			node_identifier(elt).type = ENT_ARG;
+			str = elt->arg_info.value;
+			break;
+		default:
+			node_identifier(elt).type = ENT_STR;
+			str = elt->str_info.str;
+			break;
+		}
+		node_identifier(elt).id = i + 1;
+		node_identifier(elt).boot_id = 7;
+		node_identifier(elt).machine_id = 0xdeadbeef;
+		prov_jiffies(elt) = 4294000000ULL + i;
+		/* 100 to 1000 bytes, typical of paths and command lines */
+		len = 100 + (s % 900);
+		for (str[0] = '\0'; strlen(str) < len;) {
+			s ^= s << 13;
+			s ^= s >> 7;
+			s ^= s << 17;
+			strcat(str, "/");
+			strcat(str, words[s % (sizeof(words) / sizeof(words[0]))]);
+		}
+		elt->file_name_info.length = strlen(str);
+	}
+}
+
+static double bench_run(const struct corpus *c, int format, bool scalar, unsigned int rounds, uint64_t *out_bytes)
+{
+	struct prov_writer w;
+	volatile uint8_t sink = 0;
+	unsigned int r;
+	size_t i;
+	double t;
+
+	if (prov_writer_init(&w, format, sink_discard, (void *)&sink))
+		exit(EXIT_FAILURE);
+	w.scalar = scalar;
+	t = prov_now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < c->nb; i++)
+			prov_write_elt(&w, (const union prov_elt *)c->data + i);
+		for (i = 0; i < c->nb_long; i++)
+			prov_write_long_elt(&w, (const union long_prov_elt *)(c->data + c->long_offset) + i);
+	}
+	prov_writer_flush(&w);
+	t = prov_now() - t;
+	*out_bytes = w.bytes;
+	prov_writer_free(&w);
+	return t;
+}
+
+static void bench_strings(const struct corpus *c, unsigned int rounds)
+{
+	uint8_t *out = malloc(PATH_MAX * 6);
+	uint64_t bytes = 0, sum = 0;
+	const union long_prov_elt *elt;
+	unsigned int r, scalar;
+	size_t i, len;
+	double t;
+
+	if (!out)
+		exit(EXIT_FAILURE);
+	for (scalar = 0; scalar < 2; scalar++) {
+		bytes = 0;
+		t = prov_now();
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < c->nb_long; i++) {
+				elt = (const union long_prov_elt *)(c->data + c->long_offset) + i;
+				len = strnlen(elt->str_info.str, PATH_MAX);
+				sum += prov_json_escape(out, (const uint8_t *)elt->str_info.str, len, scalar);
+				bytes += len;
+			}
+		}
+		t = prov_now() - t;
+		printf("json escape     %-7s %10.1f MB/s\n", scalar ? "scalar" : "simd", bytes / t / (1024 * 1024));
+		t = prov_now();
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < c->nb_long; i++) {
+				elt = (const union long_prov_elt *)(c->data + c->long_offset) + i;
+				len = strnlen(elt->str_info.str, PATH_MAX);
+				sum += prov_utf8_valid((const uint8_t *)elt->str_info.str, len, scalar);
+			}
+		}
+		t = prov_now() - t;
+		printf("utf-8 validate  %-7s %10.1f MB/s\n", scalar ? "scalar" : "simd", bytes / t / (1024 * 1024));
+	}
+	if (!sum)
+		printf("\n");
+	free(out);
+}
+
+static int bench(char **paths, int nb_paths, int format, unsigned int rounds)
+{
+	struct corpus c;
+	uint64_t out;
+	double t;
+	int scalar;
+
+	if (nb_paths)
+		load_corpus(&c, paths, nb_paths);
+	else
+		synthetic_corpus(&c, 100000);
+	if (!c.nb && !c.nb_long) {
+		fprintf(stderr, "serialize: no records to benchmark\n");
+		return EXIT_FAILURE;
+	}
+	printf("%zu records, %zu long records, %.1f MB in, format %s, %u rounds\n",
+	       c.nb, c.nb_long, c.size / (1024.0 * 1024), format == PROV_FORMAT_CBOR ? "cbor" : "json", rounds);
+	for (scalar = 0; scalar < 2; scalar++) {
+		t = bench_run(&c, format, scalar, rounds, &out);
+		printf("serialize       %-7s %10.1f MB/s in %10.1f MB/s out %12.0f records/s\n",
+		       scalar ? "scalar" : "simd", c.size * (double)rounds / t / (1024 * 1024),
+		       out / t / (1024 * 1024), (c.nb + c.nb_long) * (double)rounds / t);
+	}
+	if (c.nb_long)
+		bench_strings(&c, rounds);
+	free(c.data);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	struct prov_writer w;
+	int format = PROV_FORMAT_JSON;
+	unsigned int rounds = 5;
+	bool scalar = false, do_bench = false, sized = false;
+	int opt, i, rc = 0;
+
+	while ((opt = getopt(argc, argv, "f:Szbr:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				format = PROV_FORMAT_JSON;
+			else if (!strcmp(optarg, "cbor"))
+				format = PROV_FORMAT_CBOR;
+			else
+				usage(argv[0]);
+			break;
+		case 'S':
+			scalar = true;
+			break;
+		case 'z':
+			sized = true;
+			break;
+		case 'b':
+			do_bench = true;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			if (!rounds)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (do_bench)
+		return bench(&argv[optind], argc - optind, format, rounds);
+	if (optind == argc)
+		usage(argv[0]);
+	if (prov_writer_init(&w, format, sink_stdout, NULL))
+		return EXIT_FAILURE;
+	w.scalar = scalar;
+	for (i = optind; i < argc && !rc; i++)
+		rc = serialize_dump(&w, argv[i], sized);
+	rc |= prov_writer_flush(&w);
+	prov_writer_free(&w);
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,738 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * String-heavy long records dominate serialization cost, so JSON escaping and
+ * UTF-8 validation look at 16 bytes at a time (SSE2) and only drop to the
+ * byte-by-byte path around characters that need attention.
+ */
+#include "prov_serializer.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PROV_PREFIX_CF          "https://github.com/CamFlow"
+
+/* Largest single emit: an escaped PATH_MAX string, worst case \uXXXX per byte. */
+#define MAX_EMIT                (PATH_MAX * 6 + 64)
+
+/* "cf:" + base64 identifier + NUL */
+#define IDENTIFIER_NAME_SIZE    (3 + (PROV_IDENTIFIER_BUFFER_LENGTH + 2) / 3 * 4 + 1)
+
+static const char b64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int prov_writer_init(struct prov_writer *w, int format, prov_sink_t sink, void *ctx)
+{
+	memset(w, 0, sizeof(*w));
+	w->format = format;
+	w->sink = sink;
+	w->ctx = ctx;
+	w->buf = malloc(PROV_WRITER_BUFFER);
+	if (!w->buf)
+		return -1;
+	return 0;
+}
+
+void prov_writer_free(struct prov_writer *w)
+{
+	free(w->buf);
+	w->buf = NULL;
+}
+
+int prov_writer_flush(struct prov_writer *w)
+{
+	if (w->len && !w->error) {
+		if (w->sink(w->ctx, w->buf, w->len))
+			w->error = -1;
+		w->bytes += w->len;
+	}
+	w->len = 0;
+	return w->error;
+}
+
+static inline uint8_t *reserve(struct prov_writer *w, size_t n)
+{
+	if (w->len + n > PROV_WRITER_BUFFER)
+		prov_writer_flush(w);
+	return w->buf + w->len;
+}
+
+static inline void emit(struct prov_writer *w, const void *data, size_t n)
+{
+	memcpy(reserve(w, n), data, n);
+	w->len += n;
+}
+
+static inline void emit_byte(struct prov_writer *w, uint8_t c)
+{
+	*reserve(w, 1) = c;
+	w->len++;
+}
+
+/* UTF-8 */
+
+/* Length of the valid sequence starting at in, 0 if invalid. */
+static inline size_t utf8_sequence(const uint8_t *in, size_t len)
+{
+	uint8_t c = in[0];
+
+	if (c < 0x80)
+		return 1;
+	if (c >= 0xc2 && c <= 0xdf) {
+		if (len >= 2 && (in[1] & 0xc0) == 0x80)
+			return 2;
+		return 0;
+	}
+	if (c >= 0xe0 && c <= 0xef) {
+		if (len < 3 || (in[1] & 0xc0) != 0x80 || (in[2] & 0xc0) != 0x80)
+			return 0;
+		if (c == 0xe0 && in[1] < 0xa0)         // overlong
+			return 0;
+		if (c == 0xed && in[1] > 0x9f)         // surrogates
+			return 0;
+		return 3;
+	}
+	if (c >= 0xf0 && c <= 0xf4) {
+		if (len < 4 || (in[1] & 0xc0) != 0x80 || (in[2] & 0xc0) != 0x80 || (in[3] & 0xc0) != 0x80)
+			return 0;
+		if (c == 0xf0 && in[1] < 0x90)         // overlong
+			return 0;
+		if (c == 0xf4 && in[1] > 0x8f)         // above U+10FFFF
+			return 0;
+		return 4;
+	}
+	return 0;
+}
+
+bool prov_utf8_valid(const uint8_t *in, size_t len, bool scalar)
+{
+	size_t i = 0, n;
+
+#ifdef __SSE2__
+	if (!scalar) {
+		while (i + 16 <= len) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+
+			if (!_mm_movemask_epi8(v)) {
+				i += 16;
+				continue;
+			}
+			/* skip the ASCII prefix, then one multibyte sequence */
+			i += __builtin_ctz(_mm_movemask_epi8(v));
+			n = utf8_sequence(in + i, len - i);
+			if (!n)
+				return false;
+			i += n;
+		}
+	}
+#endif
+	while (i < len) {
+		n = utf8_sequence(in + i, len - i);
+		if (!n)
+			return false;
+		i += n;
+	}
+	return true;
+}
+
+/* JSON escaping */
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Escape one character that is not plain printable ASCII; returns bytes consumed. */
+static inline size_t escape_one(uint8_t **outp, const uint8_t *in, size_t len)
+{
+	uint8_t *out = *outp;
+	uint8_t c = in[0];
+	size_t n;
+
+	switch (c) {
+	case '"':
+		*out++ = '\\';
+		*out++ = '"';
+		break;
+	case '\\':
+		*out++ = '\\';
+		*out++ = '\\';
+		break;
+	case '\n':
+		*out++ = '\\';
+		*out++ = 'n';
+		break;
+	case '\r':
+		*out++ = '\\';
+		*out++ = 'r';
+		break;
+	case '\t':
+		*out++ = '\\';
+		*out++ = 't';
+		break;
+	case '\b':
+		*out++ = '\\';
+		*out++ = 'b';
+		break;
+	case '\f':
+		*out++ = '\\';
+		*out++ = 'f';
+		break;
+	default:
+		if (c < 0x20) {
+			memcpy(out, "\\u00", 4);
+			out[4] = hex_digits[c >> 4];
+			out[5] = hex_digits[c & 0xf];
+			out += 6;
+			break;
+		}
+		if (c < 0x80) {
+			*out++ = c;
+			break;
+		}
+		n = utf8_sequence(in, len);
+		if (!n) {
+			/* invalid byte, replaced by U+FFFD */
+			memcpy(out, "\xef\xbf\xbd", 3);
+			*outp = out + 3;
+			return 1;
+		}
+		memcpy(out, in, n);
+		*outp = out + n;
+		return n;
+	}
+	*outp = out;
+	return 1;
+}
+
+/* out must hold 6 * len bytes. Returns the escaped length. */
+size_t prov_json_escape(uint8_t *out, const uint8_t *in, size_t len, bool scalar)
+{
+	uint8_t *start = out;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	if (!scalar) {
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i space = _mm_set1_epi8(0x20);
+
+		while (i + 16 <= len) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+			/* signed compare: catches controls (< 0x20) and non-ASCII (>= 0x80) */
+			__m128i special = _mm_or_si128(_mm_cmplt_epi8(v, space),
+						       _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+								    _mm_cmpeq_epi8(v, backslash)));
+			unsigned int mask = _mm_movemask_epi8(special);
+			unsigned int prefix;
+
+			_mm_storeu_si128((__m128i *)out, v);
+			if (!mask) {
+				out += 16;
+				i += 16;
+				continue;
+			}
+			prefix = __builtin_ctz(mask);
+			out += prefix;
+			i += prefix;
+			i += escape_one(&out, in + i, len - i);
+		}
+	}
+#endif
+	while (i < len) {
+		uint8_t c = in[i];
+
+		if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+			*out++ = c;
+			i++;
+			continue;
+		}
+		i += escape_one(&out, in + i, len - i);
+	}
+	return out - start;
+}
+
+/* Structure, shared by both formats */
+
+static inline uint8_t *cbor_head(uint8_t *p, uint8_t major, uint64_t v)
+{
+	major <<= 5;
+	if (v < 24) {
+		*p++ = major | v;
+	} else if (v <= 0xff) {
+		*p++ = major | 24;
+		*p++ = v;
+	} else if (v <= 0xffff) {
+		*p++ = major | 25;
+		*p++ = v >> 8;
+		*p++ = v;
+	} else if (v <= 0xffffffffULL) {
+		*p++ = major | 26;
+		*p++ = v >> 24;
+		*p++ = v >> 16;
+		*p++ = v >> 8;
+		*p++ = v;
+	} else {
+		int s;
+
+		*p++ = major | 27;
+		for (s = 56; s >= 0; s -= 8)
+			*p++ = v >> s;
+	}
+	return p;
+}
+
+#define CBOR_UINT               0
+#define CBOR_NEGINT             1
+#define CBOR_BYTES              2
+#define CBOR_TEXT               3
+#define CBOR_MAP_INDEFINITE     0xbf
+#define CBOR_BREAK              0xff
+
+static inline void cbor_emit_head(struct prov_writer *w, uint8_t major, uint64_t v)
+{
+	uint8_t *p = reserve(w, 9);
+
+	w->len += cbor_head(p, major, v) - p;
+}
+
+static inline void json_separator(struct prov_writer *w)
+{
+	if (w->first[w->depth])
+		w->first[w->depth] = false;
+	else
+		emit_byte(w, ',');
+}
+
+/* Keys are literals from this file and never need escaping. */
+static inline void put_key(struct prov_writer *w, const char *key)
+{
+	size_t len = strlen(key);
+
+	if (w->format == PROV_FORMAT_CBOR) {
+		cbor_emit_head(w, CBOR_TEXT, len);
+		emit(w, key, len);
+		return;
+	}
+	json_separator(w);
+	reserve(w, len + 3);
+	w->buf[w->len++] = '"';
+	memcpy(w->buf + w->len, key, len);
+	w->len += len;
+	w->buf[w->len++] = '"';
+	w->buf[w->len++] = ':';
+}
+
+static inline void open_map(struct prov_writer *w, const char *key)
+{
+	if (key)
+		put_key(w, key);
+	emit_byte(w, w->format == PROV_FORMAT_CBOR ? CBOR_MAP_INDEFINITE : '{');
+	w->first[++w->depth] = true;
+}
+
+static inline void close_map(struct prov_writer *w)
+{
+	emit_byte(w, w->format == PROV_FORMAT_CBOR ? CBOR_BREAK : '}');
+	w->depth--;
+}
+
+static inline void emit_decimal(struct prov_writer *w, uint64_t v)
+{
+	char tmp[20];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	reserve(w, n);
+	while (n)
+		w->buf[w->len++] = tmp[--n];
+}
+
+static inline void put_uint(struct prov_writer *w, const char *key, uint64_t v)
+{
+	put_key(w, key);
+	if (w->format == PROV_FORMAT_CBOR)
+		cbor_emit_head(w, CBOR_UINT, v);
+	else
+		emit_decimal(w, v);
+}
+
+static inline void put_int(struct prov_writer *w, const char *key, int64_t v)
+{
+	if (v >= 0) {
+		put_uint(w, key, v);
+		return;
+	}
+	put_key(w, key);
+	if (w->format == PROV_FORMAT_CBOR) {
+		cbor_emit_head(w, CBOR_NEGINT, (uint64_t)(-(v + 1)));
+		return;
+	}
+	emit_byte(w, '-');
+	emit_decimal(w, (uint64_t)(-(v + 1)) + 1);
+}
+
+static inline void put_str(struct prov_writer *w, const char *key, const char *s, size_t len)
+{
+	uint8_t *p;
+
+	put_key(w, key);
+	if (w->format == PROV_FORMAT_CBOR) {
+		/* text strings must be valid UTF-8, keep anything else as bytes */
+		if (prov_utf8_valid((const uint8_t *)s, len, w->scalar))
+			cbor_emit_head(w, CBOR_TEXT, len);
+		else
+			cbor_emit_head(w, CBOR_BYTES, len);
+		emit(w, s, len);
+		return;
+	}
+	p = reserve(w, len * 6 + 2);
+	*p++ = '"';
+	p += prov_json_escape(p, (const uint8_t *)s, len, w->scalar);
+	*p++ = '"';
+	w->len = p - w->buf;
+}
+
+static inline size_t b64_encode(uint8_t *out, const uint8_t *in, size_t len)
+{
+	uint8_t *start = out;
+	size_t i;
+
+	for (i = 0; i + 3 <= len; i += 3) {
+		uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+
+		*out++ = b64_table[v >> 18];
+		*out++ = b64_table[(v >> 12) & 0x3f];
+		*out++ = b64_table[(v >> 6) & 0x3f];
+		*out++ = b64_table[v & 0x3f];
+	}
+	if (i < len) {
+		uint32_t v = in[i] << 16;
+
+		if (i + 1 < len)
+			v |= in[i + 1] << 8;
+		*out++ = b64_table[v >> 18];
+		*out++ = b64_table[(v >> 12) & 0x3f];
+		*out++ = i + 1 < len ? b64_table[(v >> 6) & 0x3f] : '=';
+		*out++ = '=';
+	}
+	return out - start;
+}
+
+/* Binary: base64 string in JSON, byte string in CBOR. */
+static inline void put_blob(struct prov_writer *w, const char *key, const void *data, size_t len)
+{
+	uint8_t *p;
+
+	put_key(w, key);
+	if (w->format == PROV_FORMAT_CBOR) {
+		cbor_emit_head(w, CBOR_BYTES, len);
+		emit(w, data, len);
+		return;
+	}
+	p = reserve(w, (len + 2) / 3 * 4 + 2);
+	*p++ = '"';
+	p += b64_encode(p, data, len);
+	*p++ = '"';
+	w->len = p - w->buf;
+}
+
+/* PROV qualified name of a record: "cf:" + base64 of its identifier. */
+static inline size_t identifier_name(char *out, const union prov_identifier *id)
+{
+	memcpy(out, "cf:", 3);
+	return 3 + b64_encode((uint8_t *)out + 3, id->buffer, PROV_IDENTIFIER_BUFFER_LENGTH);
+}
+
+static inline void put_identifier(struct prov_writer *w, const char *key, const union prov_identifier *id)
+{
+	char name[IDENTIFIER_NAME_SIZE];
+
+	put_str(w, key, name, identifier_name(name, id));
+}
+
+static inline void put_cstr(struct prov_writer *w, const char *key, const char *s, size_t max)
+{
+	put_str(w, key, s, strnlen(s, max));
+}
+
+static inline void put_uuid(struct prov_writer *w, const char *key, const uint8_t uuid[16])
+{
+	char s[37];
+	int i, n = 0;
+
+	for (i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			s[n++] = '-';
+		s[n++] = hex_digits[uuid[i] >> 4];
+		s[n++] = hex_digits[uuid[i] & 0xf];
+	}
+	put_str(w, key, s, n);
+}
+
+/* Records */
+
+static const char *node_kind(uint64_t type)
+{
+	if (prov_is_type(type, DM_ACTIVITY))
+		return "activity";
+	if (prov_is_type(type, DM_AGENT))
+		return "agent";
+	return "entity";
+}
+
+struct relation_kind {
+	const char *name;
+	const char *snd;
+	const char *rcv;
+};
+
+static const struct relation_kind relation_kinds[] = {
+	{ "wasDerivedFrom", "prov:usedEntity", "prov:generatedEntity" },
+	{ "wasGeneratedBy", "prov:activity", "prov:entity" },
+	{ "used", "prov:entity", "prov:activity" },
+	{ "wasInformedBy", "prov:informant", "prov:informed" },
+	{ "wasInfluencedBy", "prov:influencer", "prov:influencee" },
+};
+
+static const struct relation_kind *relation_kind(uint64_t type)
+{
+	if (prov_is_type(type, RL_DERIVED))
+		return &relation_kinds[0];
+	if (prov_is_type(type, RL_GENERATED))
+		return &relation_kinds[1];
+	if (prov_is_type(type, RL_USED))
+		return &relation_kinds[2];
+	if (prov_is_type(type, RL_INFORMED))
+		return &relation_kinds[3];
+	return &relation_kinds[4];
+}
+
+static void begin_document(struct prov_writer *w, const char *kind, const union prov_identifier *id)
+{
+	char name[IDENTIFIER_NAME_SIZE];
+	size_t len = identifier_name(name, id);
+
+	w->depth = 0;
+	w->first[0] = true;
+	open_map(w, NULL);
+	open_map(w, "prefix");
+	put_str(w, "cf", PROV_PREFIX_CF, sizeof(PROV_PREFIX_CF) - 1);
+	close_map(w);
+	open_map(w, kind);
+	/* the record name is a key, but it is base64 and needs no escaping */
+	name[len] = '\0';
+	open_map(w, name);
+}
+
+static void end_document(struct prov_writer *w)
+{
+	close_map(w);
+	close_map(w);
+	close_map(w);
+	if (w->format == PROV_FORMAT_JSON)
+		emit_byte(w, '\n');
+}
+
+static void write_relation(struct prov_writer *w, const struct relation_struct *r)
+{
+	uint64_t type = r->identifier.relation_id.type;
+	const struct relation_kind *kind = relation_kind(type);
+
+	begin_document(w, kind->name, &r->identifier);
+	put_cstr(w, "prov:type", relation_str(type), 64);
+	put_uint(w, "cf:id", r->identifier.relation_id.id);
+	put_uint(w, "cf:boot_id", r->identifier.relation_id.boot_id);
+	put_uint(w, "cf:machine_id", r->identifier.relation_id.machine_id);
+	put_uint(w, "cf:epoch", r->epoch);
+	put_uint(w, "cf:jiffies", r->jiffies);
+	put_identifier(w, kind->snd, &r->snd);
+	put_identifier(w, kind->rcv, &r->rcv);
+	put_uint(w, "cf:allowed", r->allowed);
+	if (r->set == FILE_INFO_SET)
+		put_int(w, "cf:offset", r->offset);
+	put_uint(w, "cf:flags", r->flags);
+	if (r->weight > 1)
+		put_uint(w, "cf:weight", r->weight);
+	end_document(w);
+}
+
+static void write_node(struct prov_writer *w, const union long_prov_elt *elt, bool is_long)
+{
+	const struct node_struct *n = &elt->node_info;
+	uint64_t type = n->identifier.node_id.type;
+	uint64_t size;
+
+	begin_document(w, node_kind(type), &n->identifier);
+	put_cstr(w, "prov:type", node_str(type), 64);
+	put_uint(w, "cf:id", n->identifier.node_id.id);
+	put_uint(w, "cf:boot_id", n->identifier.node_id.boot_id);
+	put_uint(w, "cf:machine_id", n->identifier.node_id.machine_id);
+	put_uint(w, "cf:version", n->identifier.node_id.version);
+	put_uint(w, "cf:epoch", n->epoch);
+	put_uint(w, "cf:jiffies", n->jiffies);
+	put_uint(w, "cf:uid", n->uid);
+	put_uint(w, "cf:gid", n->gid);
+	put_uint(w, "cf:secid", n->secid);
+
+	switch (type) {
+	case ACT_TASK:
+		put_uint(w, "cf:pid", elt->task_info.pid);
+		put_uint(w, "cf:vpid", elt->task_info.vpid);
+		break;
+	case ENT_PROC:
+		put_uint(w, "cf:tgid", elt->proc_info.tgid);
+		put_uint(w, "cf:utsns", elt->proc_info.utsns);
+		put_uint(w, "cf:ipcns", elt->proc_info.ipcns);
+		put_uint(w, "cf:mntns", elt->proc_info.mntns);
+		put_uint(w, "cf:pidns", elt->proc_info.pidns);
+		put_uint(w, "cf:netns", elt->proc_info.netns);
+		put_uint(w, "cf:cgroupns", elt->proc_info.cgroupns);
+		put_uint(w, "cf:utime", elt->proc_info.utime);
+		put_uint(w, "cf:stime", elt->proc_info.stime);
+		put_uint(w, "cf:vm", elt->proc_info.vm);
+		put_uint(w, "cf:rss", elt->proc_info.rss);
+		put_uint(w, "cf:hw_vm", elt->proc_info.hw_vm);
+		put_uint(w, "cf:hw_rss", elt->proc_info.hw_rss);
+		put_uint(w, "cf:rbytes", elt->proc_info.rbytes);
+		put_uint(w, "cf:wbytes", elt->proc_info.wbytes);
+		put_uint(w, "cf:cancel_wbytes", elt->proc_info.cancel_wbytes);
+		break;
+	case ENT_USAGE:
+		put_uint(w, "cf:tgid", elt->usage_info.tgid);
+		put_uint(w, "cf:utime", elt->usage_info.utime);
+		put_uint(w, "cf:stime", elt->usage_info.stime);
+		put_uint(w, "cf:vm", elt->usage_info.vm);
+		put_uint(w, "cf:rss", elt->usage_info.rss);
+		put_uint(w, "cf:hw_vm", elt->usage_info.hw_vm);
+		put_uint(w, "cf:hw_rss", elt->usage_info.hw_rss);
+		put_uint(w, "cf:rbytes", elt->usage_info.rbytes);
+		put_uint(w, "cf:wbytes", elt->usage_info.wbytes);
+		put_uint(w, "cf:cancel_wbytes", elt->usage_info.cancel_wbytes);
+		break;
+	case ENT_INODE_UNKNOWN:
+	case ENT_INODE_LINK:
+	case ENT_INODE_FILE:
+	case ENT_INODE_DIRECTORY:
+	case ENT_INODE_CHAR:
+	case ENT_INODE_BLOCK:
+	case ENT_INODE_PIPE:
+	case ENT_INODE_SOCKET:
+		put_uint(w, "cf:ino", elt->inode_info.ino);
+		put_uint(w, "cf:mode", elt->inode_info.mode);
+		put_uuid(w, "cf:uuid", elt->inode_info.sb_uuid);
+		break;
+	case ENT_IATTR:
+		put_uint(w, "cf:valid", elt->iattr_info.valid);
+		put_uint(w, "cf:mode", elt->iattr_info.mode);
+		put_int(w, "cf:size", elt->iattr_info.size);
+		put_int(w, "cf:atime", elt->iattr_info.atime);
+		put_int(w, "cf:ctime", elt->iattr_info.ctime);
+		put_int(w, "cf:mtime", elt->iattr_info.mtime);
+		break;
+	case ENT_MSG:
+		put_int(w, "cf:type", elt->msg_msg_info.type);
+		break;
+	case ENT_SHM:
+		put_uint(w, "cf:mode", elt->shm_info.mode);
+		break;
+	case ENT_SBLCK:
+		put_uuid(w, "cf:uuid", elt->sb_info.uuid);
+		break;
+	case ENT_PACKET:
+		put_uint(w, "cf:seq", elt->pck_info.identifier.packet_id.seq);
+		put_uint(w, "cf:length", elt->pck_info.length);
+		break;
+	}
+	if (!is_long)
+		goto out;
+
+	switch (type) {
+	case ENT_STR:
+		put_cstr(w, "cf:log", elt->str_info.str, PATH_MAX);
+		break;
+	case ENT_PATH:
+		put_cstr(w, "cf:pathname", elt->file_name_info.name, PATH_MAX);
+		break;
+	case ENT_ARG:
+	case ENT_ENV:
+		put_cstr(w, "cf:value", elt->arg_info.value, PATH_MAX);
+		if (elt->arg_info.truncated == PROV_TRUNCATED)
+			put_uint(w, "cf:truncated", 1);
+		break;
+	case ENT_ADDR:
+		put_blob(w, "cf:address", &elt->address_info.addr,
+			 elt->address_info.length < PATH_MAX ? elt->address_info.length : sizeof(struct sockaddr));
+		break;
+	case ENT_PCKCNT:
+		put_blob(w, "cf:content", elt->pckcnt_info.content,
+			 elt->pckcnt_info.length < PATH_MAX ? elt->pckcnt_info.length : PATH_MAX);
+		if (elt->pckcnt_info.truncated == PROV_TRUNCATED)
+			put_uint(w, "cf:truncated", 1);
+		break;
+	case ENT_DISC:
+	case ACT_DISC:
+	case AGT_DISC:
+		put_str(w, "cf:content", elt->disc_node_info.content,
+			elt->disc_node_info.length < PATH_MAX ? elt->disc_node_info.length : PATH_MAX);
+		break;
+	case ENT_XATTR:
+		put_cstr(w, "cf:name", elt->xattr_info.name, PROV_XATTR_NAME_SIZE);
+		if (provenance_is_hashed(elt)) {
+			/* the size is also kept after the hash, records of sized channels stop there */
+			memcpy(&size, elt->xattr_info.value + sizeof(uint64_t), sizeof(uint64_t));
+			put_blob(w, "cf:value_xxh64", elt->xattr_info.value, sizeof(uint64_t));
+			put_uint(w, "cf:size", size);
+			break;
+		}
+		put_blob(w, "cf:value", elt->xattr_info.value,
+			 elt->xattr_info.size < PROV_XATTR_VALUE_SIZE ? elt->xattr_info.size : PROV_XATTR_VALUE_SIZE);
+		break;
+	case AGT_MACHINE:
+		put_uint(w, "cf:cam_major", elt->machine_info.cam_major);
+		put_uint(w, "cf:cam_minor", elt->machine_info.cam_minor);
+		put_uint(w, "cf:cam_patch", elt->machine_info.cam_patch);
+		put_cstr(w, "cf:u_sysname", elt->machine_info.utsname.sysname, sizeof(elt->machine_info.utsname.sysname));
+		put_cstr(w, "cf:u_nodename", elt->machine_info.utsname.nodename, sizeof(elt->machine_info.utsname.nodename));
+		put_cstr(w, "cf:u_release", elt->machine_info.utsname.release, sizeof(elt->machine_info.utsname.release));
+		put_cstr(w, "cf:u_version", elt->machine_info.utsname.version, sizeof(elt->machine_info.utsname.version));
+		put_cstr(w, "cf:u_machine", elt->machine_info.utsname.machine, sizeof(elt->machine_info.utsname.machine));
+		put_cstr(w, "cf:u_domainname", elt->machine_info.utsname.domainname, sizeof(elt->machine_info.utsname.domainname));
+		put_cstr(w, "cf:commit", elt->machine_info.commit, sizeof(elt->machine_info.commit));
+		break;
+	}
+out:
+	end_document(w);
+}
+
+static int write_record(struct prov_writer *w, const union long_prov_elt *elt, bool is_long)
+{
+	/* make room for the largest document up front */
+	reserve(w, MAX_EMIT * 2);
+	if (prov_is_relation(elt))
+		write_relation(w, &elt->relation_info);
+	else
+		write_node(w, elt, is_long);
+	return w->error;
+}
+
+/* Only the union prov_elt sized prefix is read when is_long is false. */
+int prov_write_elt(struct prov_writer *w, const union prov_elt *elt)
+{
+	return write_record(w, (const union long_prov_elt *)elt, false);
+}
+
+int prov_write_long_elt(struct prov_writer *w, const union long_prov_elt *elt)
+{
+	return write_record(w, elt, true);
+}
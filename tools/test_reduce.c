@@ -0,0 +1,260 @@
+/*
+ *
+ * Author: Thomas Pasquier <thomas.pasquier@bristol.ac.uk>
+ *
+ * Copyright (C) 2015-2019 University of Cambridge, Harvard University, University of Bristol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * Trace replay test of the rule of the graph reduction mode ("reduce").
+ * This is a model: the kernel code cannot be built in userspace, so the rule
+ * of is_redundant_relation and the versioning of __update_version (see
+ * security/provenance/include/provenance_record.h) are restated below, and
+ * only what decides the shape of the graph is kept. Filters, sampling, rate
+ * limiting, edge compression and the saved and name state are left out. The
+ * test checks that the rule preserves ancestry, not that the kernel
+ * implements it; both must be kept in step by hand.
+ * A synthetic trace of flows between tasks and files is replayed through the
+ * model, once as captured and once reduced, with and without node
+ * compression. Each replay is written as
+ * a relay dump that camflow-lineage indexes, the flow number standing for
+ * jiffies. After every flow, the version the destination then has in each
+ * replay is written to a query file, one "flow full reduced" line per flow;
+ * test_reduce.sh checks that the ancestors of both, up to that flow, are the
+ * same nodes. Compressed nodes keep receiving flows after they are queried,
+ * hence the bound.
+ * The trace starts with the edge cases of the reduction: the same version of
+ * a source flowing again with a different relation type, before and after
+ * the destination influenced another node.
+ */
+#include "prov_tools.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+#define NB_TASKS        8
+#define NB_FILES        24
+#define NB_NODES        (NB_TASKS + NB_FILES)
+
+struct node {
+	uint64_t type;
+	uint64_t id;
+	uint32_t version;
+	uint64_t previous_id;
+	uint64_t previous_type;
+	uint32_t previous_version;
+	bool recorded;
+	bool outgoing;
+};
+
+struct replay {
+	bool reduce;
+	bool compress_node;
+	struct node nodes[NB_NODES];
+	FILE *dump;
+	uint64_t jiffies;
+	uint64_t nb_relations;
+};
+
+struct flow {
+	uint64_t type;
+	int from;
+	int to;
+};
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "test_reduce: %s: %s\n", msg, errno ? strerror(errno) : "invalid input");
+	exit(EXIT_FAILURE);
+}
+
+static void set_identifier(union prov_identifier *id, const struct node *n)
+{
+	memset(id, 0, sizeof(*id));
+	id->node_id.type = n->type;
+	id->node_id.id = n->id;
+	id->node_id.version = n->version;
+}
+
+/* __write_relation: the end points are recorded with the relation. */
+static void write_relation(struct replay *r, uint64_t type, struct node *from, struct node *to)
+{
+	union prov_elt elt;
+
+	memset(&elt, 0, sizeof(elt));
+	relation_identifier(&elt).type = type;
+	relation_identifier(&elt).id = ++r->nb_relations;
+	prov_jiffies(&elt) = r->jiffies;
+	set_identifier(&elt.relation_info.snd, from);
+	set_identifier(&elt.relation_info.rcv, to);
+	if (fwrite(&elt, sizeof(elt), 1, r->dump) != 1)
+		die("write failed");
+	from->recorded = true;
+	to->recorded = true;
+}
+
+/* __update_version, versions are not updated by the relations of filter_update_node */
+static void update_version(struct replay *r, uint64_t type, struct node *n)
+{
+	struct node old;
+
+	if (!n->outgoing && r->compress_node)
+		return;
+	if (type == RL_VERSION_TASK || type == RL_VERSION || type == RL_NAMED || type == RL_NAMED_PROCESS)
+		return;
+	old = *n;
+	n->version++;
+	n->recorded = false;
+	write_relation(r, n->type == ACT_TASK ? RL_VERSION_TASK : RL_VERSION, &old, n);
+	n->outgoing = false;
+}
+
+/* is_redundant_relation, as restated */
+static bool is_redundant(const struct node *from, const struct node *to)
+{
+	if (!from->recorded || !to->recorded)
+		return false;
+	return to->previous_id == from->id && to->previous_version == from->version;
+}
+
+/* record_relation, as restated */
+static void record_relation(struct replay *r, uint64_t type, struct node *from, struct node *to)
+{
+	if (r->reduce && is_redundant(from, to))
+		return;
+	to->previous_id = from->id;
+	to->previous_type = type;
+	to->previous_version = from->version;
+	update_version(r, type, to);
+	from->outgoing = true;
+	write_relation(r, type, from, to);
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+#define NODE_TASK(i)    (i)
+#define NODE_FILE(i)    (NB_TASKS + (i))
+
+static const struct flow edge_cases[] = {
+	{ RL_READ, NODE_FILE(0), NODE_TASK(0) },
+	{ RL_MMAP_READ, NODE_FILE(0), NODE_TASK(0) },    // same source version, different type
+	{ RL_READ, NODE_FILE(0), NODE_TASK(0) },
+	{ RL_WRITE, NODE_TASK(0), NODE_FILE(1) },        // the destination influences another node
+	{ RL_READ_IOCTL, NODE_FILE(0), NODE_TASK(0) },   // ... and receives the same source version again
+	{ RL_READ, NODE_FILE(1), NODE_TASK(1) },
+	{ RL_WRITE, NODE_TASK(2), NODE_FILE(0) },        // the source gets a new version
+	{ RL_READ, NODE_FILE(0), NODE_TASK(0) },
+	{ RL_MMAP_READ, NODE_FILE(0), NODE_TASK(0) },
+	{ RL_CLONE, NODE_TASK(0), NODE_TASK(3) },
+	{ RL_CLONE, NODE_TASK(0), NODE_TASK(3) },
+};
+
+static void next_flow(uint64_t *s, struct flow *f)
+{
+	static const uint64_t reads[] = { RL_READ, RL_MMAP_READ, RL_READ_IOCTL };
+	static const uint64_t writes[] = { RL_WRITE, RL_WRITE_IOCTL };
+	/* few files, so that the same versions flow again */
+	int task = xorshift(s) % NB_TASKS;
+	int file = xorshift(s) % (NB_FILES / 4);
+
+	switch (xorshift(s) % 8) {
+	case 0:
+		f->type = RL_CLONE;
+		f->from = NODE_TASK(task);
+		f->to = NODE_TASK((task + 1 + xorshift(s) % (NB_TASKS - 1)) % NB_TASKS);
+		break;
+	case 1:
+	case 2:
+	case 3:
+		f->type = writes[xorshift(s) % 2];
+		f->from = NODE_TASK(task);
+		f->to = NODE_FILE(file);
+		break;
+	default:
+		f->type = reads[xorshift(s) % 3];
+		f->from = NODE_FILE(file);
+		f->to = NODE_TASK(task);
+		break;
+	}
+}
+
+static void init_replay(struct replay *r, const char *dir, const char *config, bool reduce, bool compress_node)
+{
+	char path[PATH_MAX];
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	r->reduce = reduce;
+	r->compress_node = compress_node;
+	for (i = 0; i < NB_NODES; i++) {
+		r->nodes[i].type = i < NB_TASKS ? ACT_TASK : ENT_INODE_FILE;
+		r->nodes[i].id = i + 1;
+	}
+	snprintf(path, sizeof(path), "%s/%s.%s", dir, config, reduce ? "reduced" : "full");
+	r->dump = fopen(path, "w");
+	if (!r->dump)
+		die(path);
+}
+
+static void run(const char *dir, const char *config, bool compress_node, unsigned int steps, uint64_t seed)
+{
+	struct replay full, reduced;
+	char path[PATH_MAX];
+	struct flow f;
+	unsigned int i;
+	FILE *queries;
+
+	init_replay(&full, dir, config, false, compress_node);
+	init_replay(&reduced, dir, config, true, compress_node);
+	snprintf(path, sizeof(path), "%s/%s.queries", dir, config);
+	queries = fopen(path, "w");
+	if (!queries)
+		die(path);
+	for (i = 0; i < steps; i++) {
+		if (i < sizeof(edge_cases) / sizeof(edge_cases[0]))
+			f = edge_cases[i];
+		else
+			next_flow(&seed, &f);
+		full.jiffies = reduced.jiffies = i;
+		record_relation(&full, f.type, &full.nodes[f.from], &full.nodes[f.to]);
+		record_relation(&reduced, f.type, &reduced.nodes[f.from], &reduced.nodes[f.to]);
+		fprintf(queries, "%u %llu:%u %llu:%u\n", i,
+			(unsigned long long)full.nodes[f.to].id, full.nodes[f.to].version,
+			(unsigned long long)reduced.nodes[f.to].id, reduced.nodes[f.to].version);
+	}
+	if (fclose(full.dump) || fclose(reduced.dump) || fclose(queries))
+		die("write failed");
+	printf("test_reduce: %s: %u flows, %llu relations captured, %llu reduced\n", config, steps,
+	       (unsigned long long)full.nb_relations, (unsigned long long)reduced.nb_relations);
+	if (reduced.nb_relations >= full.nb_relations) {
+		fprintf(stderr, "test_reduce: %s: nothing was reduced\n", config);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int steps = 1000;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s <directory> [flows] [seed]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc > 2)
+		steps = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		seed = strtoull(argv[3], NULL, 0) | 1;
+	run(argv[1], "versioned", false, steps, seed);
+	run(argv[1], "compress_node", true, steps, seed);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Checks that the rule of the graph reduction mode ("reduce"), as modelled by
+# test_reduce.c, preserves ancestry.
+# test_reduce replays a trace with and without reduction; every query it
+# writes is run against both graphs with camflow-lineage, up to the flow it
+# was written after, and the nodes (identifiers, whatever their versions)
+# reached must be the same.
+#
+# usage: test_reduce.sh [flows] [seed]
+
+cd "$(dirname "$0")" || exit 1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+./test_reduce "$dir" "$@" || exit 1
+
+fail=0
+for config in versioned compress_node; do
+	./camflow-lineage index "$dir/$config.full.idx" "$dir/$config.full" 2>/dev/null || exit 1
+	./camflow-lineage index "$dir/$config.reduced.idx" "$dir/$config.reduced" 2>/dev/null || exit 1
+	nb=0
+	while read -r flow full reduced; do
+		./camflow-lineage query -a -e "$flow" "$dir/$config.full.idx" "$full" 2>/dev/null | cut -d: -f1 | sort -u > "$dir/full.out"
+		./camflow-lineage query -a -e "$flow" "$dir/$config.reduced.idx" "$reduced" 2>/dev/null | cut -d: -f1 | sort -u > "$dir/reduced.out"
+		if [ ! -s "$dir/full.out" ] || ! cmp -s "$dir/full.out" "$dir/reduced.out"; then
+			echo "test_reduce: $config: flow $flow: ancestors of $full and $reduced differ"
+			fail=1
+		fi
+		nb=$((nb + 1))
+	done < "$dir/$config.queries"
+	echo "test_reduce: $config: $nb ancestry queries compared"
+done
+[ $fail -eq 0 ] && echo "test_reduce: passed"
+exit $fail